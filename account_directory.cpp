@@ -0,0 +1,112 @@
+#include "account_directory.h"
+#include "common.h"
+#include <sddl.h>
+#include <atomic>
+#include <iostream>
+#include <vector>
+
+namespace {
+
+const wchar_t kSidCacheVariable[] = L"ACLTOOL_SID_CACHE";
+
+std::wstring GetSidCachePath() {
+    DWORD size = GetEnvironmentVariableW(kSidCacheVariable, nullptr, 0);
+    if (size == 0) {
+        return std::wstring();
+    }
+
+    std::wstring path(size, L'\0');
+    size = GetEnvironmentVariableW(kSidCacheVariable, &path[0], size);
+    path.resize(size);
+    return path;
+}
+
+std::atomic<bool> g_sidResolverUsed{false};
+
+}  // namespace
+
+SidLookupResult WindowsAccountDirectory::LookupSid(const std::wstring& sid, std::wstring& accountName) {
+    PSID binarySid = nullptr;
+    if (!ConvertStringSidToSidW(sid.c_str(), &binarySid)) {
+        return SidLookupResult::Failed;
+    }
+
+    DWORD nameSize = 0;
+    DWORD domainSize = 0;
+    SID_NAME_USE use;
+    LookupAccountSidW(nullptr, binarySid, nullptr, &nameSize, nullptr, &domainSize, &use);
+
+    DWORD err = GetLastError();
+    if (err != ERROR_INSUFFICIENT_BUFFER) {
+        LocalFree(binarySid);
+        return err == ERROR_NONE_MAPPED ? SidLookupResult::NotMapped : SidLookupResult::Failed;
+    }
+
+    std::vector<wchar_t> name(nameSize);
+    std::vector<wchar_t> domain(domainSize);
+    BOOL ok = LookupAccountSidW(nullptr, binarySid, name.data(), &nameSize, domain.data(), &domainSize, &use);
+    err = GetLastError();
+    LocalFree(binarySid);
+
+    if (!ok) {
+        return err == ERROR_NONE_MAPPED ? SidLookupResult::NotMapped : SidLookupResult::Failed;
+    }
+
+    accountName.clear();
+    if (!domain.empty() && domain[0] != L'\0') {
+        accountName = domain.data();
+        accountName += L'\\';
+    }
+    accountName += name.data();
+    return SidLookupResult::Found;
+}
+
+std::wstring SidToString(PSID sid) {
+    LPWSTR sidString = nullptr;
+    if (!ConvertSidToStringSidW(sid, &sidString)) {
+        return std::wstring();
+    }
+
+    std::wstring result = sidString;
+    LocalFree(sidString);
+    return result;
+}
+
+std::wstring DescribeSid(PSID sid) {
+    std::wstring sidString = SidToString(sid);
+    if (sidString.empty()) {
+        return L"<invalid SID>";
+    }
+
+    std::wstring name = GetSidResolver().Resolve(sidString);
+    if (name == sidString) {
+        return sidString;  // Unresolved, don't print it twice
+    }
+    return sidString + L" (" + name + L")";
+}
+
+SidResolver& GetSidResolver() {
+    static WindowsAccountDirectory directory;
+    static SidResolver& resolver = []() -> SidResolver& {
+        static SidResolver instance(directory);
+        std::wstring path = GetSidCachePath();
+        if (!path.empty()) {
+            instance.LoadCache(path);  // A missing cache file is not an error
+        }
+        return instance;
+    }();
+
+    g_sidResolverUsed.store(true, std::memory_order_relaxed);
+    return resolver;
+}
+
+void SaveSidResolverCache() {
+    if (!g_sidResolverUsed.load(std::memory_order_relaxed)) {
+        return;  // Nothing was resolved this run
+    }
+
+    std::wstring path = GetSidCachePath();
+    if (!path.empty() && !GetSidResolver().SaveCache(path)) {
+        std::wcerr << L"Failed to write SID cache: " << path << L"\n";
+    }
+}
@@ -0,0 +1,21 @@
+#pragma once
+#include <windows.h>
+#include <string>
+#include "sid_resolver.h"
+
+// AccountDirectory backed by LookupAccountSidW on the local machine
+class WindowsAccountDirectory : public AccountDirectory {
+public:
+    SidLookupResult LookupSid(const std::wstring& sid, std::wstring& accountName) override;
+};
+
+// Returns the string form of a SID ("S-1-5-18"), or an empty string on failure
+std::wstring SidToString(PSID sid);
+
+// Returns "S-1-5-18 (NT AUTHORITY\SYSTEM)" for display
+std::wstring DescribeSid(PSID sid);
+
+// Process-wide resolver. If ACLTOOL_SID_CACHE names a file, it is loaded on
+// first use and written back by SaveSidResolverCache().
+SidResolver& GetSidResolver();
+void SaveSidResolverCache();
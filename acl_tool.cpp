@@ -2,50 +2,194 @@
 #include <windows.h>
 #include <string>
 #include <iostream>
+#include <vector>
 
 #include "common.h"
+#include "batch_plan.h"
+#include "concurrency_benchmark.h"
+#include "account_directory.h"
 #include "event_operations.h"
 #include "service_operations.h"
 #include "process_operations.h"
 #include "file_operations.h"
+#include "serve.h"
+#include "sid_resolver_benchmark.h"
+#include "trace.h"
+#include "trace_replay.h"
 
-int wmain(int argc, wchar_t* argv[]) {
-    if (argc != 4) {
-        std::wcerr << L"Usage: AclTool.exe [--event <event-name>|--service <service-name>|--process <PID|process-name>|--file <file-path>] <command>\n\n";
-        std::wcerr << L"Event commands:\n";
-        std::wcerr << L"  set      : Set the event to signaled state\n";
-        std::wcerr << L"  unset    : Reset the event to non-signaled state\n";
-        std::wcerr << L"  harden   : Apply restrictive ACL\n";
-        std::wcerr << L"  query    : Query the event state (this will reset synchronization events)\n";
-        std::wcerr << L"  takeown  : Transfer ownership to Administrators\n";
-        std::wcerr << L"  weaken   : Grant Everyone full access\n\n";
-        std::wcerr << L"Service commands:\n";
-        std::wcerr << L"  start    : Start the service\n";
-        std::wcerr << L"  stop     : Stop the service\n";
-        std::wcerr << L"  query    : Query the service status\n";
-        std::wcerr << L"  harden   : Apply restrictive ACL\n";
-        std::wcerr << L"  takeown  : Transfer ownership to Administrators\n";
-        std::wcerr << L"  weaken   : Grant Everyone full access\n\n";
-        std::wcerr << L"Process commands:\n";
-        std::wcerr << L"  terminate: Terminate the process\n";
-        std::wcerr << L"  harden   : Apply restrictive ACL (spoiler alert - this is useless thanks to SE_DEBUG_NAME)\n";
-        std::wcerr << L"  takeown  : Transfer ownership to Administrators\n";
-        std::wcerr << L"  weaken   : Grant Everyone full access\n\n";
-        std::wcerr << L"File commands:\n";
-        std::wcerr << L"  harden   : Apply restrictive ACL\n";
-        std::wcerr << L"  takeown  : Transfer ownership to Administrators\n";
-        std::wcerr << L"  weaken   : Grant Everyone full access\n";
+namespace {
+
+void PrintUsage() {
+    std::wcerr << L"Usage: AclTool.exe [--trace <trace-file>] [--event <event-name>|--service <service-name>|--process <PID|process-name>|--file <file-path>] <command>[,<command>...]\n\n";
+    std::wcerr << L"       AclTool.exe [--trace <trace-file>] --batch <batch-file> [--plan]\n\n";
+    std::wcerr << L"Commands can be chained and run in order against a single open of the object,\n";
+    std::wcerr << L"e.g. --service <service-name> takeown,weaken,stop\n\n";
+    std::wcerr << L"--batch runs a file of \"<type> <name> <commands>\" lines (type is event, service,\n";
+    std::wcerr << L"process or file) as one planned run: duplicates are dropped, commands for the\n";
+    std::wcerr << L"same object are merged, and work is grouped by type and by directory. --plan\n";
+    std::wcerr << L"prints the plan and its estimated cost without running it.\n\n";
+    std::wcerr << L"--trace records every backend call (opens, security changes, privilege and\n";
+    std::wcerr << L"service control) to a binary trace, which can be replayed against the\n";
+    std::wcerr << L"simulated backend with:\n";
+    std::wcerr << L"  AclTool.exe --replay <trace-file> [--paced] [--print]\n\n";
+    std::wcerr << L"--serve keeps AclTool resident with privileges enabled, the SCM connection open\n";
+    std::wcerr << L"and resolved account names cached, running commands sent by --client over a\n";
+    std::wcerr << L"local named pipe (SYSTEM and Administrators only). --client-load benchmarks it:\n";
+    std::wcerr << L"  AclTool.exe --serve [--endpoint <pipe-name>]\n";
+    std::wcerr << L"  AclTool.exe --client [--endpoint <pipe-name>] (--shutdown | <arguments>)\n";
+    std::wcerr << L"  AclTool.exe --client-load [--endpoint <pipe-name>] [--connections <n>] [--requests <n>] [<arguments>]\n\n";
+    std::wcerr << L"--concurrency-benchmark drives the simulated backend with injected latency\n";
+    std::wcerr << L"curves under each concurrency policy:\n";
+    std::wcerr << L"  AclTool.exe --concurrency-benchmark [--object <type>]... [--operations <n>] [--max <n>]\n";
+    std::wcerr << L"              [--curve <capacity>,<service-us>,<collapse>,<fail-above>]\n\n";
+    std::wcerr << L"--sid-resolver-benchmark checks the account name cache and times cached lookups:\n";
+    std::wcerr << L"  AclTool.exe --sid-resolver-benchmark [--sids <n>] [--lookups <n>] [--threads <n>]\n\n";
+    std::wcerr << L"Event commands:\n";
+    std::wcerr << L"  set      : Set the event to signaled state\n";
+    std::wcerr << L"  unset    : Reset the event to non-signaled state\n";
+    std::wcerr << L"  harden   : Apply restrictive ACL\n";
+    std::wcerr << L"  query    : Query the event state (this will reset synchronization events)\n";
+    std::wcerr << L"  state    : Read the event type and state without waiting on it\n";
+    std::wcerr << L"  probe    : Measure set -> wake latency; creates the event if needed\n";
+    std::wcerr << L"             [--waiters <n>] [--iterations <n>] [--auto-reset] [--simulated]\n";
+    std::wcerr << L"  takeown  : Transfer ownership to Administrators\n";
+    std::wcerr << L"  weaken   : Grant Everyone full access\n\n";
+    std::wcerr << L"Service commands:\n";
+    std::wcerr << L"  start    : Start the service\n";
+    std::wcerr << L"  stop     : Stop the service\n";
+    std::wcerr << L"  query    : Query the service status\n";
+    std::wcerr << L"  harden   : Apply restrictive ACL\n";
+    std::wcerr << L"  takeown  : Transfer ownership to Administrators\n";
+    std::wcerr << L"  weaken   : Grant Everyone full access\n\n";
+    std::wcerr << L"Process commands:\n";
+    std::wcerr << L"  terminate: Terminate the process\n";
+    std::wcerr << L"  harden   : Apply restrictive ACL (spoiler alert - this is useless thanks to SE_DEBUG_NAME)\n";
+    std::wcerr << L"  takeown  : Transfer ownership to Administrators\n";
+    std::wcerr << L"  weaken   : Grant Everyone full access\n";
+    std::wcerr << L"             [--tree] also every descendant, leaves first; [--workers <n>] threads for --tree\n";
+    std::wcerr << L"             [--concurrency <fixed|aimd|gradient>] how many workers act at once (default gradient)\n\n";
+    std::wcerr << L"File commands:\n";
+    std::wcerr << L"  harden   : Apply restrictive ACL\n";
+    std::wcerr << L"  takeown  : Transfer ownership to Administrators\n";
+    std::wcerr << L"  weaken   : Grant Everyone full access\n";
+    std::wcerr << L"             [--recursive] applies to everything below a directory\n";
+    std::wcerr << L"             [--queue-depth <n>] most objects in flight at once with --recursive (default 256)\n";
+    std::wcerr << L"             [--concurrency <fixed|aimd|gradient>] how much of the queue depth is used (default gradient)\n";
+}
+
+int ProcessBatchArgs(const std::vector<std::wstring>& args) {
+    BatchCommandOptions options;
+    if (!ParseBatchCommandOptions(args, 3, options)) {
+        return 1;
+    }
+    std::vector<BatchRecord> records;
+    if (!ReadBatchFile(args[2], records)) {
         return 1;
     }
 
-    std::wstring objectType = argv[1];
-    std::wstring objectName = argv[2];
-    std::wstring command    = argv[3];
+    BatchPlanOptions planOptions;
+    planOptions.caseInsensitiveNames = true;
+    planOptions.pathSeparators = L"\\/";
+    planOptions.readDiskOrder = ReadFileDiskOrder;
+    BatchPlan plan = BuildBatchPlan(records, planOptions);
+    if (options.planOnly) {
+        PrintBatchPlan(std::wcout, plan);
+        return 0;
+    }
 
-    if (objectType == L"--event") {
-        return ProcessEventCommand(objectName, command);
+    std::wcout << L"Running " << plan.items.size() << L" object(s) from " << plan.records << L" record(s)\n";
+    uint64_t failures = RunBatchPlan(plan, [](BatchObjectType type, const std::vector<const BatchItem*>& items) -> uint64_t {
+        switch (type) {
+            case BatchObjectType::Service:
+                return ProcessServiceBatch(items);
+            case BatchObjectType::Process:
+                return ProcessProcessBatch(items);
+            case BatchObjectType::File:
+                return ProcessFileBatch(items);
+            default: {
+                // Events need no privileges or shared connection
+                uint64_t failed = 0;
+                for (const BatchItem* item : items) {
+                    failed += ProcessEventCommand(item->name, item->commands) != 0 ? 1 : 0;
+                }
+                return failed;
+            }
+        }
+    });
+    return failures ? 1 : 0;
+}
+
+// Everything but the resident server and its clients, so --serve can run
+// the same command lines
+int RunCommand(std::vector<std::wstring> args) {
+    if (args.size() >= 3 && args[1] == L"--replay") {
+        ReplayOptions options;
+        if (!ParseReplayOptions(args, 3, options)) {
+            return 1;
+        }
+        return ReplayTrace(args[2], options);
+    }
+
+    if (args.size() >= 2 && args[1] == L"--concurrency-benchmark") {
+        ConcurrencyBenchmarkOptions options;
+        if (!ParseConcurrencyBenchmarkOptions(args, 2, options)) {
+            return 1;
+        }
+        return RunConcurrencyBenchmark(options);
+    }
+
+    if (args.size() >= 2 && args[1] == L"--sid-resolver-benchmark") {
+        SidResolverBenchmarkOptions options;
+        if (!ParseSidResolverBenchmarkOptions(args, 2, options)) {
+            return 1;
+        }
+        return RunSidResolverBenchmark(options);
+    }
+
+    bool tracing = (args.size() >= 3 && args[1] == L"--trace");
+    if (tracing) {
+        if (!StartTraceRecording(args[2])) {
+            std::wcerr << L"Failed to create trace file: " << args[2] << L"\n";
+            return 1;
+        }
+        args.erase(args.begin() + 1, args.begin() + 3);
+    }
+
+    if (args.size() >= 3 && args[1] == L"--batch") {
+        int result = ProcessBatchArgs(args);
+        if (tracing) {
+            StopTraceRecording();
+        }
+        return result;
+    }
+
+    if (args.size() < 4) {
+        PrintUsage();
+        return 1;
+    }
+
+    std::wstring objectType = args[1];
+    std::wstring objectName = args[2];
+    std::wstring command    = args[3];
+
+    // Only the event probe, files and processes take options after the command
+    bool isEventProbe = (objectType == L"--event" && command == L"probe");
+    if (args.size() > 4 && !isEventProbe && objectType != L"--file" && objectType != L"--process") {
+        PrintUsage();
+        return 1;
+    }
+
+    int result = 1;
+    if (isEventProbe) {
+        EventProbeOptions options;
+        if (!ParseEventProbeOptions(args, 4, options)) {
+            return 1;
+        }
+        result = ProcessEventProbe(objectName, options);
+    } else if (objectType == L"--event") {
+        result = ProcessEventCommand(objectName, command);
     } else if (objectType == L"--service") {
-        return ProcessServiceCommand(objectName, command);
+        result = ProcessServiceCommand(objectName, command);
     } else if (objectType == L"--process") {
         // Try to parse as process ID first
         wchar_t* endPtr = nullptr;
@@ -59,12 +203,68 @@ int wmain(int argc, wchar_t* argv[]) {
             }
         }
         
-        return ProcessProcessCommand(processId, command);
+        ProcessCommandOptions options;
+        if (!ParseProcessCommandOptions(args, 4, options)) {
+            return 1;
+        }
+        result = ProcessProcessCommand(processId, command, options);
     } else if (objectType == L"--file") {
-        return ProcessFileCommand(objectName, command);
+        FileCommandOptions options;
+        if (!ParseFileCommandOptions(args, 4, options)) {
+            return 1;
+        }
+        result = ProcessFileCommand(objectName, command, options);
     } else {
         std::wcerr << L"Unknown object type: " << objectType << L"\n";
         std::wcerr << L"Valid types: --event, --service, --process, --file\n";
         return 1;
     }
+
+    if (tracing) {
+        StopTraceRecording();
+    }
+    return result;
+}
+
+// Privileges, the SCM connection and resolved account names are set up once
+// and kept for every request
+int Serve(const std::vector<std::wstring>& args) {
+    ServeOptions options;
+    if (!ParseServeOptions(args, 2, options)) {
+        return 1;
+    }
+    HoldPrivileges({ SE_TAKE_OWNERSHIP_NAME, SE_RESTORE_NAME, SE_DEBUG_NAME });
+    if (!KeepServiceManagerConnected()) {
+        std::wcerr << L"Service commands will connect to the SCM per request\n";
+    }
+    return RunServer(options, RunCommand);
+}
+
+}  // namespace
+
+int wmain(int argc, wchar_t* argv[]) {
+    std::vector<std::wstring> args(argv, argv + argc);
+
+    int result = 1;
+    if (args.size() >= 2 && args[1] == L"--serve") {
+        result = Serve(args);
+    } else if (args.size() >= 2 && args[1] == L"--client") {
+        ClientOptions options;
+        if (!ParseClientOptions(args, 2, options)) {
+            return 1;
+        }
+        return RunClient(options);
+    } else if (args.size() >= 2 && args[1] == L"--client-load") {
+        ClientLoadOptions options;
+        if (!ParseClientLoadOptions(args, 2, options)) {
+            return 1;
+        }
+        return RunClientLoad(options);
+    } else {
+        result = RunCommand(args);
+    }
+
+    // Persist resolved account names for the next run (ACLTOOL_SID_CACHE)
+    SaveSidResolverCache();
+    return result;
 }
\ No newline at end of file
@@ -0,0 +1,319 @@
+// AclTool entry point for non-Windows builds. Files are handled by the POSIX
+// ACL backend on Linux; events only exist as the simulated backend, which
+// lets the portable parts of the tool be exercised and benchmarked here.
+#include <clocale>
+#include <iterator>
+#include <string>
+#include <iostream>
+#include <vector>
+
+#include "batch_plan.h"
+#include "command_chain.h"
+#include "concurrency_benchmark.h"
+#include "event_probe.h"
+#include "serve.h"
+#include "sid_resolver_benchmark.h"
+#include "trace.h"
+#include "trace_replay.h"
+#include "utf8.h"
+#ifdef __linux__
+#include "file_operations.h"
+#include "posix_acl_benchmark.h"
+#include "process_operations.h"
+#include "process_tree_benchmark.h"
+#endif
+
+namespace {
+
+void PrintUsage() {
+    std::wcerr << L"Usage: AclTool [--trace <trace-file>] [--event <event-name>|--process <PID|name>|--file <file-path>] <command>[,<command>...]\n";
+    std::wcerr << L"       AclTool [--trace <trace-file>] --batch <batch-file> [--plan]\n";
+    std::wcerr << L"       AclTool --replay <trace-file> [--paced] [--print]\n";
+    std::wcerr << L"       AclTool --serve [--endpoint <name>]\n";
+    std::wcerr << L"       AclTool --client [--endpoint <name>] (--shutdown | <arguments>)\n";
+    std::wcerr << L"       AclTool --client-load [--endpoint <name>] [--connections <n>] [--requests <n>] [<arguments>]\n";
+    std::wcerr << L"       AclTool --concurrency-benchmark [--object <type>]... [--operations <n>] [--max <n>]\n";
+    std::wcerr << L"               [--curve <capacity>,<service-us>,<collapse>,<fail-above>]\n";
+    std::wcerr << L"       AclTool --sid-resolver-benchmark [--sids <n>] [--lookups <n>] [--threads <n>]\n";
+#ifdef __linux__
+    std::wcerr << L"       AclTool --process-tree-benchmark [--processes <n>] [--fanout <n>] [--workers <n>]\n";
+    std::wcerr << L"       AclTool --posix-acl-benchmark [--dir <path>] [--files <n>]\n";
+#endif
+    std::wcerr << L"\n";
+    std::wcerr << L"Event commands:\n";
+    std::wcerr << L"  set      : Set the simulated event to signaled state\n";
+    std::wcerr << L"  unset    : Reset the simulated event to non-signaled state\n";
+    std::wcerr << L"  state    : Read the event type and state without waiting on it\n";
+    std::wcerr << L"             [--auto-reset] type of the event if this creates it (default manual reset)\n";
+    std::wcerr << L"  probe    : Measure set -> wake latency on a simulated event\n";
+    std::wcerr << L"             [--waiters <n>] [--iterations <n>] [--auto-reset]\n";
+#ifdef __linux__
+    std::wcerr << L"\nProcess commands:\n";
+    std::wcerr << L"  terminate: Kill the process (SIGKILL through a pidfd)\n";
+    std::wcerr << L"             [--tree] also every descendant, leaves first; [--workers <n>] threads for --tree\n";
+    std::wcerr << L"             [--concurrency <fixed|aimd|gradient>] how many workers act at once (default gradient)\n";
+    std::wcerr << L"\nFile commands (owner root, POSIX ACLs):\n";
+    std::wcerr << L"  harden   : Owner root:root, user::rw- group::--- other::r-- (0604)\n";
+    std::wcerr << L"             directories and files the owner can execute: user::rwx other::r-x (0705)\n";
+    std::wcerr << L"  takeown  : Transfer ownership to root\n";
+    std::wcerr << L"  weaken   : Grant everyone read/write (full access to directories and executables)\n";
+    std::wcerr << L"             [--recursive] applies to everything below a directory\n";
+    std::wcerr << L"             [--queue-depth <n>] most objects in flight at once with --recursive (default 256)\n";
+    std::wcerr << L"             [--concurrency <fixed|aimd|gradient>] how much of the queue depth is used (default gradient)\n";
+#endif
+}
+
+int ProcessSimulatedEventProbe(const std::vector<std::wstring>& args) {
+    EventProbeOptions options;
+    if (!ParseEventProbeOptions(args, 4, options)) {
+        return 1;
+    }
+
+    bool manualReset = !options.autoReset;
+    std::wcout << L"Probing simulated event: " << args[2] << L"\n";
+    SimulatedEvent event(manualReset);
+    EventProbeResult result = RunEventProbe(event, options);
+    PrintEventProbeResult(result, options, manualReset);
+    return result.missedWakes ? 1 : 0;
+}
+
+const CommandSpec kSimulatedEventCommands[] = {
+    { L"set",   0, false, false },
+    { L"unset", 0, false, false },
+    { L"state", 0, false, false },
+};
+
+// set, unset and state on a named simulated event. Events live as long as the
+// process, so outside --serve every command starts from a new, non-signaled
+// event.
+int ProcessSimulatedEventArgs(const std::vector<std::wstring>& args) {
+    bool manualReset = true;
+    for (size_t i = 4; i < args.size(); i++) {
+        if (args[i] == L"--auto-reset") {
+            manualReset = false;
+        } else {
+            std::wcerr << L"Unknown event option: " << args[i] << L"\n";
+            return 1;
+        }
+    }
+
+    std::vector<const CommandSpec*> chain;
+    if (!ParseCommandChain(args[3], L"event", kSimulatedEventCommands, std::size(kSimulatedEventCommands), chain)) {
+        return 1;
+    }
+
+    TraceContext traceContext(TraceObject::Event, args[2]);
+    std::wcout << L"Opening simulated event: " << args[2] << L"\n";
+    SimulatedEvent& event = OpenSimulatedEvent(args[2], manualReset);
+
+    for (const CommandSpec* spec : chain) {
+        std::wstring command = spec->name;
+        if (command == L"set") {
+            TraceSpan trace(TraceOp::EventControl, kTraceEventSet);
+            event.Set();
+            trace.Finish(0);
+            std::wcout << L"Event set successfully\n";
+        } else if (command == L"unset") {
+            TraceSpan trace(TraceOp::EventControl, kTraceEventReset);
+            event.Reset();
+            trace.Finish(0);
+            std::wcout << L"Event reset successfully\n";
+        } else {
+            TraceSpan trace(TraceOp::EventControl, kTraceEventQueryState);
+            bool signaled = event.IsSignaled();
+            trace.Finish(0);
+            std::wcout << L"Event type   : " << (event.IsManualReset() ? L"Manual reset" : L"Auto reset") << L"\n";
+            std::wcout << L"Event state  : " << (signaled ? L"Signaled" : L"Not signaled") << L"\n";
+        }
+    }
+    return 0;
+}
+
+#ifdef __linux__
+int ProcessFileArgs(const std::vector<std::wstring>& args) {
+    FileCommandOptions options;
+    if (!ParseFileCommandOptions(args, 4, options)) {
+        return 1;
+    }
+    return ProcessFileCommand(args[2], args[3], options);
+}
+
+int ProcessProcessArgs(const std::vector<std::wstring>& args) {
+    ProcessCommandOptions options;
+    if (!ParseProcessCommandOptions(args, 4, options)) {
+        return 1;
+    }
+
+    const std::wstring& target = args[2];
+    wchar_t* endPtr = nullptr;
+    unsigned long processId = wcstoul(target.c_str(), &endPtr, 10);
+    if (*endPtr != L'\0' || processId == 0) {
+        processId = FindProcessByName(target);
+        if (processId == 0) {
+            return 1;  // Error already printed by FindProcessByName
+        }
+    }
+    return ProcessProcessCommand(static_cast<uint32_t>(processId), args[3], options);
+}
+#endif
+
+// Only files and processes have a backend here; other records are reported
+// and counted as failed
+int ProcessBatchArgs(const std::vector<std::wstring>& args) {
+    BatchCommandOptions options;
+    if (!ParseBatchCommandOptions(args, 3, options)) {
+        return 1;
+    }
+    std::vector<BatchRecord> records;
+    if (!ReadBatchFile(args[2], records)) {
+        return 1;
+    }
+
+    BatchPlanOptions planOptions;
+#ifdef __linux__
+    planOptions.readDiskOrder = ReadFileDiskOrder;
+#endif
+    BatchPlan plan = BuildBatchPlan(records, planOptions);
+    if (options.planOnly) {
+        PrintBatchPlan(std::wcout, plan);
+        return 0;
+    }
+
+    std::wcout << L"Running " << plan.items.size() << L" object(s) from " << plan.records << L" record(s)\n";
+    uint64_t failures = RunBatchPlan(plan, [](BatchObjectType type, const std::vector<const BatchItem*>& items) -> uint64_t {
+        switch (type) {
+#ifdef __linux__
+            case BatchObjectType::File:
+                return ProcessFileBatch(items);
+            case BatchObjectType::Process:
+                return ProcessProcessBatch(items);
+#endif
+            default:
+                std::wcerr << BatchObjectTypeName(type) << L" records are not supported on this platform\n";
+                return items.size();
+        }
+    });
+    return failures ? 1 : 0;
+}
+
+// Everything but the resident server and its clients, so --serve can run
+// the same command lines
+int RunCommand(std::vector<std::wstring> args) {
+    if (args.size() >= 3 && args[1] == L"--replay") {
+        ReplayOptions options;
+        if (!ParseReplayOptions(args, 3, options)) {
+            return 1;
+        }
+        return ReplayTrace(args[2], options);
+    }
+
+    if (args.size() >= 2 && args[1] == L"--concurrency-benchmark") {
+        ConcurrencyBenchmarkOptions options;
+        if (!ParseConcurrencyBenchmarkOptions(args, 2, options)) {
+            return 1;
+        }
+        return RunConcurrencyBenchmark(options);
+    }
+
+    if (args.size() >= 2 && args[1] == L"--sid-resolver-benchmark") {
+        SidResolverBenchmarkOptions options;
+        if (!ParseSidResolverBenchmarkOptions(args, 2, options)) {
+            return 1;
+        }
+        return RunSidResolverBenchmark(options);
+    }
+
+#ifdef __linux__
+    if (args.size() >= 2 && args[1] == L"--process-tree-benchmark") {
+        ProcessTreeBenchmarkOptions options;
+        if (!ParseProcessTreeBenchmarkOptions(args, 2, options)) {
+            return 1;
+        }
+        return RunProcessTreeBenchmark(options);
+    }
+
+    if (args.size() >= 2 && args[1] == L"--posix-acl-benchmark") {
+        PosixAclBenchmarkOptions options;
+        if (!ParsePosixAclBenchmarkOptions(args, 2, options)) {
+            return 1;
+        }
+        return RunPosixAclBenchmark(options);
+    }
+#endif
+
+    bool tracing = (args.size() >= 3 && args[1] == L"--trace");
+    if (tracing) {
+        if (!StartTraceRecording(args[2])) {
+            std::wcerr << L"Failed to create trace file: " << args[2] << L"\n";
+            return 1;
+        }
+        args.erase(args.begin() + 1, args.begin() + 3);
+    }
+
+    bool isBatch = (args.size() >= 3 && args[1] == L"--batch");
+    if (args.size() < 4 && !isBatch) {
+        PrintUsage();
+        return 1;
+    }
+
+    const std::wstring& objectType = args[1];
+
+    int result = 1;
+    if (isBatch) {
+        result = ProcessBatchArgs(args);
+    } else if (objectType == L"--event" && args[3] == L"probe") {
+        result = ProcessSimulatedEventProbe(args);
+    } else if (objectType == L"--event") {
+        result = ProcessSimulatedEventArgs(args);
+#ifdef __linux__
+    } else if (objectType == L"--file") {
+        result = ProcessFileArgs(args);
+    } else if (objectType == L"--process") {
+        result = ProcessProcessArgs(args);
+#endif
+    } else {
+        PrintUsage();
+    }
+
+    if (tracing) {
+        StopTraceRecording();
+    }
+    return result;
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+    std::setlocale(LC_ALL, "");
+
+    std::vector<std::wstring> args;
+    for (int i = 0; i < argc; i++) {
+        args.push_back(FromUtf8(argv[i]));
+    }
+
+    if (args.size() >= 2 && args[1] == L"--serve") {
+        ServeOptions options;
+        if (!ParseServeOptions(args, 2, options)) {
+            return 1;
+        }
+        return RunServer(options, RunCommand);
+    }
+
+    if (args.size() >= 2 && args[1] == L"--client") {
+        ClientOptions options;
+        if (!ParseClientOptions(args, 2, options)) {
+            return 1;
+        }
+        return RunClient(options);
+    }
+
+    if (args.size() >= 2 && args[1] == L"--client-load") {
+        ClientLoadOptions options;
+        if (!ParseClientLoadOptions(args, 2, options)) {
+            return 1;
+        }
+        return RunClientLoad(options);
+    }
+
+    return RunCommand(args);
+}
@@ -0,0 +1,407 @@
+#include "batch_plan.h"
+#include "latency_histogram.h"
+#include "utf8.h"
+#include <algorithm>
+#include <chrono>
+#include <cwchar>
+#include <cwctype>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <map>
+
+namespace {
+
+// Nominal costs for the estimate, in nanoseconds
+const uint64_t kOpenCostNs            = 40000;    // Open of an object in a warm directory
+const uint64_t kCommandCostNs         = 80000;    // One security change or control call
+const uint64_t kDirectoryChangeCostNs = 150000;   // Path lookup through a cold directory
+const uint64_t kScmConnectionCostNs   = 1000000;  // OpenSCManager round trip to services.exe
+const uint64_t kPrivilegeSetupCostNs  = 60000;    // Token open plus enable/revert
+
+struct TypeName {
+    const wchar_t* name;
+    BatchObjectType type;
+};
+
+const TypeName kTypeNames[] = {
+    { L"event",   BatchObjectType::Event },
+    { L"process", BatchObjectType::Process },
+    { L"service", BatchObjectType::Service },
+    { L"file",    BatchObjectType::File },
+};
+
+bool ParseType(std::wstring text, BatchObjectType& type) {
+    if (text.compare(0, 2, L"--") == 0) {
+        text.erase(0, 2);
+    }
+    for (const TypeName& entry : kTypeNames) {
+        if (text == entry.name) {
+            type = entry.type;
+            return true;
+        }
+    }
+    return false;
+}
+
+std::wstring Trim(const std::wstring& text) {
+    size_t first = text.find_first_not_of(L" \t");
+    if (first == std::wstring::npos) {
+        return std::wstring();
+    }
+    size_t last = text.find_last_not_of(L" \t");
+    return text.substr(first, last - first + 1);
+}
+
+size_t CountCommands(const std::wstring& commands) {
+    return commands.empty() ? 0 : std::count(commands.begin(), commands.end(), L',') + 1;
+}
+
+// Commands that leave the object the same however often they run. Others
+// act or report each time (set on an auto-reset event releases one more
+// waiter, state prints, start/stop and terminate fail once done), so they
+// are never folded away.
+const wchar_t* const kIdempotentCommands[] = { L"harden", L"takeown", L"weaken" };
+
+bool IsIdempotent(const std::wstring& command) {
+    return std::any_of(std::begin(kIdempotentCommands), std::end(kIdempotentCommands),
+                       [&](const wchar_t* idempotent) { return command == idempotent; });
+}
+
+std::vector<std::wstring> SplitCommands(const std::wstring& commands) {
+    std::vector<std::wstring> split;
+    size_t start = 0;
+    while (start <= commands.size()) {
+        size_t comma = commands.find(L',', start);
+        if (comma == std::wstring::npos) {
+            comma = commands.size();
+        }
+        if (comma > start) {
+            split.push_back(commands.substr(start, comma - start));
+        }
+        start = comma + 1;
+    }
+    return split;
+}
+
+bool AllIdempotent(const std::wstring& commands) {
+    std::vector<std::wstring> split = SplitCommands(commands);
+    return std::all_of(split.begin(), split.end(), IsIdempotent);
+}
+
+// Appends a chain to a merged chain, skipping an idempotent command that
+// repeats the one before it (harden,harden)
+void AppendCommands(std::wstring& merged, const std::wstring& commands) {
+    for (const std::wstring& command : SplitCommands(commands)) {
+        size_t lastComma = merged.rfind(L',');
+        std::wstring previous = merged.substr(lastComma == std::wstring::npos ? 0 : lastComma + 1);
+        if (command == previous && IsIdempotent(command)) {
+            continue;
+        }
+        if (!merged.empty()) {
+            merged += L',';
+        }
+        merged += command;
+    }
+}
+
+std::wstring NameKey(const std::wstring& name, bool caseInsensitive) {
+    std::wstring key = name;
+    if (caseInsensitive) {
+        std::transform(key.begin(), key.end(), key.begin(), [](wchar_t c) { return static_cast<wchar_t>(towlower(c)); });
+    }
+    return key;
+}
+
+void SplitPath(const std::wstring& path, const std::wstring& separators, std::wstring& directory, std::wstring& leaf) {
+    size_t split = path.find_last_of(separators);
+    if (split == std::wstring::npos) {
+        directory.clear();
+        leaf = path;
+        return;
+    }
+    // Keep the separator for a root ("/etc" -> "/", "C:\x" -> "C:\")
+    bool isRoot = split == 0 || (split == 2 && path[1] == L':');
+    directory = path.substr(0, isRoot ? split + 1 : split);
+    leaf = path.substr(split + 1);
+}
+
+bool UsesPrivileges(BatchObjectType type) {
+    return type != BatchObjectType::Event;
+}
+
+}  // namespace
+
+const wchar_t* BatchObjectTypeName(BatchObjectType type) {
+    for (const TypeName& entry : kTypeNames) {
+        if (entry.type == type) {
+            return entry.name;
+        }
+    }
+    return L"?";
+}
+
+bool ReadBatchFile(const std::wstring& path, std::vector<BatchRecord>& records) {
+    std::ifstream in(std::filesystem::path(path), std::ios::binary);
+    if (!in) {
+        std::wcerr << L"Failed to open batch file: " << path << L"\n";
+        return false;
+    }
+
+    std::string line;
+    size_t lineNumber = 0;
+    bool valid = true;
+    while (std::getline(in, line)) {
+        lineNumber++;
+        if (!line.empty() && line.back() == '\r') {
+            line.pop_back();
+        }
+        std::wstring text = Trim(FromUtf8(line));
+        if (text.empty() || text[0] == L'#') {
+            continue;
+        }
+
+        size_t typeEnd = text.find_first_of(L" \t");
+        size_t commandStart = text.find_last_of(L" \t");
+        BatchRecord record;
+        record.line = lineNumber;
+        if (typeEnd == std::wstring::npos || typeEnd == commandStart || !ParseType(text.substr(0, typeEnd), record.type)) {
+            std::wcerr << path << L":" << lineNumber << L": expected <event|process|service|file> <name> <commands>\n";
+            valid = false;
+            continue;
+        }
+        record.name = Trim(text.substr(typeEnd, commandStart - typeEnd));
+        record.commands = text.substr(commandStart + 1);
+        records.push_back(std::move(record));
+    }
+    return valid;
+}
+
+uint64_t BatchCost::EstimatedNs() const {
+    return objectOpens * kOpenCostNs + commands * kCommandCostNs + directoryChanges * kDirectoryChangeCostNs +
+           scmConnections * kScmConnectionCostNs + privilegeSetups * kPrivilegeSetupCostNs;
+}
+
+BatchPlan BuildBatchPlan(const std::vector<BatchRecord>& records, const BatchPlanOptions& options) {
+    BatchPlan plan;
+    plan.records = records.size();
+
+    // Cost of running every record as its own invocation, in the order given
+    std::wstring previousDirectory;
+    bool havePreviousFile = false;
+    for (const BatchRecord& record : records) {
+        plan.recordOrder.objectOpens++;
+        plan.recordOrder.commands += CountCommands(record.commands);
+        plan.recordOrder.privilegeSetups += UsesPrivileges(record.type) ? 1 : 0;
+        if (record.type == BatchObjectType::Service) {
+            plan.recordOrder.scmConnections++;
+        } else if (record.type == BatchObjectType::File) {
+            std::wstring directory, leaf;
+            SplitPath(record.name, options.pathSeparators, directory, leaf);
+            directory = NameKey(directory, options.caseInsensitiveNames);
+            if (!havePreviousFile || directory != previousDirectory) {
+                plan.recordOrder.directoryChanges++;
+            }
+            previousDirectory = directory;
+            havePreviousFile = true;
+        }
+    }
+
+    // Records are planned in runs of consecutive records of one type. A
+    // record can depend on an earlier one of another type (stop a service,
+    // then change the files it held open), so runs keep their record order
+    // and only the objects within a run are merged and reordered.
+    std::vector<std::pair<size_t, size_t>> runs;  // [begin, end) into plan.items
+    std::map<std::wstring, size_t> byObject;       // Within the current run, by normalized name
+    std::vector<std::wstring> lastChains;          // Per item, the chain of its latest record
+    for (size_t r = 0; r < records.size(); r++) {
+        const BatchRecord& record = records[r];
+        if (r == 0 || record.type != records[r - 1].type) {
+            runs.emplace_back(plan.items.size(), plan.items.size());
+            byObject.clear();
+        }
+
+        // Only a repeat of the object's previous record is redundant: harden,
+        // weaken, harden must still end hardened. Records with a command that
+        // is not idempotent always run as written, as an object of their own.
+        std::wstring key = NameKey(record.name, options.caseInsensitiveNames);
+        auto found = byObject.find(key);
+        if (found != byObject.end() && AllIdempotent(record.commands)) {
+            size_t index = found->second;
+            if (lastChains[index] == record.commands) {
+                plan.duplicates++;
+                continue;
+            }
+            lastChains[index] = record.commands;
+            AppendCommands(plan.items[index].commands, record.commands);
+            plan.items[index].lines.push_back(record.line);
+            plan.merged++;
+            continue;
+        }
+
+        BatchItem item;
+        item.type = record.type;
+        item.name = record.name;
+        AppendCommands(item.commands, record.commands);
+        item.lines.push_back(record.line);
+        if (item.type == BatchObjectType::File) {
+            SplitPath(item.name, options.pathSeparators, item.directory, item.leaf);
+        }
+        byObject[key] = plan.items.size();
+        plan.items.push_back(std::move(item));
+        lastChains.push_back(record.commands);
+        runs.back().second = plan.items.size();
+    }
+
+    // Position of each file within its directory
+    std::map<std::wstring, std::vector<BatchItem*>> byDirectory;
+    for (BatchItem& item : plan.items) {
+        if (item.type == BatchObjectType::File) {
+            byDirectory[NameKey(item.directory, options.caseInsensitiveNames)].push_back(&item);
+        }
+    }
+    plan.directories = byDirectory.size();
+    if (options.readDiskOrder) {
+        for (auto& [key, files] : byDirectory) {
+            options.readDiskOrder(files.front()->directory, files);
+        }
+    }
+
+    // Processes and services keep their record order (terminating one may be
+    // what frees another, a service may depend on the one stopped before it).
+    // Items for the same object stay in record order.
+    bool caseInsensitive = options.caseInsensitiveNames;
+    auto before = [caseInsensitive](const BatchItem& a, const BatchItem& b) {
+        switch (a.type) {
+            case BatchObjectType::Process:
+            case BatchObjectType::Service:
+                return false;
+            case BatchObjectType::File: {
+                std::wstring directoryA = NameKey(a.directory, caseInsensitive);
+                std::wstring directoryB = NameKey(b.directory, caseInsensitive);
+                if (directoryA != directoryB) {
+                    return directoryA < directoryB;
+                }
+                if (a.diskOrder != b.diskOrder) {
+                    return a.diskOrder < b.diskOrder;
+                }
+                return NameKey(a.leaf, caseInsensitive) < NameKey(b.leaf, caseInsensitive);
+            }
+            default:
+                return NameKey(a.name, caseInsensitive) < NameKey(b.name, caseInsensitive);
+        }
+    };
+    for (const auto& [begin, end] : runs) {
+        std::stable_sort(plan.items.begin() + static_cast<ptrdiff_t>(begin), plan.items.begin() + static_cast<ptrdiff_t>(end),
+                         before);
+    }
+
+    // Each run is a group of its own, with its own privilege setup and SCM connection
+    const BatchItem* previous = nullptr;
+    const BatchItem* previousFile = nullptr;
+    for (const BatchItem& item : plan.items) {
+        plan.planned.objectOpens++;
+        plan.planned.commands += CountCommands(item.commands);
+        if (!previous || previous->type != item.type) {
+            plan.planned.privilegeSetups += UsesPrivileges(item.type) ? 1 : 0;
+            plan.planned.scmConnections += item.type == BatchObjectType::Service ? 1 : 0;
+        }
+        previous = &item;
+        if (item.type != BatchObjectType::File) {
+            continue;
+        }
+        if (!previousFile ||
+            NameKey(previousFile->directory, caseInsensitive) != NameKey(item.directory, caseInsensitive)) {
+            plan.planned.directoryChanges++;
+        }
+        previousFile = &item;
+    }
+    return plan;
+}
+
+void PrintBatchPlan(std::wostream& out, const BatchPlan& plan) {
+    out << L"Plan: " << plan.records << L" record(s) -> " << plan.items.size() << L" object(s), "
+        << plan.duplicates << L" duplicate(s) dropped, " << plan.merged << L" merged into an earlier object\n";
+
+    const std::wstring* directory = nullptr;
+    BatchObjectType type = BatchObjectType::Event;
+    for (size_t i = 0; i < plan.items.size(); i++) {
+        const BatchItem& item = plan.items[i];
+        if (i == 0 || item.type != type) {
+            type = item.type;
+            out << L"  " << BatchObjectTypeName(type) << L":\n";
+            directory = nullptr;
+        }
+
+        std::wstring lines;
+        for (size_t line : item.lines) {
+            lines += (lines.empty() ? L"line " : L", ") + std::to_wstring(line);
+        }
+
+        std::wstring label;
+        if (type == BatchObjectType::File) {
+            if (!directory || *directory != item.directory) {
+                directory = &item.directory;
+                out << L"    " << (item.directory.empty() ? L"." : item.directory) << L"\n";
+            }
+            label = L"      " + item.leaf;
+        } else {
+            label = L"    " + item.name;
+        }
+        // Names longer than the column push the rest of the row over
+        label.resize(std::max<size_t>(label.size() + 1, 37), L' ');
+        out << label << item.commands << L"  (" << lines << L")\n";
+    }
+
+    wchar_t line[128];
+    out << L"\nEstimated cost              record order       planned\n";
+    auto row = [&](const wchar_t* label, uint64_t before, uint64_t after) {
+        swprintf(line, 128, L"  %-22ls %12llu  %12llu\n", label,
+                 static_cast<unsigned long long>(before), static_cast<unsigned long long>(after));
+        out << line;
+    };
+    row(L"Object opens", plan.recordOrder.objectOpens, plan.planned.objectOpens);
+    row(L"Commands", plan.recordOrder.commands, plan.planned.commands);
+    row(L"Directory changes", plan.recordOrder.directoryChanges, plan.planned.directoryChanges);
+    row(L"SCM connections", plan.recordOrder.scmConnections, plan.planned.scmConnections);
+    row(L"Privilege setups", plan.recordOrder.privilegeSetups, plan.planned.privilegeSetups);
+    swprintf(line, 128, L"  %-22ls %12ls  %12ls\n", L"Estimated time",
+             FormatDuration(plan.recordOrder.EstimatedNs()).c_str(), FormatDuration(plan.planned.EstimatedNs()).c_str());
+    out << line;
+}
+
+uint64_t RunBatchPlan(const BatchPlan& plan,
+                      const std::function<uint64_t(BatchObjectType, const std::vector<const BatchItem*>&)>& runGroup) {
+    uint64_t failures = 0;
+    size_t next = 0;
+    while (next < plan.items.size()) {
+        BatchObjectType type = plan.items[next].type;
+        std::vector<const BatchItem*> group;
+        for (; next < plan.items.size() && plan.items[next].type == type; next++) {
+            group.push_back(&plan.items[next]);
+        }
+
+        auto start = std::chrono::steady_clock::now();
+        uint64_t groupFailures = runGroup(type, group);
+        auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start);
+        std::wcout << L"Batch " << BatchObjectTypeName(type) << L": " << group.size() << L" object(s) in "
+                   << FormatDuration(static_cast<uint64_t>(elapsed.count())) << L", " << groupFailures << L" failed\n";
+        failures += groupFailures;
+    }
+    return failures;
+}
+
+bool ParseBatchCommandOptions(const std::vector<std::wstring>& args, size_t first, BatchCommandOptions& options) {
+    for (size_t i = first; i < args.size(); i++) {
+        const std::wstring& arg = args[i];
+        if (arg == L"--plan") {
+            options.planOnly = true;
+        } else {
+            std::wcerr << L"Unknown batch option: " << arg << L"\n";
+            std::wcerr << L"Valid options: --plan\n";
+            return false;
+        }
+    }
+    return true;
+}
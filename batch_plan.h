@@ -0,0 +1,96 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <iosfwd>
+#include <string>
+#include <vector>
+
+// Batch files hold one record per line:
+//     <type> <name> <command>[,<command>...]
+// where type is event, process, service or file (a leading "--" is
+// accepted), the name runs up to the last space so paths may contain spaces,
+// and '#' starts a comment line.
+
+enum class BatchObjectType {
+    Event,
+    Process,
+    Service,
+    File,
+};
+
+const wchar_t* BatchObjectTypeName(BatchObjectType type);
+
+struct BatchRecord {
+    BatchObjectType type;
+    std::wstring name;
+    std::wstring commands;
+    size_t line = 0;
+};
+
+bool ReadBatchFile(const std::wstring& path, std::vector<BatchRecord>& records);
+
+// One object in a plan, with the commands of its records in one run, in
+// record order. An object can have several items (one per run, and one per
+// record whose commands are not all idempotent).
+struct BatchItem {
+    BatchObjectType type;
+    std::wstring name;
+    std::wstring commands;            // Merged chain, e.g. "takeown,weaken,stop"
+    std::vector<size_t> lines;        // Records folded into this item
+    std::wstring directory;           // Files: the containing directory ("" for a bare name)
+    std::wstring leaf;                // Files: the name within it
+    uint64_t diskOrder = UINT64_MAX;  // Files: position within the directory, from
+                                      // BatchPlanOptions::readDiskOrder; unknown sorts last
+};
+
+struct BatchPlanOptions {
+    bool caseInsensitiveNames = false;  // Windows object and file names
+    std::wstring pathSeparators = L"/";
+    // Fills diskOrder for files in one directory; called once per directory
+    std::function<void(const std::wstring& directory, const std::vector<BatchItem*>& files)> readDiskOrder;
+};
+
+// Operations the batch costs when run in a given order. The time estimate
+// uses nominal per-operation costs and is only meant for comparing orders.
+struct BatchCost {
+    uint64_t objectOpens = 0;
+    uint64_t commands = 0;
+    uint64_t directoryChanges = 0;  // Moving to a directory other than the previous file's
+    uint64_t scmConnections = 0;
+    uint64_t privilegeSetups = 0;   // Enabling (and later reverting) the privileges a group needs
+
+    uint64_t EstimatedNs() const;
+};
+
+struct BatchPlan {
+    std::vector<BatchItem> items;  // In execution order, one group per run of same-type records
+    size_t records = 0;
+    size_t duplicates = 0;         // Records repeating the previous record for the same object
+    size_t merged = 0;             // Records whose commands were appended to an earlier item for the object
+    size_t directories = 0;
+    BatchCost recordOrder;         // Running each record on its own, as listed
+    BatchCost planned;
+};
+
+// Splits the records into runs of consecutive records of one type, which
+// run in record order. Within a run, records that only harden, take
+// ownership or weaken are deduped and merged per object, and the objects are
+// ordered: events by name, files by directory and then by position within
+// the directory, processes and services as listed. Each run sets up its
+// privileges (and the SCM connection) once.
+BatchPlan BuildBatchPlan(const std::vector<BatchRecord>& records, const BatchPlanOptions& options);
+
+void PrintBatchPlan(std::wostream& out, const BatchPlan& plan);
+
+// Runs a plan one group (run of same-type items) at a time, in plan order, and prints how long
+// each group took. runGroup gets a group's items and returns how many failed.
+uint64_t RunBatchPlan(const BatchPlan& plan,
+                      const std::function<uint64_t(BatchObjectType, const std::vector<const BatchItem*>&)>& runGroup);
+
+struct BatchCommandOptions {
+    bool planOnly = false;  // Print the plan and its estimated cost without running it
+};
+
+// Parses [--plan] after the batch file
+bool ParseBatchCommandOptions(const std::vector<std::wstring>& args, size_t first, BatchCommandOptions& options);
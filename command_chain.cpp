@@ -0,0 +1,107 @@
+#include "command_chain.h"
+#include <iostream>
+
+bool ParseCommandChain(const std::wstring& commands, const wchar_t* objectKind,
+                       const CommandSpec* specs, size_t specCount,
+                       std::vector<const CommandSpec*>& chain) {
+    chain.clear();
+
+    size_t start = 0;
+    while (start <= commands.size()) {
+        size_t end = commands.find(L',', start);
+        if (end == std::wstring::npos) {
+            end = commands.size();
+        }
+        std::wstring name = commands.substr(start, end - start);
+
+        const CommandSpec* match = nullptr;
+        for (size_t i = 0; i < specCount; i++) {
+            if (name == specs[i].name) {
+                match = &specs[i];
+                break;
+            }
+        }
+
+        if (!match) {
+            std::wcerr << L"Unknown " << objectKind << L" command: " << name << L"\n";
+            std::wcerr << L"Valid commands: ";
+            for (size_t i = 0; i < specCount; i++) {
+                std::wcerr << (i ? L", " : L"") << specs[i].name;
+            }
+            std::wcerr << L"\n";
+            return false;
+        }
+
+        chain.push_back(match);
+        start = end + 1;
+    }
+
+    return true;
+}
+
+uint32_t GetChainAccess(const std::vector<const CommandSpec*>& chain, size_t first) {
+    uint32_t access = 0;
+    for (size_t i = first; i < chain.size(); i++) {
+        access |= chain[i]->desiredAccess;
+    }
+    return access;
+}
+
+bool ChainRequiresTakeOwnership(const std::vector<const CommandSpec*>& chain) {
+    for (const CommandSpec* spec : chain) {
+        if (spec->requiresTakeOwnership) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool ChainRequiresRestorePrivilege(const std::vector<const CommandSpec*>& chain) {
+    for (const CommandSpec* spec : chain) {
+        if (spec->requiresRestorePrivilege) {
+            return true;
+        }
+    }
+    return false;
+}
+
+namespace {
+
+bool OpenForChain(const std::function<ChainOpenResult(uint32_t desiredAccess)>& open,
+                  uint32_t chainAccess, uint32_t commandAccess, uint32_t& grantedAccess) {
+    uint32_t desiredAccess = chainAccess;
+    for (;;) {
+        ChainOpenResult result = open(desiredAccess);
+        if (result == ChainOpenResult::Opened) {
+            grantedAccess = desiredAccess;
+            return true;
+        }
+        if (result != ChainOpenResult::AccessDenied || desiredAccess == commandAccess) {
+            return false;
+        }
+        desiredAccess = commandAccess;
+    }
+}
+
+}  // namespace
+
+ChainResult RunCommandChain(const std::vector<const CommandSpec*>& chain,
+                            const std::function<ChainOpenResult(uint32_t desiredAccess)>& open,
+                            const std::function<bool(const CommandSpec& command)>& run) {
+    bool opened = false;
+    uint32_t grantedAccess = 0;
+    for (size_t i = 0; i < chain.size(); i++) {
+        uint32_t commandAccess = chain[i]->desiredAccess;
+        if (!opened || (grantedAccess & commandAccess) != commandAccess) {
+            if (!OpenForChain(open, GetChainAccess(chain, i), commandAccess, grantedAccess)) {
+                return ChainResult::OpenFailed;
+            }
+            opened = true;
+        }
+
+        if (!run(*chain[i])) {
+            return ChainResult::CommandFailed;
+        }
+    }
+    return ChainResult::Succeeded;
+}
@@ -0,0 +1,41 @@
+#pragma once
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+// Access rights and privileges one command needs on the object it targets.
+// desiredAccess is a Win32 access mask; backends without one leave it 0.
+struct CommandSpec {
+    const wchar_t* name;
+    uint32_t desiredAccess;
+    bool requiresTakeOwnership;
+    bool requiresRestorePrivilege;
+};
+
+// Command chains ("takeown,weaken,stop") run against a single open of the object
+bool ParseCommandChain(const std::wstring& commands, const wchar_t* objectKind,
+                       const CommandSpec* specs, size_t specCount,
+                       std::vector<const CommandSpec*>& chain);
+uint32_t GetChainAccess(const std::vector<const CommandSpec*>& chain, size_t first);
+bool ChainRequiresTakeOwnership(const std::vector<const CommandSpec*>& chain);
+bool ChainRequiresRestorePrivilege(const std::vector<const CommandSpec*>& chain);
+
+// How an open attempt for RunCommandChain went
+enum class ChainOpenResult { Opened, AccessDenied, Failed };
+
+// How RunCommandChain ended; on OpenFailed the open's error is still the
+// last error, for the caller to print
+enum class ChainResult { Succeeded, OpenFailed, CommandFailed };
+
+// Runs the chain against one object, opening it before the first command and
+// reopening it only when a command needs rights the current open lacks, i.e.
+// an earlier takeown/weaken changed what we are allowed to ask for. Each open
+// asks for the rights the rest of the chain needs, falling back to what the
+// current command needs if that is denied - a later takeown/weaken may be
+// what grants the remaining rights.
+// open(desiredAccess) closes any earlier open of the object, then opens it,
+// without printing its error. run(command) runs one command on the open.
+ChainResult RunCommandChain(const std::vector<const CommandSpec*>& chain,
+                            const std::function<ChainOpenResult(uint32_t desiredAccess)>& open,
+                            const std::function<bool(const CommandSpec& command)>& run);
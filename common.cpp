@@ -1,6 +1,17 @@
 #include "common.h"
+#include "account_directory.h"
 #include <sddl.h>
+#include <algorithm>
 #include <iostream>
+#include <string>
+#include <vector>
+
+namespace {
+
+// Written by HoldPrivileges before the server starts its threads, read-only after
+std::vector<std::wstring> g_heldPrivileges;
+
+}  // namespace
 
 void PrintLastError(const wchar_t* context) {
     DWORD err = GetLastError();
@@ -40,9 +51,34 @@ void PrintDacl(PACL dacl) {
     else {
         PrintLastError(L"ConvertSecurityDescriptorToStringSecurityDescriptor");
     }
+
+    // List each ACE with its trustee resolved to an account name
+    ACL_SIZE_INFORMATION aclInfo = {};
+    if (dacl == nullptr || !GetAclInformation(dacl, &aclInfo, sizeof(aclInfo), AclSizeInformation)) {
+        return;
+    }
+
+    for (DWORD i = 0; i < aclInfo.AceCount; i++) {
+        LPVOID ace = nullptr;
+        if (!GetAce(dacl, i, &ace)) {
+            continue;
+        }
+
+        BYTE aceType = static_cast<PACE_HEADER>(ace)->AceType;
+        if (aceType != ACCESS_ALLOWED_ACE_TYPE && aceType != ACCESS_DENIED_ACE_TYPE) {
+            continue;  // Object and callback ACEs are never produced by this tool
+        }
+
+        // ACCESS_ALLOWED_ACE and ACCESS_DENIED_ACE share the same layout
+        auto allowedAce = static_cast<PACCESS_ALLOWED_ACE>(ace);
+        std::wcout << L"  " << (aceType == ACCESS_ALLOWED_ACE_TYPE ? L"Allow" : L"Deny ")
+                   << L" 0x" << std::hex << allowedAce->Mask << std::dec
+                   << L"  " << DescribeSid(&allowedAce->SidStart) << L"\n";
+    }
 }
 
-bool SetRestrictiveAcl(HANDLE handle, SE_OBJECT_TYPE objectType, DWORD systemAccessMask, DWORD everyoneAccessMask) {
+bool SetRestrictiveAcl(HANDLE handle, SE_OBJECT_TYPE objectType, DWORD systemAccessMask, DWORD everyoneAccessMask,
+                       bool verbose) {
     BYTE systemSidBuffer[SECURITY_MAX_SID_SIZE];
     BYTE interactiveSidBuffer[SECURITY_MAX_SID_SIZE];
     DWORD systemSidSize = sizeof(systemSidBuffer);
@@ -85,9 +121,13 @@ bool SetRestrictiveAcl(HANDLE handle, SE_OBJECT_TYPE objectType, DWORD systemAcc
         return false;
     }
 
-    PrintDacl(newDacl);
+    if (verbose) {
+        PrintDacl(newDacl);
+    }
 
+    TraceSpan daclTrace(TraceOp::SetSecurity, DACL_SECURITY_INFORMATION, newDacl->AclSize);
     result = SetSecurityInfo(handle, objectType, DACL_SECURITY_INFORMATION, nullptr, nullptr, newDacl, nullptr);
+    daclTrace.Finish(result);
     LocalFree(newDacl);
 
     if (result != ERROR_SUCCESS) {
@@ -96,16 +136,15 @@ bool SetRestrictiveAcl(HANDLE handle, SE_OBJECT_TYPE objectType, DWORD systemAcc
         return false;
     }
 
-    // Convert owner SID to SDDL and print it
-    LPWSTR ownerSddl = nullptr;
-    if (ConvertSidToStringSidW(systemSid, &ownerSddl)) {
-        std::wcout << L"Setting Owner: " << ownerSddl << L"\n";
-        LocalFree(ownerSddl);
+    if (verbose) {
+        std::wcout << L"Setting Owner: " << DescribeSid(systemSid) << L"\n";
     }
 
     // Set owner to LOCAL SYSTEM
     // Requires SE_RESTORE_NAME privilege (must be enabled before calling this function)
+    TraceSpan ownerTrace(TraceOp::SetSecurity, OWNER_SECURITY_INFORMATION, GetLengthSid(systemSid));
     result = SetSecurityInfo(handle, objectType, OWNER_SECURITY_INFORMATION, systemSid, nullptr, nullptr, nullptr);
+    ownerTrace.Finish(result);
     if (result != ERROR_SUCCESS) {
         SetLastError(result);
         PrintLastError(L"SetSecurityInfo (Owner)");
@@ -152,15 +191,19 @@ PACL CreateEveryoneFullAccessDacl(DWORD fullAccessMask) {
 
 }  // namespace
 
-bool WeakenAcl(HANDLE handle, SE_OBJECT_TYPE objectType, DWORD fullAccessMask) {
+bool WeakenAcl(HANDLE handle, SE_OBJECT_TYPE objectType, DWORD fullAccessMask, bool verbose) {
     PACL newDacl = CreateEveryoneFullAccessDacl(fullAccessMask);
     if (!newDacl) {
         return false;
     }
 
-    PrintDacl(newDacl);
+    if (verbose) {
+        PrintDacl(newDacl);
+    }
 
+    TraceSpan trace(TraceOp::SetSecurity, DACL_SECURITY_INFORMATION, newDacl->AclSize);
     DWORD result = SetSecurityInfo(handle, objectType, DACL_SECURITY_INFORMATION, nullptr, nullptr, newDacl, nullptr);
+    trace.Finish(result);
     LocalFree(newDacl);
 
     if (result != ERROR_SUCCESS) {
@@ -171,17 +214,21 @@ bool WeakenAcl(HANDLE handle, SE_OBJECT_TYPE objectType, DWORD fullAccessMask) {
     return true;
 }
 
-bool WeakenAclByName(const wchar_t* objectName, SE_OBJECT_TYPE objectType, DWORD fullAccessMask) {
+bool WeakenAclByName(const wchar_t* objectName, SE_OBJECT_TYPE objectType, DWORD fullAccessMask, bool verbose) {
     PACL newDacl = CreateEveryoneFullAccessDacl(fullAccessMask);
     if (!newDacl) {
         return false;
     }
 
-    PrintDacl(newDacl);
+    if (verbose) {
+        PrintDacl(newDacl);
+    }
 
     // Use SetNamedSecurityInfo which works with privileges, not handle access rights
+    TraceSpan trace(TraceOp::SetSecurity, DACL_SECURITY_INFORMATION, newDacl->AclSize);
     DWORD result = SetNamedSecurityInfoW(const_cast<LPWSTR>(objectName), objectType, 
                                          DACL_SECURITY_INFORMATION, nullptr, nullptr, newDacl, nullptr);
+    trace.Finish(result);
     LocalFree(newDacl);
 
     if (result != ERROR_SUCCESS) {
@@ -211,7 +258,11 @@ DWORD SetPrivilege(LPCWSTR privilegeName, bool enable) {
     tp.PrivilegeCount = 1;
     tp.Privileges[0].Attributes = enable ? SE_PRIVILEGE_ENABLED : 0;
 
-    if (!AdjustTokenPrivileges(tokenHandle, FALSE, &tp, 0, nullptr, nullptr)) {
+    TraceSpan trace(TraceOp::AdjustPrivilege, TraceObject::Token, privilegeName, enable ? 1 : 0);
+    BOOL adjusted = AdjustTokenPrivileges(tokenHandle, FALSE, &tp, 0, nullptr, nullptr);
+    FinishTraceSpan(trace, adjusted != FALSE);
+
+    if (!adjusted) {
         DWORD err = GetLastError();
         PrintLastError(L"AdjustTokenPrivileges");
         CloseHandle(tokenHandle);
@@ -222,7 +273,22 @@ DWORD SetPrivilege(LPCWSTR privilegeName, bool enable) {
     return ERROR_SUCCESS;
 }
 
-DWORD TakeOwnership(HANDLE handle, SE_OBJECT_TYPE objectType) {
+void HoldPrivileges(std::initializer_list<LPCWSTR> privilegeNames) {
+    for (LPCWSTR privilegeName : privilegeNames) {
+        if (SetPrivilege(privilegeName, true) == ERROR_SUCCESS) {
+            g_heldPrivileges.push_back(privilegeName);
+            std::wcout << L"Holding privilege: " << privilegeName << L"\n";
+        } else {
+            std::wcerr << L"Failed to enable privilege: " << privilegeName << L"\n";
+        }
+    }
+}
+
+bool IsPrivilegeHeld(LPCWSTR privilegeName) {
+    return std::find(g_heldPrivileges.begin(), g_heldPrivileges.end(), privilegeName) != g_heldPrivileges.end();
+}
+
+DWORD TakeOwnership(HANDLE handle, SE_OBJECT_TYPE objectType, bool verbose) {
     BYTE adminsSidBuffer[SECURITY_MAX_SID_SIZE];
     DWORD adminsSidSize = sizeof(adminsSidBuffer);
 
@@ -233,11 +299,16 @@ DWORD TakeOwnership(HANDLE handle, SE_OBJECT_TYPE objectType) {
     }
 
     PSID adminsSid = adminsSidBuffer;
+    if (verbose) {
+        std::wcout << L"Setting Owner: " << DescribeSid(adminsSid) << L"\n";
+    }
 
     // Set owner to Administrators group
     // Requires SE_TAKE_OWNERSHIP_NAME privilege (must be enabled before calling this function)
+    TraceSpan trace(TraceOp::SetSecurity, OWNER_SECURITY_INFORMATION, GetLengthSid(adminsSid));
     DWORD result = SetSecurityInfo(handle, objectType, OWNER_SECURITY_INFORMATION, 
                                    adminsSid, nullptr, nullptr, nullptr);
+    trace.Finish(result);
     if (result != ERROR_SUCCESS) {
         SetLastError(result);
         PrintLastError(L"SetSecurityInfo (Owner)");
@@ -245,3 +316,11 @@ DWORD TakeOwnership(HANDLE handle, SE_OBJECT_TYPE objectType) {
 
     return result;
 }
+
+void FinishTraceSpan(TraceSpan& trace, bool succeeded) {
+    // Successful calls can leave information in GetLastError() too
+    // (ERROR_ALREADY_EXISTS from CreateEvent), so it is put back as it was
+    DWORD lastError = GetLastError();
+    trace.Finish(succeeded ? ERROR_SUCCESS : lastError);
+    SetLastError(lastError);
+}
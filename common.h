@@ -1,12 +1,26 @@
 #pragma once
 #include <windows.h>
 #include <aclapi.h>
+#include <initializer_list>
+#include "command_chain.h"
+#include "trace.h"
 
 // Common utility functions
 void PrintLastError(const wchar_t* context);
 void PrintDacl(PACL dacl);
-bool SetRestrictiveAcl(HANDLE handle, SE_OBJECT_TYPE objectType, DWORD systemAccessMask, DWORD everyoneAccessMask);
-bool WeakenAcl(HANDLE handle, SE_OBJECT_TYPE objectType, DWORD fullAccessMask);
-bool WeakenAclByName(const wchar_t* objectName, SE_OBJECT_TYPE objectType, DWORD fullAccessMask);
+// verbose = false skips the "Setting DACL/Owner" lines, for bulk operations;
+// errors are always printed
+bool SetRestrictiveAcl(HANDLE handle, SE_OBJECT_TYPE objectType, DWORD systemAccessMask, DWORD everyoneAccessMask,
+                       bool verbose = true);
+bool WeakenAcl(HANDLE handle, SE_OBJECT_TYPE objectType, DWORD fullAccessMask, bool verbose = true);
+bool WeakenAclByName(const wchar_t* objectName, SE_OBJECT_TYPE objectType, DWORD fullAccessMask, bool verbose = true);
 DWORD SetPrivilege(LPCWSTR privilegeName, bool enable);
-DWORD TakeOwnership(HANDLE handle, SE_OBJECT_TYPE objectType);
+// For the resident server: enables the privileges once and leaves them on, so
+// PrivilegeGuard skips the token adjustment on every request. Call before any
+// other thread starts; prints and skips privileges the token does not have.
+void HoldPrivileges(std::initializer_list<LPCWSTR> privilegeNames);
+bool IsPrivilegeHeld(LPCWSTR privilegeName);
+DWORD TakeOwnership(HANDLE handle, SE_OBJECT_TYPE objectType, bool verbose = true);
+
+// Finishes a trace span for a BOOL-returning Win32 call, leaving GetLastError() intact
+void FinishTraceSpan(TraceSpan& trace, bool succeeded);
@@ -0,0 +1,191 @@
+#include "concurrency_benchmark.h"
+#include "latency_histogram.h"
+#include <atomic>
+#include <chrono>
+#include <cwchar>
+#include <iostream>
+#include <thread>
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+// Rough shapes of the real backends: the SCM serializes control requests
+// and starts timing out callers once enough pile up; a filesystem serves
+// many requests at once until its queues fill; process control is CPU-bound.
+LatencyCurve DefaultCurve(TraceObject object) {
+    switch (object) {
+        case TraceObject::Service: return LatencyCurve{ 1, 200000, 0.02, 48 };
+        case TraceObject::File:    return LatencyCurve{ 32, 400000, 0.01, 0 };
+        case TraceObject::Process: return LatencyCurve{ 8, 100000, 0.01, 0 };
+        default:                   return LatencyCurve{ 64, 20000, 0.0, 0 };
+    }
+}
+
+TraceOp OperationFor(TraceObject object) {
+    switch (object) {
+        case TraceObject::Service: return TraceOp::ServiceControl;
+        case TraceObject::Process: return TraceOp::ProcessControl;
+        case TraceObject::Event:   return TraceOp::EventControl;
+        default:                   return TraceOp::SetSecurity;
+    }
+}
+
+struct RunResult {
+    uint64_t elapsedNs = 0;
+    uint64_t failures = 0;
+    LatencyHistogram latency;
+    ConcurrencyLimit::Stats limit;
+};
+
+RunResult RunPolicy(TraceObject object, const LatencyCurve& curve, ConcurrencyPolicy policy,
+                    const ConcurrencyBenchmarkOptions& options) {
+    SimulatedBackend backend;
+    backend.SetLatencyCurve(object, curve);
+    ConcurrencyLimit limit(DefaultConcurrencyLimit(object, policy, options.maxInFlight));
+
+    std::atomic<unsigned> next{ 0 };
+    std::atomic<uint64_t> failures{ 0 };
+    std::vector<LatencyHistogram> latencies(options.maxInFlight);
+
+    auto worker = [&](unsigned index) {
+        TraceRecord record;
+        record.op = OperationFor(object);
+        record.object = object;
+        record.name = L"bench" + std::to_wstring(index);
+        while (next++ < options.operations) {
+            limit.Acquire();
+            Clock::time_point start = Clock::now();
+            bool failed = backend.Execute(record) != 0;
+            uint64_t elapsed = static_cast<uint64_t>(
+                std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count());
+            limit.Release(elapsed, failed);
+
+            latencies[index].Record(elapsed);
+            failures += failed ? 1 : 0;
+        }
+    };
+
+    Clock::time_point start = Clock::now();
+    std::vector<std::thread> threads;
+    for (unsigned i = 0; i < options.maxInFlight; i++) {
+        threads.emplace_back(worker, i);
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    RunResult result;
+    result.elapsedNs = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count());
+    result.failures = failures;
+    for (const LatencyHistogram& histogram : latencies) {
+        result.latency.Merge(histogram);
+    }
+    result.limit = limit.GetStats();
+    return result;
+}
+
+bool ParseValue(const std::wstring& arg, const std::wstring& text, unsigned long max, unsigned& value) {
+    wchar_t* endPtr = nullptr;
+    unsigned long parsed = wcstoul(text.c_str(), &endPtr, 10);
+    if (text.empty() || *endPtr != L'\0' || parsed == 0 || parsed > max) {
+        std::wcerr << L"Invalid value for " << arg << L" (1-" << max << L"): " << text << L"\n";
+        return false;
+    }
+    value = static_cast<unsigned>(parsed);
+    return true;
+}
+
+bool ParseCurve(const std::wstring& text, LatencyCurve& curve) {
+    unsigned long serviceUs = 0;
+    int consumed = 0;
+    if (swscanf(text.c_str(), L"%u,%lu,%lf,%u%n", &curve.capacity, &serviceUs, &curve.collapse, &curve.failAbove,
+                &consumed) != 4 || static_cast<size_t>(consumed) != text.size() || curve.capacity == 0 ||
+        curve.collapse < 0) {
+        std::wcerr << L"Invalid value for --curve (<capacity>,<service-us>,<collapse>,<fail-above>): " << text << L"\n";
+        return false;
+    }
+    curve.serviceNs = serviceUs * 1000;
+    return true;
+}
+
+}  // namespace
+
+bool ParseConcurrencyBenchmarkOptions(const std::vector<std::wstring>& args, size_t first,
+                                      ConcurrencyBenchmarkOptions& options) {
+    for (size_t i = first; i < args.size(); i++) {
+        const std::wstring& arg = args[i];
+        bool hasValue = i + 1 < args.size();
+        if (arg == L"--object" && hasValue) {
+            const std::wstring& text = args[++i];
+            TraceObject object = TraceObject::None;
+            for (TraceObject candidate : { TraceObject::File, TraceObject::Service, TraceObject::Process, TraceObject::Event }) {
+                if (text == TraceObjectName(candidate)) {
+                    object = candidate;
+                }
+            }
+            if (object == TraceObject::None) {
+                std::wcerr << L"Invalid value for --object (file, service, process, event): " << text << L"\n";
+                return false;
+            }
+            options.objects.push_back(object);
+        } else if (arg == L"--operations" && hasValue) {
+            if (!ParseValue(arg, args[++i], 1000000, options.operations)) {
+                return false;
+            }
+        } else if (arg == L"--max" && hasValue) {
+            if (!ParseValue(arg, args[++i], 1024, options.maxInFlight)) {
+                return false;
+            }
+        } else if (arg == L"--curve" && hasValue) {
+            if (!ParseCurve(args[++i], options.curve)) {
+                return false;
+            }
+            options.hasCurve = true;
+        } else {
+            std::wcerr << L"Unknown benchmark option: " << arg << L"\n";
+            std::wcerr << L"Valid options: --object <file|service|process|event>, --operations <n>, --max <n>, "
+                          L"--curve <capacity>,<service-us>,<collapse>,<fail-above>\n";
+            return false;
+        }
+    }
+    return true;
+}
+
+int RunConcurrencyBenchmark(const ConcurrencyBenchmarkOptions& options) {
+    std::vector<TraceObject> objects = options.objects;
+    if (objects.empty()) {
+        objects = { TraceObject::Service, TraceObject::File };
+    }
+
+    std::wcout << L"Concurrency benchmark: " << options.operations << L" operation(s) per run, up to "
+               << options.maxInFlight << L" in flight\n";
+
+    for (TraceObject object : objects) {
+        LatencyCurve curve = options.hasCurve ? options.curve : DefaultCurve(object);
+        std::wcout << L"\n" << TraceObjectName(object) << L": capacity " << curve.capacity << L", "
+                   << FormatDuration(curve.serviceNs) << L" per operation, +" << curve.collapse * 100
+                   << L"% per queued caller";
+        if (curve.failAbove) {
+            std::wcout << L", times out above " << curve.failAbove << L" in flight";
+        }
+        std::wcout << L"\n  policy          ops/s        p50        p99    failed   limit (range)\n";
+
+        for (ConcurrencyPolicy policy : { ConcurrencyPolicy::Fixed, ConcurrencyPolicy::Aimd, ConcurrencyPolicy::Gradient }) {
+            RunResult result = RunPolicy(object, curve, policy, options);
+            // Operations that timed out don't count towards throughput
+            double succeeded = static_cast<double>(options.operations - result.failures);
+            double opsPerSecond = result.elapsedNs ? succeeded * 1e9 / static_cast<double>(result.elapsedNs) : 0;
+
+            wchar_t line[160];
+            swprintf(line, 160, L"  %-10ls %10.0f %10ls %10ls %9llu   %u (%u-%u)\n",
+                     ConcurrencyPolicyName(policy), opsPerSecond,
+                     FormatDuration(result.latency.Percentile(50)).c_str(),
+                     FormatDuration(result.latency.Percentile(99)).c_str(),
+                     static_cast<unsigned long long>(result.failures),
+                     result.limit.limit, result.limit.lowest, result.limit.highest);
+            std::wcout << line;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,23 @@
+#pragma once
+#include <string>
+#include <vector>
+#include "concurrency_limit.h"
+#include "simulated_backend.h"
+
+struct ConcurrencyBenchmarkOptions {
+    std::vector<TraceObject> objects;  // Empty = service and file
+    unsigned operations = 2000;        // Per run
+    unsigned maxInFlight = 256;        // Worker threads, and the fixed policy's limit
+    bool hasCurve = false;             // --curve given; applies to every object in the run
+    LatencyCurve curve;
+};
+
+// Parses [--object <type>]... [--operations <n>] [--max <n>]
+// [--curve <capacity>,<service-us>,<collapse>,<fail-above>] from args[first..]
+bool ParseConcurrencyBenchmarkOptions(const std::vector<std::wstring>& args, size_t first,
+                                      ConcurrencyBenchmarkOptions& options);
+
+// Drives the simulated backend, with a latency curve per object type, under
+// each concurrency policy in turn and reports throughput, latency and the
+// limit each policy settled on
+int RunConcurrencyBenchmark(const ConcurrencyBenchmarkOptions& options);
@@ -0,0 +1,180 @@
+#include "concurrency_limit.h"
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <thread>
+
+namespace {
+
+const uint64_t kMinWindowSamples = 16;
+const double kErrorRateLimit     = 0.1;   // Failures above this share of a window count as overload
+const double kAimdLatencyFactor  = 2.0;   // AIMD backs off past this multiple of the no-load latency
+const double kAimdBackoff        = 0.9;
+const double kGradientTolerance  = 1.5;   // Gradient accepts this much queueing before shrinking
+const double kGradientSmoothing  = 0.2;   // Share of each new estimate taken into the limit
+
+}  // namespace
+
+const wchar_t* ConcurrencyPolicyName(ConcurrencyPolicy policy) {
+    switch (policy) {
+        case ConcurrencyPolicy::Fixed:    return L"fixed";
+        case ConcurrencyPolicy::Aimd:     return L"aimd";
+        case ConcurrencyPolicy::Gradient: return L"gradient";
+    }
+    return L"?";
+}
+
+bool ParseConcurrencyPolicy(const std::wstring& text, ConcurrencyPolicy& policy) {
+    for (ConcurrencyPolicy candidate : { ConcurrencyPolicy::Fixed, ConcurrencyPolicy::Aimd, ConcurrencyPolicy::Gradient }) {
+        if (text == ConcurrencyPolicyName(candidate)) {
+            policy = candidate;
+            return true;
+        }
+    }
+    std::wcerr << L"Invalid value for --concurrency (fixed, aimd, gradient): " << text << L"\n";
+    return false;
+}
+
+ConcurrencyLimitOptions DefaultConcurrencyLimit(TraceObject object, ConcurrencyPolicy policy, unsigned max) {
+    ConcurrencyLimitOptions options;
+    options.policy = policy;
+    options.max = std::max(1u, max);
+    switch (object) {
+        case TraceObject::Service:
+            options.initial = 1;   // The SCM handles one control request at a time
+            break;
+        case TraceObject::File:
+            options.initial = 16;  // Filesystems keep scaling with outstanding I/O; start well above 1
+            break;
+        case TraceObject::Process:
+            options.initial = std::max(1u, std::thread::hardware_concurrency());
+            break;
+        default:
+            options.initial = 4;
+            break;
+    }
+    options.initial = std::min(options.initial, options.max);
+    return options;
+}
+
+ConcurrencyLimit::ConcurrencyLimit(const ConcurrencyLimitOptions& options)
+    : options_(options),
+      limit_(options.policy == ConcurrencyPolicy::Fixed ? options.max : options.initial) {
+    stats_.limit = stats_.lowest = stats_.highest = CurrentLimit();
+}
+
+void ConcurrencyLimit::Acquire() {
+    std::unique_lock<std::mutex> guard(lock_);
+    if (TakeSlot()) {
+        return;
+    }
+    // Release hands the slot over (already counted in inFlight_), so a thread
+    // is only woken when there is a slot for it
+    waiting_++;
+    released_.wait(guard, [this] { return grants_ > 0; });
+    grants_--;
+    waiting_--;
+}
+
+bool ConcurrencyLimit::TryAcquire() {
+    std::lock_guard<std::mutex> guard(lock_);
+    return TakeSlot();
+}
+
+bool ConcurrencyLimit::TakeSlot() {
+    // No jumping ahead of threads already waiting
+    if (waiting_ > grants_ || inFlight_ >= CurrentLimit()) {
+        return false;
+    }
+    inFlight_++;
+    windowPeakInFlight_ = std::max(windowPeakInFlight_, inFlight_);
+    return true;
+}
+
+void ConcurrencyLimit::Release(uint64_t latencyNs, bool failed) {
+    std::lock_guard<std::mutex> guard(lock_);
+    inFlight_--;
+    stats_.samples++;
+    stats_.failures += failed ? 1 : 0;
+
+    windowSamples_++;
+    windowFailures_ += failed ? 1 : 0;
+    windowLatencyNs_ += latencyNs;
+    if (windowSamples_ >= std::max<uint64_t>(kMinWindowSamples, CurrentLimit())) {
+        EndWindow();
+    }
+
+    // One slot freed, or several if the limit grew
+    while (waiting_ > grants_ && inFlight_ < CurrentLimit()) {
+        inFlight_++;
+        windowPeakInFlight_ = std::max(windowPeakInFlight_, inFlight_);
+        grants_++;
+        released_.notify_one();
+    }
+}
+
+void ConcurrencyLimit::EndWindow() {
+    double averageNs = static_cast<double>(windowLatencyNs_) / static_cast<double>(windowSamples_);
+    bool overloaded = static_cast<double>(windowFailures_) > kErrorRateLimit * static_cast<double>(windowSamples_);
+    // Only a window that actually used the limit says anything about raising it
+    bool saturated = windowPeakInFlight_ >= CurrentLimit();
+    recentAveragesNs_[windowCount_++ % kNoLoadWindows] = averageNs;
+    auto recentEnd = recentAveragesNs_.begin() + std::min(windowCount_, kNoLoadWindows);
+    double noLoadNs = *std::min_element(recentAveragesNs_.begin(), recentEnd);
+
+    double previous = limit_;
+    switch (options_.policy) {
+        case ConcurrencyPolicy::Fixed:
+            break;
+
+        case ConcurrencyPolicy::Aimd:
+            if (overloaded || averageNs > kAimdLatencyFactor * noLoadNs) {
+                limit_ *= kAimdBackoff;
+            } else if (saturated) {
+                limit_ += 1;
+            }
+            break;
+
+        case ConcurrencyPolicy::Gradient: {
+            double gradient = overloaded ? 0.5 : std::clamp(kGradientTolerance * noLoadNs / averageNs, 0.5, 1.0);
+            if (gradient == 1.0 && !saturated) {
+                break;
+            }
+            double estimate = limit_ * gradient + std::sqrt(limit_);
+            limit_ = limit_ * (1 - kGradientSmoothing) + estimate * kGradientSmoothing;
+            break;
+        }
+    }
+    limit_ = std::clamp(limit_, static_cast<double>(options_.min), static_cast<double>(options_.max));
+
+    if (limit_ < previous) {
+        stats_.decreases++;
+    }
+    stats_.limit = CurrentLimit();
+    stats_.lowest = std::min(stats_.lowest, stats_.limit);
+    stats_.highest = std::max(stats_.highest, stats_.limit);
+
+    windowSamples_ = 0;
+    windowFailures_ = 0;
+    windowLatencyNs_ = 0;
+    windowPeakInFlight_ = inFlight_;
+}
+
+unsigned ConcurrencyLimit::Limit() const {
+    std::lock_guard<std::mutex> guard(lock_);
+    return CurrentLimit();
+}
+
+ConcurrencyLimit::Stats ConcurrencyLimit::GetStats() const {
+    std::lock_guard<std::mutex> guard(lock_);
+    return stats_;
+}
+
+std::wstring ConcurrencyLimit::Describe() const {
+    Stats stats = GetStats();
+    std::wstring text = std::wstring(ConcurrencyPolicyName(options_.policy)) + L" limit " + std::to_wstring(stats.limit);
+    if (stats.lowest != stats.highest) {
+        text += L" (" + std::to_wstring(stats.lowest) + L"-" + std::to_wstring(stats.highest) + L")";
+    }
+    return text;
+}
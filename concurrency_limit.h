@@ -0,0 +1,93 @@
+#pragma once
+#include <array>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include "trace.h"
+
+// How many operations on one kind of object may be in flight at once.
+// Backends saturate at very different points: the SCM serializes service
+// control, while filesystems keep scaling with outstanding I/O, so the limit
+// is found at run time from the latency and failures of completed operations.
+enum class ConcurrencyPolicy {
+    Fixed,     // Always the maximum
+    Aimd,      // +1 per window while saturated; x0.9 on failures or latency over twice the no-load latency
+    Gradient,  // Scaled by no-load / current latency each window, plus sqrt(limit) of headroom
+};
+
+const wchar_t* ConcurrencyPolicyName(ConcurrencyPolicy policy);
+
+// Parses the value of --concurrency; prints the valid values if it is not one
+bool ParseConcurrencyPolicy(const std::wstring& text, ConcurrencyPolicy& policy);
+
+struct ConcurrencyLimitOptions {
+    ConcurrencyPolicy policy = ConcurrencyPolicy::Gradient;
+    unsigned initial = 8;
+    unsigned min = 1;
+    unsigned max = 256;
+};
+
+// Starting point for each backend; max is what the caller can run at once
+// (queue depth or worker threads)
+ConcurrencyLimitOptions DefaultConcurrencyLimit(TraceObject object, ConcurrencyPolicy policy, unsigned max);
+
+// Thread-safe. Each operation is bracketed by Acquire (or TryAcquire) and
+// Release with its latency. Samples are evaluated a window at a time, a
+// window being at least as many samples as the current limit, so one slow
+// or failed operation does not move the limit on its own. The no-load
+// latency is the lowest average of the last kNoLoadWindows windows, so one
+// fast window early on does not set the baseline for the rest of the run.
+class ConcurrencyLimit {
+public:
+    struct Stats {
+        unsigned limit = 0;
+        unsigned lowest = 0;
+        unsigned highest = 0;
+        uint64_t samples = 0;
+        uint64_t failures = 0;
+        uint64_t decreases = 0;
+    };
+
+    explicit ConcurrencyLimit(const ConcurrencyLimitOptions& options);
+
+    ConcurrencyLimit(const ConcurrencyLimit&) = delete;
+    ConcurrencyLimit& operator=(const ConcurrencyLimit&) = delete;
+
+    // Blocks until fewer than Limit() operations are in flight
+    void Acquire();
+    bool TryAcquire();
+    void Release(uint64_t latencyNs, bool failed);
+
+    unsigned Limit() const;
+    Stats GetStats() const;
+
+    // For summary lines: "gradient limit 24 (4-40)"
+    std::wstring Describe() const;
+
+private:
+    static constexpr size_t kNoLoadWindows = 32;
+
+    unsigned CurrentLimit() const { return static_cast<unsigned>(limit_); }
+    bool TakeSlot();
+    void EndWindow();
+
+    const ConcurrencyLimitOptions options_;
+    mutable std::mutex lock_;
+    std::condition_variable released_;
+    double limit_;
+    unsigned inFlight_ = 0;  // Including slots granted to waiters that have not woken yet
+    unsigned waiting_ = 0;
+    unsigned grants_ = 0;
+    Stats stats_;
+
+    // Current window
+    uint64_t windowSamples_ = 0;
+    uint64_t windowFailures_ = 0;
+    uint64_t windowLatencyNs_ = 0;
+    unsigned windowPeakInFlight_ = 0;
+
+    // Averages of the most recent windows, oldest overwritten first
+    std::array<double, kNoLoadWindows> recentAveragesNs_ = {};
+    size_t windowCount_ = 0;
+};
@@ -3,15 +3,72 @@
 #include "privilege_guard.h"
 #include <windows.h>
 #include <iostream>
+#include <iterator>
 
 namespace {
 
+// EVENT_BASIC_INFORMATION; NtQueryEvent isn't in the SDK headers so it is
+// resolved from ntdll at runtime
+struct EventBasicInformation {
+    ULONG eventType;   // 0 = NotificationEvent (manual reset), 1 = SynchronizationEvent (auto reset)
+    LONG  eventState;  // Non-zero when signaled
+};
+
+using NtQueryEventFn = LONG (NTAPI*)(HANDLE eventHandle, ULONG infoClass, PVOID info, ULONG infoLength, PULONG returnLength);
+
+const ULONG kEventBasicInformation = 0;
+const ULONG kNotificationEvent = 0;
+
+// Reads the event type and state without waiting on it, so unlike "query"
+// this does not consume the signal of an auto-reset event
+bool QueryEventInformation(HANDLE handle, EventBasicInformation& info) {
+    static NtQueryEventFn ntQueryEvent = reinterpret_cast<NtQueryEventFn>(
+        GetProcAddress(GetModuleHandleW(L"ntdll.dll"), "NtQueryEvent"));
+    if (!ntQueryEvent) {
+        PrintLastError(L"GetProcAddress(NtQueryEvent)");
+        return false;
+    }
+
+    TraceSpan trace(TraceOp::EventControl, kTraceEventQueryState);
+    LONG status = ntQueryEvent(handle, kEventBasicInformation, &info, sizeof(info), nullptr);
+    trace.Finish(static_cast<uint32_t>(status));
+    if (status < 0) {
+        std::wcerr << L"NtQueryEvent failed: 0x" << std::hex << static_cast<ULONG>(status) << std::dec << L"\n";
+        return false;
+    }
+    return true;
+}
+
+std::wstring GetFullEventName(const std::wstring& eventName) {
+    // Prepend "Global\" if the event name doesn't contain a backslash
+    if (eventName.find(L'\\') == std::wstring::npos) {
+        return L"Global\\" + eventName;
+    }
+    return eventName;
+}
+
+class Win32ProbeEvent : public ProbeEvent {
+public:
+    Win32ProbeEvent(HANDLE handle, bool manualReset) : handle_(handle), manualReset_(manualReset) {}
+
+    bool Set() override { return SetEvent(handle_) != 0; }
+    bool Reset() override { return ResetEvent(handle_) != 0; }
+    bool Wait(uint32_t timeoutMs) override { return WaitForSingleObject(handle_, timeoutMs) == WAIT_OBJECT_0; }
+    bool IsManualReset() const override { return manualReset_; }
+
+private:
+    HANDLE handle_;
+    bool manualReset_;
+};
+
 bool SetEventAcl(HANDLE handle) {
     return SetRestrictiveAcl(handle, SE_KERNEL_OBJECT, EVENT_ALL_ACCESS, SYNCHRONIZE);
 }
 
 bool QueryEventState(HANDLE handle) {
+    TraceSpan trace(TraceOp::EventControl, kTraceEventWait);
     DWORD result = WaitForSingleObject(handle, 0);
+    FinishTraceSpan(trace, result != WAIT_FAILED);
     
     if (result == WAIT_OBJECT_0) {
         std::wcout << L"Event state  : Signaled\n";
@@ -25,68 +82,59 @@ bool QueryEventState(HANDLE handle) {
     }
 }
 
-}  // namespace
-
-int ProcessEventCommand(const std::wstring& eventName, const std::wstring& command) {
-    // Prepend "Global\" if the event name doesn't contain a backslash
-    std::wstring fullEventName = eventName;
-    if (fullEventName.find(L'\\') == std::wstring::npos) {
-        fullEventName = L"Global\\" + fullEventName;
+bool ReadEventState(HANDLE handle) {
+    EventBasicInformation info = {};
+    if (!QueryEventInformation(handle, info)) {
+        return false;
     }
 
-    bool requiresTakeOwnership = false;
-    bool requiresRestorePrivilege = false;
-    DWORD desiredAccess = 0;
-    
-    if (command == L"set" || command == L"unset") {
-        desiredAccess = EVENT_MODIFY_STATE;
-    } else if (command == L"harden") {
-        requiresRestorePrivilege = true; // Needed to set the owner to SYSTEM
-        requiresTakeOwnership = true; // needed to set WRITE_DAC
-        desiredAccess = WRITE_DAC | WRITE_OWNER;
-    } else if (command == L"query") {
-        desiredAccess = SYNCHRONIZE;
-    } else if (command == L"takeown") {
-        desiredAccess = WRITE_OWNER;
-        requiresTakeOwnership = true;
-    } else if (command == L"weaken") {
-        desiredAccess = WRITE_DAC;
-    } else {
-        std::wcerr << L"Unknown event command: " << command << L"\n";
-        std::wcerr << L"Valid commands: set, unset, harden, query, takeown, weaken\n";
-        return 1;
-    }
+    std::wcout << L"Event type   : " << (info.eventType == kNotificationEvent ? L"Manual reset" : L"Auto reset") << L"\n";
+    std::wcout << L"Event state  : " << (info.eventState ? L"Signaled" : L"Not signaled") << L"\n";
+    return true;
+}
 
-    // Enable SE_TAKE_OWNERSHIP_NAME privilege for WRITE_OWNER access
-    PrivilegeGuard takeownPrivilegeGuard(requiresTakeOwnership ? SE_TAKE_OWNERSHIP_NAME : nullptr);    
-    if (takeownPrivilegeGuard.IsValid() && !takeownPrivilegeGuard.IsEnabled()) {
-        return 1;  // Error message already printed by PrivilegeGuard
-    }
+const CommandSpec kEventCommands[] = {
+    // name        desiredAccess              takeown restore
+    { L"set",     EVENT_MODIFY_STATE,         false,  false },
+    { L"unset",   EVENT_MODIFY_STATE,         false,  false },
+    { L"harden",  WRITE_DAC | WRITE_OWNER,    true,   true  },  // restore: owner -> SYSTEM, takeown: WRITE_DAC
+    { L"query",   SYNCHRONIZE,                false,  false },
+    { L"state",   EVENT_QUERY_STATE,          false,  false },
+    { L"takeown", WRITE_OWNER,                true,   false },
+    { L"weaken",  WRITE_DAC,                  false,  false },
+};
 
-    // Enable SE_RESTORE_NAME privilege if setting owner (allows setting arbitrary owners)
-    PrivilegeGuard restorePrivilegeGuard(requiresRestorePrivilege ? SE_RESTORE_NAME : nullptr);    
-    if (restorePrivilegeGuard.IsValid() && !restorePrivilegeGuard.IsEnabled()) {
-        return 1;  // Error message already printed by PrivilegeGuard
+// Open callback for RunCommandChain; eventHandle is replaced by the new open
+ChainOpenResult OpenEventForChain(const std::wstring& fullEventName, DWORD desiredAccess, HANDLE& eventHandle) {
+    if (eventHandle) {
+        CloseHandle(eventHandle);
     }
-    
     std::wcout << L"Opening event: " << fullEventName << L" with permissions: 0x" << std::hex << desiredAccess << std::dec << L"\n";
 
-    HANDLE eventHandle = OpenEventW(desiredAccess, FALSE, fullEventName.c_str());
-    if (!eventHandle || eventHandle == INVALID_HANDLE_VALUE) {
-        PrintLastError(L"OpenEvent");
-        return 1;
+    TraceSpan trace(TraceOp::Open, TraceObject::Event, fullEventName, desiredAccess);
+    eventHandle = OpenEventW(desiredAccess, FALSE, fullEventName.c_str());
+    FinishTraceSpan(trace, eventHandle != nullptr);
+    if (eventHandle) {
+        return ChainOpenResult::Opened;
     }
+    return GetLastError() == ERROR_ACCESS_DENIED ? ChainOpenResult::AccessDenied : ChainOpenResult::Failed;
+}
 
+bool RunEventCommand(HANDLE eventHandle, const std::wstring& command) {
     bool success = false;
     if (command == L"set") {
+        TraceSpan trace(TraceOp::EventControl, kTraceEventSet);
         success = SetEvent(eventHandle) != 0;
+        FinishTraceSpan(trace, success);
         if (success) {
             std::wcout << L"Event set successfully\n";
         } else {
             PrintLastError(L"SetEvent");
         }
     } else if (command == L"unset") {
+        TraceSpan trace(TraceOp::EventControl, kTraceEventReset);
         success = ResetEvent(eventHandle) != 0;
+        FinishTraceSpan(trace, success);
         if (success) {
             std::wcout << L"Event reset successfully\n";
         } else {
@@ -108,10 +156,91 @@ int ProcessEventCommand(const std::wstring& eventName, const std::wstring& comma
         if (success) {
             std::wcout << L"Event ACL weakened successfully (Everyone has full access)\n";
         }
+    } else if (command == L"state") {
+        success = ReadEventState(eventHandle);
     } else {  // query
         success = QueryEventState(eventHandle);
     }
+    return success;
+}
+
+}  // namespace
+
+int ProcessEventCommand(const std::wstring& eventName, const std::wstring& command) {
+    std::wstring fullEventName = GetFullEventName(eventName);
+    TraceContext traceContext(TraceObject::Event, fullEventName);
+
+    std::vector<const CommandSpec*> chain;
+    if (!ParseCommandChain(command, L"event", kEventCommands, std::size(kEventCommands), chain)) {
+        return 1;
+    }
+
+    // Enable SE_TAKE_OWNERSHIP_NAME privilege for WRITE_OWNER access
+    PrivilegeGuard takeownPrivilegeGuard(ChainRequiresTakeOwnership(chain) ? SE_TAKE_OWNERSHIP_NAME : nullptr);    
+    if (takeownPrivilegeGuard.IsValid() && !takeownPrivilegeGuard.IsEnabled()) {
+        return 1;  // Error message already printed by PrivilegeGuard
+    }
+
+    // Enable SE_RESTORE_NAME privilege if setting owner (allows setting arbitrary owners)
+    PrivilegeGuard restorePrivilegeGuard(ChainRequiresRestorePrivilege(chain) ? SE_RESTORE_NAME : nullptr);    
+    if (restorePrivilegeGuard.IsValid() && !restorePrivilegeGuard.IsEnabled()) {
+        return 1;  // Error message already printed by PrivilegeGuard
+    }
+
+    HANDLE eventHandle = nullptr;
+    ChainResult result = RunCommandChain(chain,
+        [&](uint32_t desiredAccess) { return OpenEventForChain(fullEventName, desiredAccess, eventHandle); },
+        [&](const CommandSpec& spec) { return RunEventCommand(eventHandle, spec.name); });
+    if (result == ChainResult::OpenFailed) {
+        PrintLastError(L"OpenEvent");
+    }
+
+    if (eventHandle) {
+        CloseHandle(eventHandle);
+    }
+    return result == ChainResult::Succeeded ? 0 : 1;
+}
+
+int ProcessEventProbe(const std::wstring& eventName, const EventProbeOptions& options) {
+    bool manualReset = !options.autoReset;
+
+    if (options.simulated) {
+        std::wcout << L"Probing simulated event\n";
+        SimulatedEvent event(manualReset);
+        EventProbeResult result = RunEventProbe(event, options);
+        PrintEventProbeResult(result, options, manualReset);
+        return result.missedWakes ? 1 : 0;
+    }
+
+    std::wstring fullEventName = GetFullEventName(eventName);
+    DWORD desiredAccess = EVENT_MODIFY_STATE | SYNCHRONIZE | EVENT_QUERY_STATE;
+    std::wcout << L"Creating event: " << fullEventName << L" with permissions: 0x" << std::hex << desiredAccess << std::dec << L"\n";
+
+    TraceSpan trace(TraceOp::Open, TraceObject::Event, fullEventName, desiredAccess);
+    HANDLE eventHandle = CreateEventExW(nullptr, fullEventName.c_str(),
+                                        manualReset ? CREATE_EVENT_MANUAL_RESET : 0, desiredAccess);
+    FinishTraceSpan(trace, eventHandle != nullptr);
+    if (!eventHandle) {
+        PrintLastError(L"CreateEventEx");
+        return 1;
+    }
+
+    if (GetLastError() == ERROR_ALREADY_EXISTS) {
+        // The existing event keeps its own reset type; probe it as it is
+        EventBasicInformation info = {};
+        if (!QueryEventInformation(eventHandle, info)) {
+            CloseHandle(eventHandle);
+            return 1;
+        }
+        manualReset = (info.eventType == kNotificationEvent);
+        std::wcout << L"Event already exists - it will be signaled and left non-signaled\n";
+        ResetEvent(eventHandle);
+    }
+
+    Win32ProbeEvent event(eventHandle, manualReset);
+    EventProbeResult result = RunEventProbe(event, options);
+    PrintEventProbeResult(result, options, manualReset);
 
     CloseHandle(eventHandle);
-    return success ? 0 : 1;
+    return result.missedWakes ? 1 : 0;
 }
@@ -1,4 +1,9 @@
 #pragma once
 #include <string>
+#include "event_probe.h"
 
 int ProcessEventCommand(const std::wstring& eventName, const std::wstring& command);
+
+// Signals the named event repeatedly with waiter threads blocked on it and
+// reports Set -> wake latency. The event is created if it does not exist.
+int ProcessEventProbe(const std::wstring& eventName, const EventProbeOptions& options);
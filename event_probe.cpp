@@ -0,0 +1,232 @@
+#include "event_probe.h"
+#include <atomic>
+#include <chrono>
+#include <cwchar>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <thread>
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+// Waiters poll this often for shutdown, and a missing wake is declared after it
+constexpr uint32_t kWaitSliceMs = 100;
+constexpr auto kWakeTimeout = std::chrono::seconds(2);
+
+uint64_t NowNs() {
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+        Clock::now().time_since_epoch()).count());
+}
+
+bool ParseCount(const std::wstring& text, unsigned& value) {
+    wchar_t* endPtr = nullptr;
+    unsigned long parsed = wcstoul(text.c_str(), &endPtr, 10);
+    if (text.empty() || *endPtr != L'\0' || parsed == 0 || parsed > 1000000) {
+        return false;
+    }
+    value = static_cast<unsigned>(parsed);
+    return true;
+}
+
+// Spins briefly, then yields, until pred() holds or the deadline passes
+template <typename Pred>
+bool SpinUntil(Pred pred, Clock::time_point deadline) {
+    for (unsigned spins = 0; !pred(); spins++) {
+        if (Clock::now() >= deadline) {
+            return false;
+        }
+        if (spins > 1000) {
+            std::this_thread::yield();
+        }
+    }
+    return true;
+}
+
+struct ProbeState {
+    std::atomic<bool> stop{false};
+    std::atomic<unsigned> waiting{0};      // Threads about to block / blocked in Wait()
+    std::atomic<unsigned> woken{0};        // Wakes observed in the current iteration
+    std::atomic<uint64_t> generation{0};   // Bumped after each manual-reset Reset()
+    std::atomic<uint64_t> signalTimeNs{0};
+
+    // Woken manual-reset waiters block here until the next generation rather
+    // than spinning, so they don't steal CPU from the threads being timed
+    std::mutex generationLock;
+    std::condition_variable generationChanged;
+
+    void NextGeneration() {
+        {
+            std::lock_guard<std::mutex> guard(generationLock);
+            generation.fetch_add(1);
+        }
+        generationChanged.notify_all();
+    }
+
+    void WaitForNextGeneration(uint64_t current) {
+        std::unique_lock<std::mutex> guard(generationLock);
+        generationChanged.wait_for(guard, kWakeTimeout, [&] { return generation.load() != current; });
+    }
+};
+
+void WaiterThread(ProbeEvent& event, ProbeState& state, LatencyHistogram& latency) {
+    bool manualReset = event.IsManualReset();
+
+    while (!state.stop.load()) {
+        uint64_t generation = state.generation.load();
+        state.waiting.fetch_add(1);
+        bool signaled = event.Wait(kWaitSliceMs);
+        uint64_t wakeNs = NowNs();
+        state.waiting.fetch_sub(1);
+
+        if (!signaled || state.stop.load()) {
+            continue;
+        }
+
+        latency.Record(wakeNs - state.signalTimeNs.load());
+        state.woken.fetch_add(1);
+
+        // A manual-reset event stays signaled until the controller resets it;
+        // don't wait on it again until then or every pass would "wake" at once
+        if (manualReset) {
+            state.WaitForNextGeneration(generation);
+        }
+    }
+}
+
+}  // namespace
+
+SimulatedEvent::SimulatedEvent(bool manualReset, bool initialState)
+    : manualReset_(manualReset), signaled_(initialState) {
+}
+
+bool SimulatedEvent::Set() {
+    {
+        std::lock_guard<std::mutex> guard(lock_);
+        signaled_ = true;
+    }
+    if (manualReset_) {
+        cv_.notify_all();
+    } else {
+        cv_.notify_one();
+    }
+    return true;
+}
+
+bool SimulatedEvent::Reset() {
+    std::lock_guard<std::mutex> guard(lock_);
+    signaled_ = false;
+    return true;
+}
+
+bool SimulatedEvent::Wait(uint32_t timeoutMs) {
+    std::unique_lock<std::mutex> guard(lock_);
+    if (!cv_.wait_for(guard, std::chrono::milliseconds(timeoutMs), [this] { return signaled_; })) {
+        return false;
+    }
+    if (!manualReset_) {
+        signaled_ = false;  // Auto-reset: this waiter consumes the signal
+    }
+    return true;
+}
+
+bool SimulatedEvent::IsSignaled() const {
+    std::lock_guard<std::mutex> guard(lock_);
+    return signaled_;
+}
+
+SimulatedEvent& OpenSimulatedEvent(const std::wstring& name, bool manualReset) {
+    static std::mutex lock;
+    static std::map<std::wstring, std::unique_ptr<SimulatedEvent>> events;
+
+    std::lock_guard<std::mutex> guard(lock);
+    std::unique_ptr<SimulatedEvent>& event = events[name];
+    if (!event) {
+        event = std::make_unique<SimulatedEvent>(manualReset);
+    }
+    return *event;
+}
+
+bool ParseEventProbeOptions(const std::vector<std::wstring>& args, size_t first, EventProbeOptions& options) {
+    for (size_t i = first; i < args.size(); i++) {
+        const std::wstring& arg = args[i];
+        if (arg == L"--auto-reset") {
+            options.autoReset = true;
+        } else if (arg == L"--simulated") {
+            options.simulated = true;
+        } else if ((arg == L"--waiters" || arg == L"--iterations") && i + 1 < args.size()) {
+            unsigned& value = (arg == L"--waiters") ? options.waiters : options.iterations;
+            if (!ParseCount(args[++i], value)) {
+                std::wcerr << L"Invalid value for " << arg << L": " << args[i] << L"\n";
+                return false;
+            }
+        } else {
+            std::wcerr << L"Unknown probe option: " << arg << L"\n";
+            std::wcerr << L"Valid options: --waiters <n>, --iterations <n>, --auto-reset, --simulated\n";
+            return false;
+        }
+    }
+    return true;
+}
+
+EventProbeResult RunEventProbe(ProbeEvent& event, const EventProbeOptions& options) {
+    EventProbeResult result;
+    ProbeState state;
+    bool manualReset = event.IsManualReset();
+    unsigned expectedWakes = manualReset ? options.waiters : 1;
+
+    // Each waiter records into its own histogram; merged after join
+    std::vector<LatencyHistogram> latencies(options.waiters);
+    std::vector<std::thread> waiters;
+    waiters.reserve(options.waiters);
+    for (unsigned i = 0; i < options.waiters; i++) {
+        waiters.emplace_back(WaiterThread, std::ref(event), std::ref(state), std::ref(latencies[i]));
+    }
+
+    uint64_t startNs = NowNs();
+    for (unsigned iteration = 0; iteration < options.iterations; iteration++) {
+        // Only signal once every waiter is parked, so we time a real wake-up
+        // rather than a thread that has not reached Wait() yet
+        SpinUntil([&] { return state.waiting.load() == options.waiters; }, Clock::now() + kWakeTimeout);
+
+        state.woken.store(0);
+        uint64_t setStartNs = NowNs();
+        state.signalTimeNs.store(setStartNs);
+        event.Set();
+        result.setCall.Record(NowNs() - setStartNs);
+
+        if (!SpinUntil([&] { return state.woken.load() >= expectedWakes; }, Clock::now() + kWakeTimeout)) {
+            result.missedWakes++;
+        }
+
+        if (manualReset) {
+            event.Reset();
+            state.NextGeneration();
+        }
+    }
+    result.elapsedNs = NowNs() - startNs;
+
+    state.stop.store(true);
+    state.NextGeneration();
+    for (auto& waiter : waiters) {
+        waiter.join();
+    }
+    event.Reset();  // A final auto-reset Set may have found nobody waiting
+
+    for (const auto& latency : latencies) {
+        result.setToWake.Merge(latency);
+    }
+    return result;
+}
+
+void PrintEventProbeResult(const EventProbeResult& result, const EventProbeOptions& options, bool manualReset) {
+    std::wcout << L"Probe        : " << (manualReset ? L"manual-reset" : L"auto-reset")
+               << L" event, " << options.waiters << L" waiter(s), " << options.iterations << L" iteration(s)\n";
+    std::wcout << L"Elapsed      : " << FormatDuration(result.elapsedNs) << L"\n";
+    if (result.missedWakes) {
+        std::wcout << L"Missed wakes : " << result.missedWakes << L"\n";
+    }
+    result.setCall.Print(std::wcout, L"Set call     ");
+    result.setToWake.Print(std::wcout, L"Set -> wake  ");
+}
@@ -0,0 +1,71 @@
+#pragma once
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "latency_histogram.h"
+
+// Synchronization event as seen by the latency probe. Implemented over Win32
+// events in event_operations.cpp and over a condition variable by SimulatedEvent.
+class ProbeEvent {
+public:
+    virtual ~ProbeEvent() = default;
+    virtual bool Set() = 0;
+    virtual bool Reset() = 0;
+    // Returns true if the event was signaled within timeoutMs
+    virtual bool Wait(uint32_t timeoutMs) = 0;
+    virtual bool IsManualReset() const = 0;
+};
+
+// In-process event with Win32 semantics: a manual-reset event releases every
+// waiter until reset, an auto-reset event releases exactly one waiter per Set.
+// std::condition_variable sits on futexes on Linux, so this is the simulated
+// backend used to validate the probe off Windows.
+class SimulatedEvent : public ProbeEvent {
+public:
+    explicit SimulatedEvent(bool manualReset, bool initialState = false);
+
+    bool Set() override;
+    bool Reset() override;
+    bool Wait(uint32_t timeoutMs) override;
+    bool IsManualReset() const override { return manualReset_; }
+
+    // Non-destructive state read
+    bool IsSignaled() const;
+
+private:
+    const bool manualReset_;
+    bool signaled_;
+    mutable std::mutex lock_;
+    std::condition_variable cv_;
+};
+
+// Named simulated events, created non-signaled on first use with the given
+// type and kept for the life of the process, so under --serve they keep their
+// state across requests. The reference stays valid until exit.
+SimulatedEvent& OpenSimulatedEvent(const std::wstring& name, bool manualReset);
+
+struct EventProbeOptions {
+    unsigned waiters = 4;
+    unsigned iterations = 1000;
+    bool autoReset = false;
+    bool simulated = false;  // Ignored where SimulatedEvent is the only backend
+};
+
+struct EventProbeResult {
+    LatencyHistogram setToWake;  // Set() -> waiter returning from Wait()
+    LatencyHistogram setCall;    // Duration of the Set() call itself
+    uint64_t missedWakes = 0;    // Iterations where not every expected waiter woke in time
+    uint64_t elapsedNs = 0;
+};
+
+// Parses "--waiters N --iterations N --auto-reset --simulated" from args[first..]
+bool ParseEventProbeOptions(const std::vector<std::wstring>& args, size_t first, EventProbeOptions& options);
+
+// Starts options.waiters threads blocked on the event and signals it
+// options.iterations times, timing each Set -> wake. The event must be
+// non-signaled on entry; it is left non-signaled.
+EventProbeResult RunEventProbe(ProbeEvent& event, const EventProbeOptions& options);
+
+void PrintEventProbeResult(const EventProbeResult& result, const EventProbeOptions& options, bool manualReset);
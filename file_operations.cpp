@@ -1,57 +1,45 @@
 #include "file_operations.h"
 #include "common.h"
+#include "latency_histogram.h"
 #include "privilege_guard.h"
 #include <windows.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cwctype>
 #include <iostream>
+#include <iterator>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
 
 namespace {
 
-bool SetFileAcl(HANDLE handle) {
-    return SetRestrictiveAcl(handle, SE_FILE_OBJECT, FILE_ALL_ACCESS, FILE_GENERIC_READ);
+bool SetFileAcl(HANDLE handle, bool verbose) {
+    return SetRestrictiveAcl(handle, SE_FILE_OBJECT, FILE_ALL_ACCESS, FILE_GENERIC_READ, verbose);
 }
 
-}  // namespace
+// takeown/weaken need SE_TAKE_OWNERSHIP_NAME to get past restrictive DACLs when
+// opening, and SE_RESTORE_NAME to set the owner / DACL without WRITE_DAC access
+const CommandSpec kFileCommands[] = {
+    // name        desiredAccess            takeown restore
+    { L"harden",  WRITE_DAC | WRITE_OWNER, true,   true },
+    { L"takeown", WRITE_OWNER,             true,   true },
+    { L"weaken",  WRITE_DAC,               true,   true },
+};
 
-int ProcessFileCommand(const std::wstring& filePath, const std::wstring& command) {
-    bool requiresTakeOwnership = false;
-    bool requiresRestorePrivilege = false;
-    DWORD desiredAccess = 0;
-    
-    if (command == L"harden") {
-        desiredAccess = WRITE_DAC | WRITE_OWNER;
-        requiresRestorePrivilege = true;  // Needed to set owner to SYSTEM
-        requiresTakeOwnership = true;     // Needed for WRITE_OWNER access
-    } else if (command == L"takeown") {
-        desiredAccess = WRITE_OWNER;
-        requiresTakeOwnership = true;
-        requiresRestorePrivilege = true;  // Needed to set owner to Administrators
-    } else if (command == L"weaken") {
-        desiredAccess = WRITE_DAC;
-        requiresTakeOwnership = true;     // Needed to bypass restrictive DACLs when opening
-        requiresRestorePrivilege = true;  // Needed to modify DACL when you don't have WRITE_DAC access
-    } else {
-        std::wcerr << L"Unknown file command: " << command << L"\n";
-        std::wcerr << L"Valid commands: harden, takeown, weaken\n";
-        return 1;
+// Open callback for RunCommandChain; fileHandle is replaced by the new open,
+// or nullptr if it fails
+ChainOpenResult OpenFileForChain(const std::wstring& filePath, DWORD desiredAccess, HANDLE& fileHandle, bool verbose) {
+    if (fileHandle) {
+        CloseHandle(fileHandle);
     }
-
-    // Enable SE_TAKE_OWNERSHIP_NAME privilege for WRITE_OWNER access
-    PrivilegeGuard takeownPrivilegeGuard(requiresTakeOwnership ? SE_TAKE_OWNERSHIP_NAME : nullptr);
-    
-    if (takeownPrivilegeGuard.IsValid() && !takeownPrivilegeGuard.IsEnabled()) {
-        return 1;  // Error message already printed by PrivilegeGuard
+    if (verbose) {
+        std::wcout << L"Opening file: " << filePath << L" with permissions: 0x" << std::hex << desiredAccess << std::dec << L"\n";
     }
 
-    // Enable SE_RESTORE_NAME privilege if setting owner to SYSTEM/Administrators
-    PrivilegeGuard restorePrivilegeGuard(requiresRestorePrivilege ? SE_RESTORE_NAME : nullptr);
-    
-    if (restorePrivilegeGuard.IsValid() && !restorePrivilegeGuard.IsEnabled()) {
-        return 1;  // Error message already printed by PrivilegeGuard
-    }
-
-    std::wcout << L"Opening file: " << filePath << L" with permissions: 0x" << std::hex << desiredAccess << std::dec << L"\n";
-
-    HANDLE fileHandle = CreateFileW(
+    TraceSpan trace(TraceOp::Open, TraceObject::File, filePath, desiredAccess);
+    fileHandle = CreateFileW(
         filePath.c_str(),
         desiredAccess,
         FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
@@ -60,35 +48,335 @@ int ProcessFileCommand(const std::wstring& filePath, const std::wstring& command
         FILE_FLAG_BACKUP_SEMANTICS,  // Allows opening directories
         nullptr
     );
-
-    if (!fileHandle || fileHandle == INVALID_HANDLE_VALUE) {
-        PrintLastError(L"CreateFile");
-        return 1;
+    FinishTraceSpan(trace, fileHandle != INVALID_HANDLE_VALUE);
+    if (fileHandle != INVALID_HANDLE_VALUE) {
+        return ChainOpenResult::Opened;
     }
+    fileHandle = nullptr;
+    return GetLastError() == ERROR_ACCESS_DENIED ? ChainOpenResult::AccessDenied : ChainOpenResult::Failed;
+}
 
+bool RunFileCommand(HANDLE fileHandle, const std::wstring& filePath, const std::wstring& command, bool verbose) {
     bool success = false;
     if (command == L"harden") {
-        success = SetFileAcl(fileHandle);
-        if (success) {
+        success = SetFileAcl(fileHandle, verbose);
+        if (success && verbose) {
             std::wcout << L"File ACL hardened successfully\n";
         }
-        CloseHandle(fileHandle);
     } else if (command == L"takeown") {
-        DWORD result = TakeOwnership(fileHandle, SE_FILE_OBJECT);
+        DWORD result = TakeOwnership(fileHandle, SE_FILE_OBJECT, verbose);
         success = (result == ERROR_SUCCESS);
-        if (success) {
+        if (success && verbose) {
             std::wcout << L"File ownership transferred to Administrators\n";
         }
-        CloseHandle(fileHandle);
     } else if (command == L"weaken") {
-        // Close the handle and use SetNamedSecurityInfo instead
+        // Use SetNamedSecurityInfo instead of the handle
         // This works with privileges rather than handle access rights
-        CloseHandle(fileHandle);
-        success = WeakenAclByName(filePath.c_str(), SE_FILE_OBJECT, FILE_ALL_ACCESS);
-        if (success) {
+        success = WeakenAclByName(filePath.c_str(), SE_FILE_OBJECT, FILE_ALL_ACCESS, verbose);
+        if (success && verbose) {
             std::wcout << L"File ACL weakened successfully (Everyone has full access)\n";
         }
     }
+    return success;
+}
+
+bool RunFileChain(const std::wstring& filePath, const std::vector<const CommandSpec*>& chain, bool verbose) {
+    TraceContext traceContext(TraceObject::File, filePath);
+
+    HANDLE fileHandle = nullptr;
+    ChainResult result = RunCommandChain(chain,
+        [&](uint32_t desiredAccess) { return OpenFileForChain(filePath, desiredAccess, fileHandle, verbose); },
+        [&](const CommandSpec& spec) { return RunFileCommand(fileHandle, filePath, spec.name, verbose); });
+    if (result == ChainResult::OpenFailed) {
+        PrintLastError(L"CreateFile");
+    }
+
+    if (fileHandle) {
+        CloseHandle(fileHandle);
+    }
+    return result == ChainResult::Succeeded;
+}
+
+// Applies the chain to the objects below a directory for --recursive. There
+// is no overlapped form of CreateFile/SetSecurityInfo for security changes,
+// so objects are handed to a pool of workers through an I/O completion port
+// instead, and each worker waits on the filesystem for one object at a time.
+// The calls block rather than compute, so there are a few workers per CPU
+// (never more than queueDepth), and the port only lets about one per CPU run
+// at a time. queueDepth bounds the objects submitted but not finished; the
+// enumerating thread blocks once that many are outstanding. How many of the
+// workers touch the filesystem at once follows the concurrency policy.
+class FileWorkQueue {
+public:
+    FileWorkQueue(const std::vector<const CommandSpec*>& chain, const FileCommandOptions& options)
+        : chain_(chain),
+          workerCount_(std::min(options.queueDepth, std::max(1u, std::thread::hardware_concurrency()) * kWorkersPerCpu)),
+          limit_(DefaultConcurrencyLimit(TraceObject::File, options.concurrency, workerCount_)) {
+        port_ = CreateIoCompletionPort(INVALID_HANDLE_VALUE, nullptr, 0, 0);
+        if (!port_) {
+            PrintLastError(L"CreateIoCompletionPort");
+            return;
+        }
+        LONG queueDepth = static_cast<LONG>(options.queueDepth);
+        slots_ = CreateSemaphoreW(nullptr, queueDepth, queueDepth, nullptr);
+        if (!slots_) {
+            PrintLastError(L"CreateSemaphore");
+            return;
+        }
+        for (unsigned i = 0; i < workerCount_; i++) {
+            workers_.emplace_back(&FileWorkQueue::WorkerLoop, this);
+        }
+    }
+
+    ~FileWorkQueue() {
+        Drain();
+        if (slots_) {
+            CloseHandle(slots_);
+        }
+        if (port_) {
+            CloseHandle(port_);
+        }
+    }
+
+    FileWorkQueue(const FileWorkQueue&) = delete;
+    FileWorkQueue& operator=(const FileWorkQueue&) = delete;
+
+    bool IsValid() const { return !workers_.empty(); }
+
+    void Submit(const std::wstring& filePath) {
+        WaitForSingleObject(slots_, INFINITE);
+        auto* item = new std::wstring(filePath);
+        if (!PostQueuedCompletionStatus(port_, 0, reinterpret_cast<ULONG_PTR>(item), nullptr)) {
+            PrintLastError(L"PostQueuedCompletionStatus");
+            delete item;
+            failures_++;
+            ReleaseSemaphore(slots_, 1, nullptr);
+        }
+    }
+
+    // Waits for every submitted object and stops the workers
+    void Drain() {
+        // A zero key tells one worker to exit; it is queued behind all real work
+        for (size_t i = 0; i < workers_.size(); i++) {
+            PostQueuedCompletionStatus(port_, 0, 0, nullptr);
+        }
+        for (auto& worker : workers_) {
+            worker.join();
+        }
+        workers_.clear();
+    }
+
+    uint64_t Failures() const { return failures_; }
+    unsigned Workers() const { return workerCount_; }
+    std::wstring DescribeLimit() const { return limit_.Describe(); }
+
+private:
+    static constexpr unsigned kWorkersPerCpu = 4;
+
+    void WorkerLoop() {
+        for (;;) {
+            DWORD bytes = 0;
+            ULONG_PTR key = 0;
+            LPOVERLAPPED overlapped = nullptr;
+            if (!GetQueuedCompletionStatus(port_, &bytes, &key, &overlapped, INFINITE) || key == 0) {
+                return;
+            }
+
+            auto* filePath = reinterpret_cast<std::wstring*>(key);
+            limit_.Acquire();
+            auto start = std::chrono::steady_clock::now();
+            bool succeeded = RunFileChain(*filePath, chain_, false);
+            auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start);
+            limit_.Release(static_cast<uint64_t>(elapsed.count()), !succeeded);
+
+            if (!succeeded) {
+                std::lock_guard<std::mutex> guard(errorLock_);
+                std::wcerr << L"Failed: " << *filePath << L"\n";
+                failures_++;
+            }
+            delete filePath;
+            ReleaseSemaphore(slots_, 1, nullptr);
+        }
+    }
+
+    const std::vector<const CommandSpec*>& chain_;
+    unsigned workerCount_;
+    ConcurrencyLimit limit_;
+    HANDLE port_ = nullptr;
+    HANDLE slots_ = nullptr;
+    std::vector<std::thread> workers_;
+    std::atomic<uint64_t> failures_{ 0 };
+    std::mutex errorLock_;
+};
+
+// Batch names are matched case-insensitively, like the filesystem does
+std::wstring LowerName(std::wstring name) {
+    std::transform(name.begin(), name.end(), name.begin(), [](wchar_t c) { return static_cast<wchar_t>(towlower(c)); });
+    return name;
+}
+
+struct WalkStats {
+    uint64_t objects = 0;
+    uint64_t failures = 0;
+    uint64_t skipped = 0;  // Symbolic links and junctions - not followed, and their ACL is not the target's
+};
+
+// Hands everything below directory to the queue. Directories still to be
+// listed are kept on a stack of paths rather than the thread's stack, and
+// only one find handle is open at a time, so tree depth costs neither.
+void WalkDirectory(const std::wstring& root, FileWorkQueue& queue, WalkStats& stats) {
+    std::vector<std::wstring> pending = { root };
+    while (!pending.empty()) {
+        std::wstring directory = std::move(pending.back());
+        pending.pop_back();
+
+        WIN32_FIND_DATAW findData;
+        HANDLE find = FindFirstFileExW((directory + L"\\*").c_str(), FindExInfoBasic, &findData,
+                                       FindExSearchNameMatch, nullptr, FIND_FIRST_EX_LARGE_FETCH);
+        if (find == INVALID_HANDLE_VALUE) {
+            std::wcerr << directory << L": ";
+            PrintLastError(L"FindFirstFileEx");
+            stats.failures++;
+            continue;
+        }
+
+        do {
+            const wchar_t* name = findData.cFileName;
+            if (name[0] == L'.' && (name[1] == L'\0' || (name[1] == L'.' && name[2] == L'\0'))) {
+                continue;
+            }
+
+            bool isLink = (findData.dwFileAttributes & FILE_ATTRIBUTE_REPARSE_POINT) &&
+                          (findData.dwReserved0 == IO_REPARSE_TAG_SYMLINK ||
+                           findData.dwReserved0 == IO_REPARSE_TAG_MOUNT_POINT);
+            if (isLink) {
+                stats.skipped++;
+                continue;
+            }
+
+            std::wstring path = directory + L"\\" + name;
+            stats.objects++;
+            queue.Submit(path);
+
+            if (findData.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) {
+                pending.push_back(std::move(path));
+            }
+        } while (FindNextFileW(find, &findData));
+
+        if (GetLastError() != ERROR_NO_MORE_FILES) {
+            std::wcerr << directory << L": ";
+            PrintLastError(L"FindNextFile");
+            stats.failures++;
+        }
+        FindClose(find);
+    }
+}
+
+}  // namespace
+
+int ProcessFileCommand(const std::wstring& filePath, const std::wstring& command,
+                       const FileCommandOptions& options) {
+    std::vector<const CommandSpec*> chain;
+    if (!ParseCommandChain(command, L"file", kFileCommands, std::size(kFileCommands), chain)) {
+        return 1;
+    }
+
+    // Enable SE_TAKE_OWNERSHIP_NAME privilege for WRITE_OWNER access
+    PrivilegeGuard takeownPrivilegeGuard(ChainRequiresTakeOwnership(chain) ? SE_TAKE_OWNERSHIP_NAME : nullptr);
+    
+    if (takeownPrivilegeGuard.IsValid() && !takeownPrivilegeGuard.IsEnabled()) {
+        return 1;  // Error message already printed by PrivilegeGuard
+    }
+
+    // Enable SE_RESTORE_NAME privilege if setting owner to SYSTEM/Administrators
+    PrivilegeGuard restorePrivilegeGuard(ChainRequiresRestorePrivilege(chain) ? SE_RESTORE_NAME : nullptr);
+    
+    if (restorePrivilegeGuard.IsValid() && !restorePrivilegeGuard.IsEnabled()) {
+        return 1;  // Error message already printed by PrivilegeGuard
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    bool success = RunFileChain(filePath, chain, true);
+
+    DWORD attributes = GetFileAttributesW(filePath.c_str());
+    bool isDirectory = attributes != INVALID_FILE_ATTRIBUTES && (attributes & FILE_ATTRIBUTE_DIRECTORY);
+    if (options.recursive && isDirectory) {
+        WalkStats stats;
+        FileWorkQueue queue(chain, options);
+        if (!queue.IsValid()) {
+            return 1;
+        }
+        WalkDirectory(filePath, queue, stats);
+        queue.Drain();
+        stats.failures += queue.Failures();
+
+        auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start);
+        std::wcout << L"Processed " << stats.objects << L" object(s) below " << filePath
+                   << L" in " << FormatDuration(static_cast<uint64_t>(elapsed.count()))
+                   << L" (completion port, queue depth " << options.queueDepth << L", " << queue.Workers()
+                   << L" workers, " << queue.DescribeLimit() << L"): "
+                   << stats.failures << L" failed, " << stats.skipped << L" link(s) skipped\n";
+        success = success && stats.failures == 0;
+    }
 
     return success ? 0 : 1;
 }
+
+void ReadFileDiskOrder(const std::wstring& directory, const std::vector<BatchItem*>& files) {
+    // NTFS returns entries in the order of its directory index, so this is
+    // the order the index (and usually the MFT records) are read in
+    std::unordered_map<std::wstring, BatchItem*> byName;
+    for (BatchItem* file : files) {
+        byName.emplace(LowerName(file->leaf), file);
+    }
+
+    WIN32_FIND_DATAW findData;
+    HANDLE find = FindFirstFileExW(((directory.empty() ? L"." : directory) + L"\\*").c_str(), FindExInfoBasic, &findData,
+                                   FindExSearchNameMatch, nullptr, FIND_FIRST_EX_LARGE_FETCH);
+    if (find == INVALID_HANDLE_VALUE) {
+        return;  // Left in name order; running the batch reports the error
+    }
+
+    uint64_t position = 0;
+    size_t remaining = byName.size();
+    do {
+        auto found = byName.find(LowerName(findData.cFileName));
+        if (found != byName.end()) {
+            found->second->diskOrder = position;
+            remaining--;
+        }
+        position++;
+    } while (remaining && FindNextFileW(find, &findData));
+    FindClose(find);
+}
+
+uint64_t ProcessFileBatch(const std::vector<const BatchItem*>& items) {
+    std::vector<std::vector<const CommandSpec*>> chains(items.size());
+    bool takeown = false;
+    bool restore = false;
+    for (size_t i = 0; i < items.size(); i++) {
+        if (!ParseCommandChain(items[i]->commands, L"file", kFileCommands, std::size(kFileCommands), chains[i])) {
+            return items.size();
+        }
+        takeown = takeown || ChainRequiresTakeOwnership(chains[i]);
+        restore = restore || ChainRequiresRestorePrivilege(chains[i]);
+    }
+
+    PrivilegeGuard takeownPrivilegeGuard(takeown ? SE_TAKE_OWNERSHIP_NAME : nullptr);
+    if (takeownPrivilegeGuard.IsValid() && !takeownPrivilegeGuard.IsEnabled()) {
+        return items.size();  // Error message already printed by PrivilegeGuard
+    }
+    PrivilegeGuard restorePrivilegeGuard(restore ? SE_RESTORE_NAME : nullptr);
+    if (restorePrivilegeGuard.IsValid() && !restorePrivilegeGuard.IsEnabled()) {
+        return items.size();  // Error message already printed by PrivilegeGuard
+    }
+
+    uint64_t failures = 0;
+    for (size_t i = 0; i < items.size(); i++) {
+        if (!RunFileChain(items[i]->name, chains[i], false)) {
+            std::wcerr << L"Failed: " << items[i]->name << L"\n";
+            failures++;
+        }
+    }
+    return failures;
+}
@@ -1,4 +1,25 @@
 #pragma once
+#include <cstdint>
 #include <string>
+#include <vector>
+#include "batch_plan.h"
+#include "concurrency_limit.h"
 
-int ProcessFileCommand(const std::wstring& filePath, const std::wstring& command);
+struct FileCommandOptions {
+    bool recursive = false;     // Also apply to everything below a directory, without following symlinks
+    unsigned queueDepth = 256;  // Most objects below the directory in flight at once
+    ConcurrencyPolicy concurrency = ConcurrencyPolicy::Gradient;  // How many of queueDepth are used
+};
+
+// Parses [--recursive] [--queue-depth <n>] [--concurrency <policy>] after the command
+bool ParseFileCommandOptions(const std::vector<std::wstring>& args, size_t first, FileCommandOptions& options);
+
+int ProcessFileCommand(const std::wstring& filePath, const std::wstring& command,
+                       const FileCommandOptions& options = FileCommandOptions());
+
+// Fills diskOrder for the batch files in one directory with their position
+// in the directory's own order (BatchPlanOptions::readDiskOrder)
+void ReadFileDiskOrder(const std::wstring& directory, const std::vector<BatchItem*>& files);
+
+// Runs the file items of a batch plan in order, quietly. Returns the number that failed.
+uint64_t ProcessFileBatch(const std::vector<const BatchItem*>& items);
@@ -0,0 +1,1327 @@
+// File backend for Linux: maps the tool's owner/DACL model onto uid/gid plus
+// POSIX ACLs. SYSTEM and Administrators both become root, INTERACTIVE and
+// Everyone become "other".
+#include "file_operations.h"
+#include "command_chain.h"
+#include "latency_histogram.h"
+#include "posix_acl.h"
+#include "posix_common.h"
+#include "trace.h"
+#include "uring.h"
+#include <dirent.h>
+#include <sys/eventfd.h>
+#include <fcntl.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/xattr.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <iostream>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <unordered_map>
+
+namespace {
+
+const char kAclAccessXattr[]  = "system.posix_acl_access";
+const char kAclDefaultXattr[] = "system.posix_acl_default";
+
+const unsigned kAbandonAttempts = 1000;     // Reaps to wait for cancelled io_uring operations
+const rlim_t kReservedDescriptors = 64;     // Kept free of --recursive for everything else
+
+const uid_t kRootUid = 0;
+const gid_t kRootGid = 0;
+
+// No privileges to enable here; the caller needs CAP_CHOWN / CAP_FOWNER (root)
+const CommandSpec kFileCommands[] = {
+    { L"harden",  0, false, false },
+    { L"takeown", 0, false, false },
+    { L"weaken",  0, false, false },
+};
+
+// An ACL a command writes, encoded once per run and reused for every object
+struct EncodedAcl {
+    PosixAcl acl;
+    std::vector<uint8_t> xattr;
+    mode_t mode;  // The same permissions as mode bits, for filesystems without ACL support
+};
+
+EncodedAcl MakeEncodedAcl(uint16_t userPerm, uint16_t groupPerm, uint16_t otherPerm) {
+    EncodedAcl result;
+    result.acl = MakeMinimalPosixAcl(userPerm, groupPerm, otherPerm);
+    result.xattr = EncodePosixAcl(result.acl);
+    result.mode = static_cast<mode_t>((userPerm << 6) | (groupPerm << 3) | otherPerm);
+    return result;
+}
+
+// Regular files only get execute if their owner could already execute them
+struct EncodedAcls {
+    EncodedAcl hardenFile;        // SYSTEM read/write, INTERACTIVE read
+    EncodedAcl hardenExecutable;  // ... plus execute
+    EncodedAcl hardenDirectory;   // SYSTEM full control, INTERACTIVE read and traverse
+    EncodedAcl weakenFile;        // Everyone read/write
+    EncodedAcl weakenExecutable;  // ... plus execute
+    EncodedAcl weakenDirectory;   // Everyone full control
+};
+
+const EncodedAcls& GetEncodedAcls() {
+    static const EncodedAcls acls = [] {
+        const uint16_t readWrite = kPosixAclRead | kPosixAclWrite;
+        const uint16_t readExecute = kPosixAclRead | kPosixAclExecute;
+        EncodedAcls result;
+        result.hardenFile       = MakeEncodedAcl(readWrite, 0, kPosixAclRead);
+        result.hardenExecutable = MakeEncodedAcl(kPosixAclAll, 0, readExecute);
+        result.hardenDirectory  = MakeEncodedAcl(kPosixAclAll, 0, readExecute);
+        result.weakenFile       = MakeEncodedAcl(readWrite, readWrite, readWrite);
+        result.weakenExecutable = MakeEncodedAcl(kPosixAclAll, kPosixAclAll, kPosixAclAll);
+        result.weakenDirectory  = MakeEncodedAcl(kPosixAclAll, kPosixAclAll, kPosixAclAll);
+        return result;
+    }();
+    return acls;
+}
+
+void PrintFileError(const std::string& path, const wchar_t* context, int err) {
+    std::wcerr << FromNativePath(path) << L": ";
+    PrintErrno(context, err);
+}
+
+// A file opened for security changes. Regular files and directories get an
+// O_RDONLY descriptor so fsetxattr/fchown work on it directly. Anything else
+// (devices, FIFOs, sockets) is opened O_PATH so that opening it has no side
+// effects, and its xattrs and mode are reached through /proc/self/fd.
+class SecurityTarget {
+public:
+    SecurityTarget() = default;
+    ~SecurityTarget() {
+        if (fd_ >= 0) {
+            close(fd_);
+        }
+    }
+
+    SecurityTarget(const SecurityTarget&) = delete;
+    SecurityTarget& operator=(const SecurityTarget&) = delete;
+
+    // Open flags for an object; type is its S_IFMT bits, as known from readdir or stat
+    static int OpenFlags(mode_t type, bool followSymlinks) {
+        int flags = O_CLOEXEC | O_NOCTTY | O_NONBLOCK;
+        if (!S_ISREG(type) && !S_ISDIR(type)) {
+            flags = O_CLOEXEC | O_PATH;
+        } else {
+            flags |= O_RDONLY | (S_ISDIR(type) ? O_DIRECTORY : 0);
+        }
+        if (!followSymlinks) {
+            flags |= O_NOFOLLOW;
+        }
+        return flags;
+    }
+
+    int Open(int dirfd, const char* name, std::string path, mode_t type, bool followSymlinks) {
+        int flags = OpenFlags(type, followSymlinks);
+        SetObject(std::move(path), type);
+
+        TraceSpan trace(TraceOp::Open, TraceObject::File, TraceName(), static_cast<uint32_t>(flags));
+        fd_ = openat(dirfd, name, flags);
+        int err = fd_ < 0 ? errno : 0;
+        trace.Finish(static_cast<uint32_t>(err));
+        return err;
+    }
+
+    // Takes ownership of a descriptor opened elsewhere with OpenFlags(type, ...)
+    void Adopt(int fd, std::string path, mode_t type) {
+        SetObject(std::move(path), type);
+        fd_ = fd;
+    }
+
+    // Gives up ownership of the descriptor, e.g. to close it asynchronously
+    int Release() {
+        int fd = fd_;
+        fd_ = -1;
+        return fd;
+    }
+
+    // The permission bits, to tell whether a file is executable
+    int GetMode(mode_t& mode) {
+        TraceSpan trace(TraceOp::GetSecurity, TraceObject::File, TraceName(), kTraceDaclSecurity);
+        struct stat st;
+        int err = fstat(fd_, &st) < 0 ? errno : 0;
+        mode = st.st_mode;
+        trace.Finish(static_cast<uint32_t>(err));
+        return err;
+    }
+
+    // Writing an ACL with only the base entries replaces any extended ACL
+    // and sets the permission bits; setuid/setgid/sticky are kept
+    int SetXattr(const char* name, const std::vector<uint8_t>& value) {
+        TraceSpan trace(TraceOp::SetSecurity, TraceObject::File, TraceName(), kTraceDaclSecurity,
+                        static_cast<uint32_t>(value.size()));
+        int result = pathOnly_
+            ? setxattr(ProcPath().c_str(), name, value.data(), value.size(), 0)
+            : fsetxattr(fd_, name, value.data(), value.size(), 0);
+        int err = result < 0 ? errno : 0;
+        trace.Finish(static_cast<uint32_t>(err));
+        return err;
+    }
+
+    // For filesystems without ACL support, where SetXattr fails with EOPNOTSUPP
+    int SetMode(mode_t mode) {
+        TraceSpan trace(TraceOp::SetSecurity, TraceObject::File, TraceName(), kTraceDaclSecurity);
+        struct stat st;
+        int result = fstat(fd_, &st);
+        if (result == 0) {
+            mode |= st.st_mode & (S_ISUID | S_ISGID | S_ISVTX);
+            result = pathOnly_ ? chmod(ProcPath().c_str(), mode) : fchmod(fd_, mode);
+        }
+        int err = result < 0 ? errno : 0;
+        trace.Finish(static_cast<uint32_t>(err));
+        return err;
+    }
+
+    // Returns 0 if the attribute is gone, including when it was never there
+    // or the filesystem has no ACLs to remove
+    int RemoveXattr(const char* name) {
+        TraceSpan trace(TraceOp::SetSecurity, TraceObject::File, TraceName(), kTraceDaclSecurity);
+        int result = pathOnly_ ? removexattr(ProcPath().c_str(), name) : fremovexattr(fd_, name);
+        int err = result < 0 ? errno : 0;
+        err = err == ENODATA || err == EOPNOTSUPP ? 0 : err;
+        trace.Finish(static_cast<uint32_t>(err));
+        return err;
+    }
+
+    int Chown(uid_t uid, gid_t gid) {
+        TraceSpan trace(TraceOp::SetSecurity, TraceObject::File, TraceName(), kTraceOwnerSecurity);
+        int result = pathOnly_ ? fchownat(fd_, "", uid, gid, AT_EMPTY_PATH) : fchown(fd_, uid, gid);
+        int err = result < 0 ? errno : 0;
+        trace.Finish(static_cast<uint32_t>(err));
+        return err;
+    }
+
+    int Fd() const { return fd_; }
+    bool IsPathOnly() const { return pathOnly_; }
+    mode_t Type() const { return type_; }
+    bool IsDirectory() const { return directory_; }
+    const std::string& Path() const { return path_; }
+
+    std::string ProcPath() const {
+        return "/proc/self/fd/" + std::to_string(fd_);
+    }
+
+private:
+    void SetObject(std::string path, mode_t type) {
+        path_ = std::move(path);
+        type_ = type;
+        directory_ = S_ISDIR(type);
+        pathOnly_ = !S_ISREG(type) && !directory_;
+    }
+
+    // Only pay for the wide conversion when a trace is being recorded
+    std::wstring TraceName() const {
+        return IsTraceRecording() ? FromNativePath(path_) : std::wstring();
+    }
+
+    int fd_ = -1;
+    mode_t type_ = 0;
+    bool directory_ = false;
+    bool pathOnly_ = false;
+    std::string path_;
+};
+
+// One call a command makes on an object. Commands expand to a short list of
+// these so the synchronous path and the async engine share one definition.
+enum class FileStepKind {
+    SetAccessAcl,
+    RemoveDefaultAcl,  // Directories only
+    Chown,
+};
+
+struct FileStep {
+    FileStepKind kind;
+    const EncodedAcl* acl = nullptr;
+    const EncodedAcl* executableAcl = nullptr;  // Written instead for executables; regular files only
+    uid_t uid = static_cast<uid_t>(-1);
+    gid_t gid = static_cast<gid_t>(-1);
+};
+
+using FilePlan = std::vector<FileStep>;
+
+FileStep AccessAclStep(const EncodedAcl& acl, const EncodedAcl* executableAcl) {
+    FileStep step{ FileStepKind::SetAccessAcl };
+    step.acl = &acl;
+    step.executableAcl = executableAcl;
+    return step;
+}
+
+FileStep ChownStep(uid_t uid, gid_t gid) {
+    FileStep step{ FileStepKind::Chown };
+    step.uid = uid;
+    step.gid = gid;
+    return step;
+}
+
+void AppendCommandSteps(const std::wstring& command, mode_t type, FilePlan& plan) {
+    const EncodedAcls& acls = GetEncodedAcls();
+    bool directory = S_ISDIR(type);
+
+    bool setsAcl = false;
+    if (command == L"harden") {
+        // Owner becomes root:root, the equivalent of LOCAL SYSTEM
+        plan.push_back(directory ? AccessAclStep(acls.hardenDirectory, nullptr)
+                                 : AccessAclStep(acls.hardenFile, S_ISREG(type) ? &acls.hardenExecutable : nullptr));
+        setsAcl = true;
+    } else if (command == L"takeown") {
+        plan.push_back(ChownStep(kRootUid, static_cast<gid_t>(-1)));
+    } else if (command == L"weaken") {
+        plan.push_back(directory ? AccessAclStep(acls.weakenDirectory, nullptr)
+                                 : AccessAclStep(acls.weakenFile, S_ISREG(type) ? &acls.weakenExecutable : nullptr));
+        setsAcl = true;
+    }
+
+    // The Win32 backend writes non-inheritable ACEs; likewise drop any default
+    // ACL so children created later don't inherit the old entries
+    if (setsAcl && directory) {
+        plan.push_back(FileStep{ FileStepKind::RemoveDefaultAcl });
+    }
+    if (command == L"harden") {
+        plan.push_back(ChownStep(kRootUid, kRootGid));
+    }
+}
+
+FilePlan BuildFilePlan(const std::vector<const CommandSpec*>& chain, mode_t type) {
+    FilePlan plan;
+    for (const CommandSpec* spec : chain) {
+        AppendCommandSteps(spec->name, type, plan);
+    }
+    return plan;
+}
+
+void PrintStepError(const std::string& path, const FileStep& step, int err) {
+    switch (step.kind) {
+        case FileStepKind::SetAccessAcl:     PrintFileError(path, L"setxattr(system.posix_acl_access)", err); break;
+        case FileStepKind::RemoveDefaultAcl: PrintFileError(path, L"removexattr(system.posix_acl_default)", err); break;
+        case FileStepKind::Chown:            PrintFileError(path, L"fchown", err); break;
+    }
+}
+
+// Which ACL step writes: executables get step.executableAcl if it has one
+const EncodedAcl* ChooseAcl(const FileStep& step, mode_t mode) {
+    return step.executableAcl && (mode & S_IXUSR) ? step.executableAcl : step.acl;
+}
+
+// Writes the ACL, or the same permissions as a mode where the filesystem has
+// no ACL support. Doesn't print, so it can run on any thread: on failure
+// failedCall names the call for the message.
+int ApplyAccessAcl(SecurityTarget& target, const FileStep& step, const EncodedAcl*& acl, const wchar_t*& failedCall) {
+    mode_t mode = 0;
+    if (step.executableAcl) {
+        if (int err = target.GetMode(mode)) {
+            failedCall = L"fstat";
+            return err;
+        }
+    }
+    acl = ChooseAcl(step, mode);
+
+    int err = target.SetXattr(kAclAccessXattr, acl->xattr);
+    failedCall = L"setxattr(system.posix_acl_access)";
+    if (err == EOPNOTSUPP) {
+        err = target.SetMode(acl->mode);
+        failedCall = L"fchmod";
+    }
+    return err;
+}
+
+bool RunFileStep(SecurityTarget& target, const FileStep& step, bool verbose) {
+    int err = 0;
+    switch (step.kind) {
+        case FileStepKind::SetAccessAcl: {
+            const EncodedAcl* acl = nullptr;
+            const wchar_t* failedCall = nullptr;
+            err = ApplyAccessAcl(target, step, acl, failedCall);
+            if (err) {
+                PrintFileError(target.Path(), failedCall, err);
+                return false;
+            }
+            if (verbose) {
+                std::wcout << L"Set ACL: " << FormatPosixAcl(acl->acl) << L"\n";
+            }
+            return true;
+        }
+        case FileStepKind::RemoveDefaultAcl:
+            err = target.RemoveXattr(kAclDefaultXattr);
+            break;
+        case FileStepKind::Chown:
+            if (verbose) {
+                std::wcout << L"Setting Owner: uid " << step.uid;
+                if (step.gid != static_cast<gid_t>(-1)) {
+                    std::wcout << L", gid " << step.gid;
+                }
+                std::wcout << L"\n";
+            }
+            err = target.Chown(step.uid, step.gid);
+            break;
+    }
+
+    if (err) {
+        PrintStepError(target.Path(), step, err);
+        return false;
+    }
+    return true;
+}
+
+bool RunFileCommand(SecurityTarget& target, const std::wstring& command, bool verbose) {
+    FilePlan plan;
+    AppendCommandSteps(command, target.Type(), plan);
+    for (const FileStep& step : plan) {
+        if (!RunFileStep(target, step, verbose)) {
+            return false;
+        }
+    }
+
+    if (verbose) {
+        if (command == L"harden") {
+            std::wcout << L"File ACL hardened successfully\n";
+        } else if (command == L"takeown") {
+            std::wcout << L"File ownership transferred to root\n";
+        } else if (command == L"weaken") {
+            std::wcout << L"File ACL weakened successfully (Everyone has full access)\n";
+        }
+    }
+    return true;
+}
+
+bool RunFileChain(SecurityTarget& target, const std::vector<const CommandSpec*>& chain, bool verbose) {
+    for (const CommandSpec* spec : chain) {
+        if (!RunFileCommand(target, spec->name, verbose)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// A directory being walked. Children are opened relative to it, so it stays
+// open until its last child's openat has completed. Only the descriptor is
+// kept; the readdir stream and its buffer exist while it is enumerated.
+class DirectoryHandle {
+public:
+    DirectoryHandle(int fd, std::string path) : fd_(fd), path_(std::move(path)) {}
+    ~DirectoryHandle() {
+        close(fd_);
+    }
+
+    DirectoryHandle(const DirectoryHandle&) = delete;
+    DirectoryHandle& operator=(const DirectoryHandle&) = delete;
+
+    int Fd() const { return fd_; }
+    const std::string& Path() const { return path_; }
+
+private:
+    int fd_;
+    std::string path_;
+};
+
+// RLIMIT_NOFILE raised to the hard limit for one --recursive run, and put
+// back afterwards so a resident server doesn't keep the raised limit
+class DescriptorLimit {
+public:
+    DescriptorLimit() {
+        if (getrlimit(RLIMIT_NOFILE, &original_) != 0) {
+            original_.rlim_cur = original_.rlim_max = RLIM_INFINITY;
+            return;
+        }
+        current_ = original_.rlim_cur;
+        if (original_.rlim_cur < original_.rlim_max) {
+            rlimit raised = { original_.rlim_max, original_.rlim_max };
+            if (setrlimit(RLIMIT_NOFILE, &raised) == 0) {
+                current_ = original_.rlim_max;
+                raised_ = true;
+            }
+        }
+    }
+
+    ~DescriptorLimit() {
+        if (raised_) {
+            setrlimit(RLIMIT_NOFILE, &original_);
+        }
+    }
+
+    DescriptorLimit(const DescriptorLimit&) = delete;
+    DescriptorLimit& operator=(const DescriptorLimit&) = delete;
+
+    // Every object in flight holds a descriptor, and may keep its parent
+    // directory's open too, so the queue depth is capped to what the limit
+    // leaves room for instead of failing deep queues with EMFILE
+    unsigned CapQueueDepth(unsigned queueDepth) const {
+        if (current_ == RLIM_INFINITY) {
+            return queueDepth;
+        }
+        rlim_t available = current_ > 2 * kReservedDescriptors ? current_ - kReservedDescriptors : current_ / 2;
+        return static_cast<unsigned>(std::min<rlim_t>(queueDepth, std::max<rlim_t>(1, available / 2)));
+    }
+
+private:
+    rlimit original_ = {};
+    rlim_t current_ = RLIM_INFINITY;
+    bool raised_ = false;
+};
+
+// Threads for the calls io_uring has no opcode for: fchown, and chmod where
+// the filesystem has no ACL support. The calls block on the filesystem, so
+// there are a few threads per CPU rather than one per object in flight.
+// Finished calls are collected by the engine thread, which is woken through
+// an eventfd it keeps a read queued on.
+class BlockingCallPool {
+public:
+    explicit BlockingCallPool(unsigned threads) : eventFd_(eventfd(0, EFD_CLOEXEC)) {
+        for (unsigned i = 0; eventFd_ >= 0 && i < threads; i++) {
+            threads_.emplace_back([this] { Run(); });
+        }
+    }
+
+    ~BlockingCallPool() {
+        {
+            std::lock_guard<std::mutex> guard(lock_);
+            stopping_ = true;
+        }
+        wake_.notify_all();
+        for (auto& thread : threads_) {
+            thread.join();
+        }
+        if (eventFd_ >= 0) {
+            close(eventFd_);
+        }
+    }
+
+    BlockingCallPool(const BlockingCallPool&) = delete;
+    BlockingCallPool& operator=(const BlockingCallPool&) = delete;
+
+    int EventFd() const { return eventFd_; }
+    unsigned Threads() const { return static_cast<unsigned>(threads_.size()); }
+
+    // Runs call on a pool thread; TakeFinished hands back tag with its result
+    void Post(void* tag, std::function<int()> call) {
+        {
+            std::lock_guard<std::mutex> guard(lock_);
+            queued_.push_back({ tag, std::move(call) });
+        }
+        wake_.notify_one();
+    }
+
+    void TakeFinished(std::vector<std::pair<void*, int>>& finished) {
+        std::lock_guard<std::mutex> guard(lock_);
+        finished.insert(finished.end(), finished_.begin(), finished_.end());
+        finished_.clear();
+    }
+
+    // Waits until every posted call has finished
+    void WaitIdle() {
+        std::unique_lock<std::mutex> guard(lock_);
+        idle_.wait(guard, [this] { return queued_.empty() && running_ == 0; });
+    }
+
+private:
+    struct Call {
+        void* tag;
+        std::function<int()> call;
+    };
+
+    void Run() {
+        std::unique_lock<std::mutex> guard(lock_);
+        for (;;) {
+            wake_.wait(guard, [this] { return stopping_ || !queued_.empty(); });
+            if (queued_.empty()) {
+                return;
+            }
+            Call call = std::move(queued_.front());
+            queued_.pop_front();
+            running_++;
+            guard.unlock();
+
+            int result = call.call();
+
+            guard.lock();
+            running_--;
+            finished_.emplace_back(call.tag, result);
+            idle_.notify_all();
+            uint64_t one = 1;
+            ssize_t written = write(eventFd_, &one, sizeof(one));
+            (void)written;  // Only fails if the counter would overflow, which still wakes the reader
+        }
+    }
+
+    int eventFd_;
+    std::vector<std::thread> threads_;
+    std::mutex lock_;
+    std::condition_variable wake_;
+    std::condition_variable idle_;
+    std::deque<Call> queued_;
+    std::vector<std::pair<void*, int>> finished_;
+    unsigned running_ = 0;
+    bool stopping_ = false;
+};
+
+// Applies the chain to many objects at once for --recursive. Each object
+// moves through openat -> its plan's steps -> close. The open, the statx
+// that tells whether a file is executable, the ACL xattr writes (a
+// zero-length write removes a default ACL) and the close are queued on the
+// ring instead of called, so up to queueDepth objects are waiting on the
+// filesystem at once from this one thread. Submissions queued while
+// handling a batch of completions go to the kernel together in the next
+// io_uring_enter. fchown, and chmod on filesystems without ACL support,
+// have no opcode and go to a small BlockingCallPool; so do the xattr steps
+// on kernels without the xattr opcodes. Without io_uring (old kernel,
+// seccomp) every object runs inline. How much of the queue depth is used
+// follows the concurrency policy, fed with each object's open -> close
+// latency.
+class AsyncFileEngine {
+public:
+    AsyncFileEngine(const std::vector<const CommandSpec*>& chain, const FileCommandOptions& options)
+        : filePlan_(BuildFilePlan(chain, S_IFREG)),
+          directoryPlan_(BuildFilePlan(chain, S_IFDIR)),
+          specialPlan_(BuildFilePlan(chain, S_IFIFO)),
+          queueDepth_(descriptorLimit_.CapQueueDepth(options.queueDepth)),
+          limit_(DefaultConcurrencyLimit(TraceObject::File, options.concurrency, queueDepth_)) {
+        // One slot per object, which has at most one SQE queued at a time,
+        // plus one for the wake read
+        int err = ring_.Init(queueDepth_ + 1);
+        if (err == 0 && ring_.Supports(IORING_OP_OPENAT) && ring_.Supports(IORING_OP_CLOSE) &&
+            ring_.Supports(IORING_OP_READ) && ring_.Entries() > 1) {
+            queueDepth_ = std::min(queueDepth_, ring_.Entries() - 1);
+            asyncXattr_ = ring_.Supports(IORING_OP_FSETXATTR) && ring_.Supports(IORING_OP_SETXATTR) &&
+                          ring_.Supports(IORING_OP_STATX);
+
+            unsigned cpus = std::max(1u, std::thread::hardware_concurrency());
+            pool_ = std::make_unique<BlockingCallPool>(std::min(queueDepth_, cpus * kBlockingThreadsPerCpu));
+            async_ = pool_->Threads() > 0 && QueueWakeRead();
+        }
+    }
+
+    ~AsyncFileEngine() {
+        Drain();
+    }
+
+    AsyncFileEngine(const AsyncFileEngine&) = delete;
+    AsyncFileEngine& operator=(const AsyncFileEngine&) = delete;
+
+    // How the engine is running, for the summary line
+    std::wstring Mode() const {
+        if (!async_) {
+            return L"synchronous";
+        }
+        return (asyncXattr_ ? L"io_uring" : L"io_uring without xattr opcodes") + std::wstring(L", queue depth ") +
+               std::to_wstring(queueDepth_) + L", " + std::to_wstring(pool_->Threads()) +
+               L" thread(s) for blocking calls, " + limit_.Describe();
+    }
+
+    // Queues the chain for one child of parent, first waiting for room if
+    // the concurrency limit's worth of objects are already outstanding
+    void Submit(const std::shared_ptr<DirectoryHandle>& parent, const char* name, mode_t type) {
+        std::string path = parent->Path() + "/" + name;
+        while (async_ && !limit_.TryAcquire()) {
+            Reap(1);
+        }
+        if (!async_) {
+            RunInline(*parent, name, std::move(path), type);
+            return;
+        }
+
+        auto* op = new Operation;
+        op->parent = parent;
+        op->name = name;
+        op->path = std::move(path);
+        op->type = type;
+        op->plan = &PlanFor(type);
+        op->start = std::chrono::steady_clock::now();
+        outstanding_++;
+        QueueOpen(op);
+    }
+
+    // Waits for every outstanding object to finish
+    void Drain() {
+        while (outstanding_ > 0 && async_) {
+            Reap(1);
+        }
+    }
+
+    uint64_t Failures() const { return failures_; }
+
+private:
+    // user_data of the eventfd read that wakes the engine for BlockingCallPool
+    // results; 0 is the cancel request in Abandon
+    static constexpr uint64_t kWakeTag = 1;
+    static constexpr unsigned kBlockingThreadsPerCpu = 4;
+
+    enum class Stage { Opening, GettingMode, SettingXattr, Blocking, Closing };
+
+    struct Operation {
+        std::shared_ptr<DirectoryHandle> parent;  // Released once openat completes
+        std::string name;
+        std::string path;
+        mode_t type = 0;
+        const FilePlan* plan = nullptr;
+        size_t step = 0;
+        Stage stage = Stage::Opening;
+        bool failed = false;
+        std::chrono::steady_clock::time_point start;
+        SecurityTarget target;
+        const EncodedAcl* acl = nullptr;          // Chosen for the current SetAccessAcl step
+        const wchar_t* failedCall = nullptr;      // Set by blocking calls
+        struct statx statx = {};
+        std::string procPath;                     // For O_PATH objects, whose xattrs go through /proc
+        std::optional<TraceSpan> trace;
+    };
+
+    struct Completion {
+        uint64_t userData;
+        int result;
+    };
+
+    const FilePlan& PlanFor(mode_t type) const {
+        return S_ISDIR(type) ? directoryPlan_ : S_ISREG(type) ? filePlan_ : specialPlan_;
+    }
+
+    // The ring always has room, since every object has at most one SQE
+    // queued; it can only be full if the kernel hasn't consumed earlier SQEs
+    // yet, so those are submitted first. Completions that arrive meanwhile
+    // are set aside for the next Reap, since handling them here would queue
+    // more SQEs. Returns nullptr once submitting fails; Reap then abandons
+    // the ring.
+    io_uring_sqe* NextSqe(uint64_t userData, uint8_t opcode) {
+        io_uring_sqe* sqe = ring_.GetSqe();
+        for (unsigned attempt = 0; !sqe && submitError_ == 0; attempt++) {
+            int err = ring_.Submit(0);
+            if (err == EBUSY || err == EAGAIN) {
+                unsigned reaped = ring_.ForEachCompletion([this](const io_uring_cqe& cqe) {
+                    deferred_.push_back({ cqe.user_data, cqe.res });
+                });
+                if (reaped == 0) {
+                    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+                }
+                err = attempt < kAbandonAttempts ? 0 : err;
+            }
+            submitError_ = err;
+            sqe = ring_.GetSqe();
+        }
+        if (sqe) {
+            sqe->opcode = opcode;
+            sqe->user_data = userData;
+        }
+        return sqe;
+    }
+
+    // As NextSqe, failing op (and closing its descriptor) if there is no SQE
+    io_uring_sqe* NextSqe(Operation* op, uint8_t opcode) {
+        io_uring_sqe* sqe = NextSqe(reinterpret_cast<uint64_t>(op), opcode);
+        if (!sqe) {
+            Finish(op, false);
+        }
+        return sqe;
+    }
+
+    bool QueueWakeRead() {
+        io_uring_sqe* sqe = NextSqe(kWakeTag, IORING_OP_READ);
+        if (!sqe) {
+            return false;
+        }
+        sqe->fd = pool_->EventFd();
+        sqe->addr = reinterpret_cast<uint64_t>(&wakeCount_);
+        sqe->len = sizeof(wakeCount_);
+        return true;
+    }
+
+    std::wstring TraceName(const Operation* op) const {
+        return IsTraceRecording() ? FromNativePath(op->path) : std::wstring();
+    }
+
+    void QueueOpen(Operation* op) {
+        int flags = SecurityTarget::OpenFlags(op->type, false);
+        io_uring_sqe* sqe = NextSqe(op, IORING_OP_OPENAT);
+        if (!sqe) {
+            return;
+        }
+        sqe->fd = op->parent->Fd();
+        sqe->addr = reinterpret_cast<uint64_t>(op->name.c_str());
+        sqe->open_flags = static_cast<uint32_t>(flags);
+        op->trace.emplace(TraceOp::Open, TraceObject::File, TraceName(op), static_cast<uint32_t>(flags));
+    }
+
+    void QueueGetMode(Operation* op) {
+        op->stage = Stage::GettingMode;
+        io_uring_sqe* sqe = NextSqe(op, IORING_OP_STATX);
+        if (!sqe) {
+            return;
+        }
+        sqe->fd = op->target.Fd();
+        sqe->addr = reinterpret_cast<uint64_t>("");
+        sqe->statx_flags = AT_EMPTY_PATH;
+        sqe->len = STATX_MODE;
+        sqe->off = reinterpret_cast<uint64_t>(&op->statx);
+        op->trace.emplace(TraceOp::GetSecurity, TraceObject::File, TraceName(op), kTraceDaclSecurity);
+    }
+
+    // A zero-length value removes the ACL, like removexattr
+    void QueueSetXattr(Operation* op, const char* name, const std::vector<uint8_t>* value) {
+        op->stage = Stage::SettingXattr;
+        io_uring_sqe* sqe;
+        if (op->target.IsPathOnly()) {
+            sqe = NextSqe(op, IORING_OP_SETXATTR);
+            if (!sqe) {
+                return;
+            }
+            op->procPath = op->target.ProcPath();
+            sqe->addr3 = reinterpret_cast<uint64_t>(op->procPath.c_str());
+        } else {
+            sqe = NextSqe(op, IORING_OP_FSETXATTR);
+            if (!sqe) {
+                return;
+            }
+            sqe->fd = op->target.Fd();
+        }
+        uint32_t size = value ? static_cast<uint32_t>(value->size()) : 0;
+        sqe->addr = reinterpret_cast<uint64_t>(name);
+        sqe->addr2 = value ? reinterpret_cast<uint64_t>(value->data()) : 0;
+        sqe->len = size;
+        op->trace.emplace(TraceOp::SetSecurity, TraceObject::File, TraceName(op), kTraceDaclSecurity, size);
+    }
+
+    void QueueClose(Operation* op) {
+        op->stage = Stage::Closing;
+        io_uring_sqe* sqe = NextSqe(op, IORING_OP_CLOSE);
+        if (!sqe) {
+            return;
+        }
+        sqe->fd = op->target.Release();
+    }
+
+    // Hands the current step to the pool; the engine doesn't touch op until
+    // the result comes back
+    void PostBlocking(Operation* op, std::function<int()> call) {
+        op->stage = Stage::Blocking;
+        blockingCalls_++;
+        pool_->Post(op, std::move(call));
+    }
+
+    // Starts the current step, or closes the object once the plan is done
+    void Continue(Operation* op) {
+        const FilePlan& plan = *op->plan;
+        if (op->step == plan.size()) {
+            QueueClose(op);
+            return;
+        }
+
+        const FileStep& step = plan[op->step];
+        switch (step.kind) {
+            case FileStepKind::SetAccessAcl:
+                if (!asyncXattr_) {
+                    PostBlocking(op, [op, &step] { return ApplyAccessAcl(op->target, step, op->acl, op->failedCall); });
+                } else if (step.executableAcl && !op->acl) {
+                    QueueGetMode(op);
+                } else {
+                    op->acl = op->acl ? op->acl : step.acl;
+                    QueueSetXattr(op, kAclAccessXattr, &op->acl->xattr);
+                }
+                return;
+            case FileStepKind::RemoveDefaultAcl:
+                if (!asyncXattr_) {
+                    PostBlocking(op, [op] {
+                        op->failedCall = L"removexattr(system.posix_acl_default)";
+                        return op->target.RemoveXattr(kAclDefaultXattr);
+                    });
+                } else {
+                    QueueSetXattr(op, kAclDefaultXattr, nullptr);
+                }
+                return;
+            case FileStepKind::Chown:
+                PostBlocking(op, [op, &step] {
+                    op->failedCall = L"fchown";
+                    return op->target.Chown(step.uid, step.gid);
+                });
+                return;
+        }
+    }
+
+    void NextStep(Operation* op) {
+        op->step++;
+        op->acl = nullptr;
+        Continue(op);
+    }
+
+    void Fail(Operation* op, const wchar_t* call, int err) {
+        PrintFileError(op->path, call, err);
+        op->failed = true;
+        QueueClose(op);
+    }
+
+    // result is the CQE result, or for blocking calls the negated errno
+    void Complete(Operation* op, int result) {
+        int err = result < 0 ? -result : 0;
+        if (op->stage != Stage::Blocking && op->stage != Stage::Closing) {
+            op->trace->Finish(static_cast<uint32_t>(err));
+        }
+
+        switch (op->stage) {
+            case Stage::Opening:
+                op->parent.reset();
+                if (err) {
+                    PrintFileError(op->path, L"openat", err);
+                    Finish(op, false);
+                    return;
+                }
+                op->target.Adopt(result, op->path, op->type);
+                Continue(op);
+                return;
+
+            case Stage::GettingMode:
+                if (err) {
+                    Fail(op, L"statx", err);
+                    return;
+                }
+                op->acl = ChooseAcl((*op->plan)[op->step], op->statx.stx_mode);
+                Continue(op);
+                return;
+
+            case Stage::SettingXattr: {
+                const FileStep& step = (*op->plan)[op->step];
+                if (step.kind == FileStepKind::SetAccessAcl && err == EOPNOTSUPP) {
+                    const EncodedAcl* acl = op->acl;
+                    PostBlocking(op, [op, acl] {
+                        op->failedCall = L"fchmod";
+                        return op->target.SetMode(acl->mode);
+                    });
+                    return;
+                }
+                if (step.kind == FileStepKind::RemoveDefaultAcl && (err == ENODATA || err == EOPNOTSUPP)) {
+                    err = 0;
+                }
+                if (err) {
+                    PrintStepError(op->path, step, err);
+                    op->failed = true;
+                    QueueClose(op);
+                    return;
+                }
+                NextStep(op);
+                return;
+            }
+
+            case Stage::Blocking:
+                if (err) {
+                    Fail(op, op->failedCall, err);
+                    return;
+                }
+                NextStep(op);
+                return;
+
+            case Stage::Closing:
+                Finish(op, !op->failed);
+                return;
+        }
+    }
+
+    void Finish(Operation* op, bool succeeded) {
+        if (!succeeded) {
+            failures_++;
+        }
+        auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - op->start);
+        limit_.Release(static_cast<uint64_t>(elapsed.count()), !succeeded);
+        outstanding_--;
+        delete op;
+    }
+
+    void Dispatch(uint64_t userData, int result) {
+        if (userData != kWakeTag) {
+            Complete(reinterpret_cast<Operation*>(userData), result);
+            return;
+        }
+
+        // Pool calls finished; take their results, then listen again
+        pool_->TakeFinished(finished_);
+        for (auto& [tag, err] : finished_) {
+            blockingCalls_--;
+            Complete(static_cast<Operation*>(tag), -err);
+        }
+        finished_.clear();
+        QueueWakeRead();
+    }
+
+    // Submits everything queued, waits for at least minComplete objects to
+    // advance, and handles every completion that is ready
+    void Reap(unsigned minComplete) {
+        int err = submitError_ ? submitError_ : ring_.Submit(deferred_.empty() ? minComplete : 0);
+        if (err) {
+            Abandon(err);
+            return;
+        }
+
+        // Collected first: handling a completion may queue SQEs, and NextSqe
+        // may reap the completion queue itself
+        ring_.ForEachCompletion([this](const io_uring_cqe& cqe) {
+            deferred_.push_back({ cqe.user_data, cqe.res });
+        });
+        std::vector<Completion> ready;
+        ready.swap(deferred_);
+        for (const Completion& completion : ready) {
+            Dispatch(completion.userData, completion.result);
+        }
+    }
+
+    // io_uring_enter failed, so the walk carries on synchronously. Every
+    // outstanding object is failed, but an operation is only freed (and its
+    // descriptor closed) once nothing else uses it: calls on the pool are
+    // waited for, SQEs the kernel never saw are taken back, the rest are
+    // cancelled and reaped. Whatever is still in the kernel after that is
+    // left allocated rather than freed under it; closing the ring cancels it.
+    void Abandon(int err) {
+        PrintErrno(L"io_uring_enter", err);
+        async_ = false;
+
+        pool_->WaitIdle();
+        pool_->TakeFinished(finished_);
+        for (auto& [tag, result] : finished_) {
+            blockingCalls_--;
+            Abort(static_cast<Operation*>(tag), -ECANCELED);
+        }
+        finished_.clear();
+        for (const Completion& completion : deferred_) {
+            if (completion.userData != kWakeTag) {
+                Abort(reinterpret_cast<Operation*>(completion.userData), completion.result);
+            }
+        }
+        deferred_.clear();
+
+        ring_.DiscardUnsubmitted([this](const io_uring_sqe& sqe) {
+            if (sqe.user_data == kWakeTag) {
+                return;
+            }
+            if (sqe.opcode == IORING_OP_CLOSE) {
+                close(sqe.fd);  // Already released from the target
+            }
+            Abort(reinterpret_cast<Operation*>(sqe.user_data), -ECANCELED);
+        });
+
+        if (outstanding_ > 0) {
+            if (io_uring_sqe* sqe = ring_.GetSqe()) {
+                sqe->opcode = IORING_OP_ASYNC_CANCEL;
+                sqe->cancel_flags = IORING_ASYNC_CANCEL_ANY;
+                sqe->user_data = 0;
+            }
+        }
+        for (unsigned attempt = 0; outstanding_ > 0 && attempt < kAbandonAttempts; attempt++) {
+            if (ring_.Submit(1) != 0) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            }
+            ring_.ForEachCompletion([this](const io_uring_cqe& cqe) {
+                if (cqe.user_data != 0 && cqe.user_data != kWakeTag) {
+                    Abort(reinterpret_cast<Operation*>(cqe.user_data), cqe.res);
+                }
+            });
+        }
+
+        if (outstanding_ > 0) {
+            std::wcerr << outstanding_ << L" object(s) still queued in io_uring could not be reclaimed\n";
+            failures_ += outstanding_;
+            outstanding_ = 0;
+        }
+    }
+
+    // Fails an operation whose SQE will not complete normally; result is
+    // its CQE result, or -ECANCELED if it never reached the kernel
+    void Abort(Operation* op, int result) {
+        if (op->stage == Stage::Opening && result >= 0) {
+            close(result);  // The open completed before the cancel got to it
+        }
+        if (op->trace && op->stage != Stage::Blocking && op->stage != Stage::Closing) {
+            op->trace->Finish(ECANCELED);
+        }
+        Finish(op, false);
+    }
+
+    void RunInline(const DirectoryHandle& parent, const char* name, std::string path, mode_t type) {
+        SecurityTarget target;
+        int err = target.Open(parent.Fd(), name, std::move(path), type, false);
+        if (err) {
+            PrintFileError(target.Path(), L"openat", err);
+            failures_++;
+            return;
+        }
+
+        for (const FileStep& step : PlanFor(type)) {
+            if (!RunFileStep(target, step, false)) {
+                failures_++;
+                return;
+            }
+        }
+    }
+
+    DescriptorLimit descriptorLimit_;  // Restored after everything below is closed
+    IoUring ring_;
+    std::unique_ptr<BlockingCallPool> pool_;  // Joined before the ring is closed
+    bool async_ = false;
+    bool asyncXattr_ = false;
+    FilePlan filePlan_;
+    FilePlan directoryPlan_;
+    FilePlan specialPlan_;  // Devices, FIFOs, sockets: never given execute
+    unsigned queueDepth_;
+    ConcurrencyLimit limit_;
+    unsigned outstanding_ = 0;
+    unsigned blockingCalls_ = 0;
+    uint64_t failures_ = 0;
+    int submitError_ = 0;
+    uint64_t wakeCount_ = 0;
+    std::vector<Completion> deferred_;
+    std::vector<std::pair<void*, int>> finished_;
+};
+
+struct WalkStats {
+    uint64_t objects = 0;
+    uint64_t failures = 0;
+    uint64_t skipped = 0;  // Symlinks - they carry no ACL of their own
+};
+
+mode_t TypeFromDirent(int dirfd, const dirent* entry) {
+    switch (entry->d_type) {
+        case DT_REG:  return S_IFREG;
+        case DT_DIR:  return S_IFDIR;
+        case DT_LNK:  return S_IFLNK;
+        case DT_FIFO: return S_IFIFO;
+        case DT_SOCK: return S_IFSOCK;
+        case DT_CHR:  return S_IFCHR;
+        case DT_BLK:  return S_IFBLK;
+        default: {
+            // Filesystem doesn't report types in readdir
+            struct stat st;
+            if (fstatat(dirfd, entry->d_name, &st, AT_SYMLINK_NOFOLLOW) != 0) {
+                return 0;
+            }
+            return st.st_mode & S_IFMT;
+        }
+    }
+}
+
+// A subdirectory waiting to be walked. It holds its parent open so it can be
+// opened relative to it.
+struct PendingDirectory {
+    std::shared_ptr<DirectoryHandle> parent;
+    std::string name;
+};
+
+// Submits every entry of directory to the engine and queues its
+// subdirectories. Reading the directory is synchronous (there is no
+// io_uring getdents); the security changes for the entries read so far
+// proceed on the ring meanwhile.
+void EnumerateDirectory(const std::shared_ptr<DirectoryHandle>& directory, AsyncFileEngine& engine,
+                        std::vector<PendingDirectory>& pending, WalkStats& stats) {
+    int fd = dup(directory->Fd());
+    DIR* dir = fd >= 0 ? fdopendir(fd) : nullptr;
+    if (!dir) {
+        PrintFileError(directory->Path(), L"opendir", errno);
+        if (fd >= 0) {
+            close(fd);
+        }
+        stats.failures++;
+        return;
+    }
+
+    size_t firstChild = pending.size();
+    while (dirent* entry = readdir(dir)) {
+        const char* name = entry->d_name;
+        if (name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0'))) {
+            continue;
+        }
+
+        mode_t type = TypeFromDirent(directory->Fd(), entry);
+        if (type == S_IFLNK) {
+            stats.skipped++;
+            continue;
+        }
+
+        stats.objects++;
+        engine.Submit(directory, name, type);
+        if (S_ISDIR(type)) {
+            pending.push_back({ directory, name });
+        }
+    }
+    closedir(dir);
+
+    // Walked in the order they were read
+    std::reverse(pending.begin() + static_cast<ptrdiff_t>(firstChild), pending.end());
+}
+
+// Hands everything below root to the engine, depth first. The walk keeps
+// its own stack rather than recursing, and holds no readdir stream across
+// levels: a directory's descriptor stays open only while a subdirectory of
+// it is still waiting to be opened or an object in it is still opening, so
+// a deep tree costs neither stack nor a descriptor per level. Children are
+// opened relative to the parent's descriptor, so each object costs one path
+// component lookup rather than a full path walk.
+void WalkDirectory(std::shared_ptr<DirectoryHandle> root, AsyncFileEngine& engine, WalkStats& stats) {
+    std::vector<PendingDirectory> pending;
+    EnumerateDirectory(root, engine, pending, stats);
+    root.reset();
+
+    while (!pending.empty()) {
+        PendingDirectory next = std::move(pending.back());
+        pending.pop_back();
+
+        std::string path = next.parent->Path() + "/" + next.name;
+        int fd = openat(next.parent->Fd(), next.name.c_str(), O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+        next.parent.reset();
+        if (fd < 0) {
+            PrintFileError(path, L"opendir", errno);
+            stats.failures++;
+            continue;
+        }
+        EnumerateDirectory(std::make_shared<DirectoryHandle>(fd, std::move(path)), engine, pending, stats);
+    }
+}
+
+}  // namespace
+
+int ProcessFileCommand(const std::wstring& filePath, const std::wstring& command,
+                       const FileCommandOptions& options) {
+    std::vector<const CommandSpec*> chain;
+    if (!ParseCommandChain(command, L"file", kFileCommands, std::size(kFileCommands), chain)) {
+        return 1;
+    }
+
+    std::string path = ToNativePath(filePath);
+    TraceContext traceContext(TraceObject::File, filePath);
+
+    // The named path itself follows symlinks, like CreateFile does
+    struct stat st;
+    if (stat(path.c_str(), &st) != 0) {
+        PrintFileError(path, L"stat", errno);
+        return 1;
+    }
+
+    std::wcout << L"Opening file: " << filePath << L"\n";
+
+    SecurityTarget target;
+    int err = target.Open(AT_FDCWD, path.c_str(), path, st.st_mode & S_IFMT, true);
+    if (err) {
+        PrintFileError(path, L"openat", err);
+        return 1;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    bool success = RunFileChain(target, chain, true);
+
+    if (options.recursive && target.IsDirectory()) {
+        WalkStats stats;
+        AsyncFileEngine engine(chain, options);
+        int rootFd = dup(target.Fd());
+        if (rootFd >= 0) {
+            WalkDirectory(std::make_shared<DirectoryHandle>(rootFd, path), engine, stats);
+        } else {
+            PrintFileError(path, L"dup", errno);
+            stats.failures++;
+        }
+        engine.Drain();
+        stats.failures += engine.Failures();
+
+        auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start);
+        std::wcout << L"Processed " << stats.objects << L" object(s) below " << filePath
+                   << L" in " << FormatDuration(static_cast<uint64_t>(elapsed.count()))
+                   << L" (" << engine.Mode() << L"): "
+                   << stats.failures << L" failed, " << stats.skipped << L" symlink(s) skipped\n";
+        success = success && stats.failures == 0;
+    }
+
+    return success ? 0 : 1;
+}
+
+void ReadFileDiskOrder(const std::wstring& directory, const std::vector<BatchItem*>& files) {
+    // ext4/xfs hand out inode numbers roughly in allocation order, so inode
+    // order keeps the inode table reads sequential. The number comes from
+    // readdir, without a stat per entry.
+    std::unordered_map<std::string, BatchItem*> byName;
+    for (BatchItem* file : files) {
+        byName.emplace(ToNativePath(file->leaf), file);
+    }
+
+    DIR* dir = opendir(directory.empty() ? "." : ToNativePath(directory).c_str());
+    if (!dir) {
+        return;  // Left in name order; running the batch reports the error
+    }
+    size_t remaining = byName.size();
+    while (remaining) {
+        dirent* entry = readdir(dir);
+        if (!entry) {
+            break;
+        }
+        auto found = byName.find(entry->d_name);
+        if (found != byName.end()) {
+            found->second->diskOrder = entry->d_ino;
+            remaining--;
+        }
+    }
+    closedir(dir);
+}
+
+uint64_t ProcessFileBatch(const std::vector<const BatchItem*>& items) {
+    std::vector<std::vector<const CommandSpec*>> chains(items.size());
+    for (size_t i = 0; i < items.size(); i++) {
+        if (!ParseCommandChain(items[i]->commands, L"file", kFileCommands, std::size(kFileCommands), chains[i])) {
+            return items.size();
+        }
+    }
+
+    // Items arrive grouped by directory: each directory is opened once and
+    // its files are opened relative to it
+    uint64_t failures = 0;
+    int dirfd = -1;
+    bool directoryFailed = false;
+    const std::wstring* directory = nullptr;
+    for (size_t i = 0; i < items.size(); i++) {
+        const BatchItem& item = *items[i];
+        std::string path = ToNativePath(item.name);
+        if (!directory || *directory != item.directory) {
+            if (dirfd >= 0) {
+                close(dirfd);
+            }
+            directory = &item.directory;
+            dirfd = AT_FDCWD;
+            directoryFailed = false;
+            if (!item.directory.empty()) {
+                std::string directoryPath = ToNativePath(item.directory);
+                dirfd = open(directoryPath.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+                directoryFailed = dirfd < 0;
+                if (directoryFailed) {
+                    PrintFileError(directoryPath, L"open", errno);
+                }
+            }
+        }
+        if (directoryFailed) {
+            failures++;
+            continue;
+        }
+
+        // The named path itself follows symlinks, as for a single --file
+        std::string leaf = item.leaf.empty() ? "." : ToNativePath(item.leaf);
+        TraceContext traceContext(TraceObject::File, item.name);
+        struct stat st;
+        if (fstatat(dirfd, leaf.c_str(), &st, 0) != 0) {
+            PrintFileError(path, L"stat", errno);
+            failures++;
+            continue;
+        }
+        SecurityTarget target;
+        int err = target.Open(dirfd, leaf.c_str(), path, st.st_mode & S_IFMT, true);
+        if (err) {
+            PrintFileError(path, L"openat", err);
+            failures++;
+            continue;
+        }
+        if (!RunFileChain(target, chains[i], false)) {
+            failures++;
+        }
+    }
+    if (dirfd >= 0) {
+        close(dirfd);
+    }
+    return failures;
+}
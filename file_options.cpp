@@ -0,0 +1,36 @@
+#include "file_operations.h"
+#include <cwchar>
+#include <iostream>
+
+namespace {
+
+const unsigned long kMaxQueueDepth = 4096;
+
+}  // namespace
+
+bool ParseFileCommandOptions(const std::vector<std::wstring>& args, size_t first, FileCommandOptions& options) {
+    for (size_t i = first; i < args.size(); i++) {
+        const std::wstring& arg = args[i];
+        if (arg == L"--recursive") {
+            options.recursive = true;
+        } else if (arg == L"--queue-depth" && i + 1 < args.size()) {
+            const std::wstring& text = args[++i];
+            wchar_t* endPtr = nullptr;
+            unsigned long depth = wcstoul(text.c_str(), &endPtr, 10);
+            if (text.empty() || *endPtr != L'\0' || depth == 0 || depth > kMaxQueueDepth) {
+                std::wcerr << L"Invalid value for --queue-depth (1-" << kMaxQueueDepth << L"): " << text << L"\n";
+                return false;
+            }
+            options.queueDepth = static_cast<unsigned>(depth);
+        } else if (arg == L"--concurrency" && i + 1 < args.size()) {
+            if (!ParseConcurrencyPolicy(args[++i], options.concurrency)) {
+                return false;
+            }
+        } else {
+            std::wcerr << L"Unknown file option: " << arg << L"\n";
+            std::wcerr << L"Valid options: --recursive, --queue-depth <n>, --concurrency <fixed|aimd|gradient>\n";
+            return false;
+        }
+    }
+    return true;
+}
@@ -0,0 +1,160 @@
+// Named pipe transport for --serve on Windows
+#include <windows.h>
+#include <sddl.h>
+#include <algorithm>
+#include <iostream>
+
+#include "ipc_channel.h"
+#include "common.h"
+
+namespace {
+
+// Protected DACL: SYSTEM and Administrators only. The server runs privileged
+// commands for whoever connects.
+const wchar_t kPipeSddl[] = L"D:P(A;;GA;;;SY)(A;;GA;;;BA)";
+const DWORD kPipeBufferSize = 64 * 1024;
+const DWORD kConnectTimeoutMs = 5000;
+
+std::wstring PipePath(const std::wstring& endpoint) {
+    return L"\\\\.\\pipe\\" + endpoint;
+}
+
+class PipeConnection : public IpcConnection {
+public:
+    explicit PipeConnection(HANDLE pipe) : pipe_(pipe) {}
+    ~PipeConnection() override { CloseHandle(pipe_); }
+
+    bool Read(void* buffer, size_t size) override {
+        BYTE* next = static_cast<BYTE*>(buffer);
+        while (size > 0) {
+            DWORD read = 0;
+            if (!ReadFile(pipe_, next, static_cast<DWORD>(std::min<size_t>(size, kPipeBufferSize)), &read, nullptr) ||
+                read == 0) {
+                return false;
+            }
+            next += read;
+            size -= read;
+        }
+        return true;
+    }
+
+    bool Write(const void* buffer, size_t size) override {
+        const BYTE* next = static_cast<const BYTE*>(buffer);
+        while (size > 0) {
+            DWORD written = 0;
+            if (!WriteFile(pipe_, next, static_cast<DWORD>(std::min<size_t>(size, kPipeBufferSize)), &written, nullptr) ||
+                written == 0) {
+                return false;
+            }
+            next += written;
+            size -= written;
+        }
+        return true;
+    }
+
+    // The handle is synchronous, so DisconnectNamedPipe would queue behind
+    // the blocked ReadFile; cancelling it works from any thread
+    void Close() override { CancelIoEx(pipe_, nullptr); }
+
+private:
+    HANDLE pipe_;
+};
+
+class PipeListener : public IpcListener {
+public:
+    PipeListener(const std::wstring& path, PSECURITY_DESCRIPTOR descriptor)
+        : path_(path), descriptor_(descriptor), next_(INVALID_HANDLE_VALUE) {}
+
+    ~PipeListener() override {
+        if (next_ != INVALID_HANDLE_VALUE) {
+            CloseHandle(next_);
+        }
+        LocalFree(descriptor_);
+    }
+
+    // The first instance is created with FILE_FLAG_FIRST_PIPE_INSTANCE so a
+    // pipe squatted by another process is an error rather than shared
+    bool CreateInstance(bool first) {
+        SECURITY_ATTRIBUTES attributes = { sizeof(attributes), descriptor_, FALSE };
+        next_ = CreateNamedPipeW(path_.c_str(), PIPE_ACCESS_DUPLEX | (first ? FILE_FLAG_FIRST_PIPE_INSTANCE : 0),
+                                 PIPE_TYPE_BYTE | PIPE_READMODE_BYTE | PIPE_WAIT | PIPE_REJECT_REMOTE_CLIENTS,
+                                 PIPE_UNLIMITED_INSTANCES, kPipeBufferSize, kPipeBufferSize, 0, &attributes);
+        if (next_ == INVALID_HANDLE_VALUE) {
+            PrintLastError(L"CreateNamedPipe");
+            return false;
+        }
+        return true;
+    }
+
+    std::unique_ptr<IpcConnection> Accept() override {
+        for (;;) {
+            if (next_ == INVALID_HANDLE_VALUE && !CreateInstance(false)) {
+                return nullptr;
+            }
+            BOOL connected = ConnectNamedPipe(next_, nullptr) || GetLastError() == ERROR_PIPE_CONNECTED;
+            HANDLE pipe = next_;
+            next_ = INVALID_HANDLE_VALUE;
+            if (!connected) {
+                // The client gave up before we got to it (ERROR_NO_DATA)
+                CloseHandle(pipe);
+                continue;
+            }
+            // The next client finds a free instance instead of ERROR_PIPE_BUSY
+            CreateInstance(false);
+            return std::make_unique<PipeConnection>(pipe);
+        }
+    }
+
+    std::wstring Path() const override { return path_; }
+
+private:
+    std::wstring path_;
+    PSECURITY_DESCRIPTOR descriptor_;
+    HANDLE next_;
+};
+
+}  // namespace
+
+std::wstring DefaultIpcEndpoint() {
+    return L"AclTool";
+}
+
+std::unique_ptr<IpcListener> ListenIpc(const std::wstring& endpoint) {
+    PSECURITY_DESCRIPTOR descriptor = nullptr;
+    if (!ConvertStringSecurityDescriptorToSecurityDescriptorW(kPipeSddl, SDDL_REVISION_1, &descriptor, nullptr)) {
+        PrintLastError(L"ConvertStringSecurityDescriptorToSecurityDescriptor");
+        return nullptr;
+    }
+
+    auto listener = std::make_unique<PipeListener>(PipePath(endpoint), descriptor);
+    if (!listener->CreateInstance(true)) {
+        if (GetLastError() == ERROR_ACCESS_DENIED) {
+            std::wcerr << L"A server is already listening on " << listener->Path() << L"\n";
+        }
+        return nullptr;
+    }
+    return listener;
+}
+
+std::unique_ptr<IpcConnection> ConnectIpc(const std::wstring& endpoint) {
+    std::wstring path = PipePath(endpoint);
+    for (;;) {
+        // Identification level only: the server cannot act as this client
+        HANDLE pipe = CreateFileW(path.c_str(), GENERIC_READ | GENERIC_WRITE, 0, nullptr, OPEN_EXISTING,
+                                  SECURITY_SQOS_PRESENT | SECURITY_IDENTIFICATION, nullptr);
+        if (pipe != INVALID_HANDLE_VALUE) {
+            return std::make_unique<PipeConnection>(pipe);
+        }
+        if (GetLastError() != ERROR_PIPE_BUSY) {
+            if (GetLastError() == ERROR_FILE_NOT_FOUND) {
+                std::wcerr << L"No server on " << path << L" (start one with --serve)\n";
+            }
+            PrintLastError(L"CreateFile(pipe)");
+            return nullptr;
+        }
+        if (!WaitNamedPipeW(path.c_str(), kConnectTimeoutMs)) {
+            PrintLastError(L"WaitNamedPipe");
+            return nullptr;
+        }
+    }
+}
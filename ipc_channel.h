@@ -0,0 +1,35 @@
+#pragma once
+#include <cstddef>
+#include <memory>
+#include <string>
+
+// Local byte stream between a resident AclTool (--serve) and its clients: a
+// named pipe on Windows, a Unix domain socket elsewhere. Implemented in
+// ipc_channel.cpp and ipc_channel_posix.cpp. Endpoints only accept local
+// callers, and only administrators (root / the socket's owner) may connect.
+class IpcConnection {
+public:
+    virtual ~IpcConnection() = default;
+    // Transfer exactly size bytes; false on error or when the peer has gone
+    virtual bool Read(void* buffer, size_t size) = 0;
+    virtual bool Write(const void* buffer, size_t size) = 0;
+    // Makes a Read blocked on another thread return false
+    virtual void Close() = 0;
+};
+
+class IpcListener {
+public:
+    virtual ~IpcListener() = default;
+    // Blocks until a client connects; nullptr if the endpoint is unusable
+    virtual std::unique_ptr<IpcConnection> Accept() = 0;
+    // Pipe name or socket path, for messages
+    virtual std::wstring Path() const = 0;
+};
+
+// "AclTool". On Windows an endpoint is a pipe name (\\.\pipe\<endpoint>);
+// elsewhere a socket path, or a name placed as <endpoint>.sock in a 0700
+// directory of the server's ($XDG_RUNTIME_DIR/AclTool, else /tmp/AclTool-<uid>).
+// Both functions print their errors.
+std::wstring DefaultIpcEndpoint();
+std::unique_ptr<IpcListener> ListenIpc(const std::wstring& endpoint);
+std::unique_ptr<IpcConnection> ConnectIpc(const std::wstring& endpoint);
@@ -0,0 +1,239 @@
+// Unix domain socket transport for --serve on non-Windows builds
+#include "ipc_channel.h"
+#include "posix_common.h"
+#include <cerrno>
+#include <csignal>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace {
+
+const int kListenBacklog = 64;
+
+// Only a socket this user owns may be replaced; anything else at the path
+// (a regular file, a link, another user's socket) is left alone
+bool RemoveStaleSocket(const std::string& path) {
+    struct stat info;
+    if (lstat(path.c_str(), &info) != 0) {
+        return errno == ENOENT;
+    }
+    if (!S_ISSOCK(info.st_mode) || info.st_uid != geteuid()) {
+        std::wcerr << L"Refusing to replace " << FromNativePath(path) << L": not a socket owned by this user\n";
+        return false;
+    }
+    if (unlink(path.c_str()) != 0) {
+        PrintErrno(L"unlink");
+        return false;
+    }
+    return true;
+}
+
+class SocketConnection : public IpcConnection {
+public:
+    explicit SocketConnection(int fd) : fd_(fd) {}
+    ~SocketConnection() override { close(fd_); }
+
+    bool Read(void* buffer, size_t size) override {
+        char* next = static_cast<char*>(buffer);
+        while (size > 0) {
+            ssize_t received = recv(fd_, next, size, 0);
+            if (received < 0 && errno == EINTR) {
+                continue;
+            }
+            if (received <= 0) {
+                return false;
+            }
+            next += received;
+            size -= static_cast<size_t>(received);
+        }
+        return true;
+    }
+
+    bool Write(const void* buffer, size_t size) override {
+        const char* next = static_cast<const char*>(buffer);
+        while (size > 0) {
+            ssize_t sent = send(fd_, next, size, 0);
+            if (sent < 0 && errno == EINTR) {
+                continue;
+            }
+            if (sent <= 0) {
+                return false;
+            }
+            next += sent;
+            size -= static_cast<size_t>(sent);
+        }
+        return true;
+    }
+
+    void Close() override { shutdown(fd_, SHUT_RDWR); }
+
+private:
+    int fd_;
+};
+
+class SocketListener : public IpcListener {
+public:
+    SocketListener(int fd, const std::string& path) : fd_(fd), path_(path) {}
+    ~SocketListener() override {
+        close(fd_);
+        RemoveStaleSocket(path_);
+    }
+
+    std::unique_ptr<IpcConnection> Accept() override {
+        for (;;) {
+            int fd = accept(fd_, nullptr, nullptr);
+            if (fd >= 0) {
+                return std::make_unique<SocketConnection>(fd);
+            }
+            // The client may have given up before we got to it
+            if (errno != EINTR && errno != ECONNABORTED) {
+                PrintErrno(L"accept");
+                return nullptr;
+            }
+        }
+    }
+
+    std::wstring Path() const override { return FromNativePath(path_); }
+
+private:
+    int fd_;
+    std::string path_;
+};
+
+// Named endpoints live in a directory only this user can enter, so another
+// user cannot create the socket first and either block the server or answer
+// its clients. The server creates the directory; both sides check it is a
+// real directory owned by them (or, for a client, by root) that nobody else
+// can write to.
+bool PrivateDirectory(const std::string& path, bool create) {
+    if (create && mkdir(path.c_str(), 0700) != 0 && errno != EEXIST) {
+        PrintErrno((L"mkdir " + FromNativePath(path)).c_str());
+        return false;
+    }
+    struct stat info;
+    if (lstat(path.c_str(), &info) != 0) {
+        if (!create && errno == ENOENT) {
+            std::wcerr << L"No server on " << FromNativePath(path) << L" (start one with --serve)\n";
+        } else {
+            PrintErrno((L"lstat " + FromNativePath(path)).c_str());
+        }
+        return false;
+    }
+    bool owned = info.st_uid == geteuid() || (!create && info.st_uid == 0);
+    if (!S_ISDIR(info.st_mode) || !owned || (info.st_mode & (create ? 077 : 022)) != 0) {
+        std::wcerr << L"Refusing to use " << FromNativePath(path)
+                   << L": it must be a directory owned by this user that nobody else can write to\n";
+        return false;
+    }
+    return true;
+}
+
+bool SocketAddress(const std::wstring& endpoint, bool listening, sockaddr_un& address, std::string& path) {
+    path = ToNativePath(endpoint);
+    if (path.find('/') == std::string::npos) {
+        const char* runtimeDir = getenv("XDG_RUNTIME_DIR");
+        std::string directory = runtimeDir && *runtimeDir ? std::string(runtimeDir) + "/AclTool"
+                                                          : "/tmp/AclTool-" + std::to_string(geteuid());
+        if (!PrivateDirectory(directory, listening)) {
+            return false;
+        }
+        path = directory + "/" + path + ".sock";
+    }
+
+    address = {};
+    address.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(address.sun_path)) {
+        std::wcerr << L"Socket path is too long: " << FromNativePath(path) << L"\n";
+        return false;
+    }
+    memcpy(address.sun_path, path.c_str(), path.size() + 1);
+    return true;
+}
+
+// A peer that goes away mid-response must fail the send, not kill the server
+void IgnoreSigpipe() {
+    signal(SIGPIPE, SIG_IGN);
+}
+
+}  // namespace
+
+std::wstring DefaultIpcEndpoint() {
+    return L"AclTool";
+}
+
+std::unique_ptr<IpcListener> ListenIpc(const std::wstring& endpoint) {
+    sockaddr_un address;
+    std::string path;
+    if (!SocketAddress(endpoint, true, address, path)) {
+        return nullptr;
+    }
+    IgnoreSigpipe();
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        PrintErrno(L"socket");
+        return nullptr;
+    }
+
+    // A socket file nobody answers on is left over from a server that died
+    if (connect(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) == 0) {
+        std::wcerr << L"A server is already listening on " << FromNativePath(path) << L"\n";
+        close(fd);
+        return nullptr;
+    }
+    close(fd);
+    if (!RemoveStaleSocket(path)) {
+        return nullptr;
+    }
+
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        PrintErrno(L"socket");
+        return nullptr;
+    }
+    // Owner only from the moment the socket exists
+    mode_t previousMask = umask(0177);
+    int bound = bind(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address));
+    int bindError = errno;
+    umask(previousMask);
+    if (bound != 0) {
+        PrintErrno(L"bind", bindError);
+        close(fd);
+        return nullptr;
+    }
+    if (listen(fd, kListenBacklog) != 0) {
+        PrintErrno(L"listen");
+        close(fd);
+        unlink(path.c_str());
+        return nullptr;
+    }
+    return std::make_unique<SocketListener>(fd, path);
+}
+
+std::unique_ptr<IpcConnection> ConnectIpc(const std::wstring& endpoint) {
+    sockaddr_un address;
+    std::string path;
+    if (!SocketAddress(endpoint, false, address, path)) {
+        return nullptr;
+    }
+    IgnoreSigpipe();
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        PrintErrno(L"socket");
+        return nullptr;
+    }
+    if (connect(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0) {
+        int err = errno;
+        std::wcerr << L"No server on " << FromNativePath(path) << L" (start one with --serve)\n";
+        PrintErrno(L"connect", err);
+        close(fd);
+        return nullptr;
+    }
+    return std::make_unique<SocketConnection>(fd);
+}
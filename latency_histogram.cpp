@@ -0,0 +1,133 @@
+#include "latency_histogram.h"
+#include <algorithm>
+#include <cstdio>
+#include <cwchar>
+#include <string>
+
+namespace {
+
+const unsigned kSubBucketBits = LatencyHistogram::kSubBucketBits;
+const uint64_t kSubBuckets = LatencyHistogram::kSubBuckets;
+
+// Index of the highest set bit; 0 for 0 and 1
+unsigned Log2(uint64_t value) {
+    unsigned log = 0;
+    while (value > 1) {
+        value >>= 1;
+        log++;
+    }
+    return log;
+}
+
+size_t BucketFor(uint64_t nanoseconds) {
+    if (nanoseconds < kSubBuckets) {
+        return static_cast<size_t>(nanoseconds);
+    }
+    unsigned shift = Log2(nanoseconds) - kSubBucketBits;
+    return static_cast<size_t>((shift + 1) * kSubBuckets + ((nanoseconds >> shift) & (kSubBuckets - 1)));
+}
+
+// Smallest value that lands in a bucket, and the bucket's width
+uint64_t BucketLower(size_t bucket, uint64_t& width) {
+    if (bucket < kSubBuckets) {
+        width = 1;
+        return bucket;
+    }
+    unsigned shift = static_cast<unsigned>(bucket / kSubBuckets - 1);
+    width = 1ull << shift;
+    return (kSubBuckets + bucket % kSubBuckets) << shift;
+}
+
+}  // namespace
+
+std::wstring FormatDuration(uint64_t nanoseconds) {
+    wchar_t buffer[32];
+    if (nanoseconds < 1000) {
+        swprintf(buffer, 32, L"%lluns", static_cast<unsigned long long>(nanoseconds));
+    } else if (nanoseconds < 1000000) {
+        swprintf(buffer, 32, L"%.1fus", nanoseconds / 1e3);
+    } else if (nanoseconds < 1000000000) {
+        swprintf(buffer, 32, L"%.1fms", nanoseconds / 1e6);
+    } else {
+        swprintf(buffer, 32, L"%.2fs", nanoseconds / 1e9);
+    }
+    return buffer;
+}
+
+void LatencyHistogram::Record(uint64_t nanoseconds) {
+    buckets_[BucketFor(nanoseconds)]++;
+    count_++;
+    total_ += nanoseconds;
+    min_ = std::min(min_, nanoseconds);
+    max_ = std::max(max_, nanoseconds);
+}
+
+void LatencyHistogram::Merge(const LatencyHistogram& other) {
+    for (size_t i = 0; i < kBucketCount; i++) {
+        buckets_[i] += other.buckets_[i];
+    }
+    count_ += other.count_;
+    total_ += other.total_;
+    min_ = std::min(min_, other.min_);
+    max_ = std::max(max_, other.max_);
+}
+
+uint64_t LatencyHistogram::Mean() const {
+    return count_ ? total_ / count_ : 0;
+}
+
+uint64_t LatencyHistogram::Percentile(double percentile) const {
+    if (count_ == 0) {
+        return 0;
+    }
+
+    // The sample of that rank lies somewhere in its bucket; take the middle,
+    // kept within the exact min and max
+    uint64_t rank = static_cast<uint64_t>(percentile / 100.0 * (count_ - 1) + 0.5);
+    uint64_t seen = 0;
+    for (size_t i = 0; i < kBucketCount; i++) {
+        seen += buckets_[i];
+        if (seen > rank) {
+            uint64_t width = 0;
+            uint64_t lower = BucketLower(i, width);
+            return std::min(max_, std::max(min_, lower + (width - 1) / 2));
+        }
+    }
+    return max_;
+}
+
+void LatencyHistogram::Print(std::wostream& out, const wchar_t* title) const {
+    out << title << L": " << Count() << L" samples";
+    if (count_ == 0) {
+        out << L"\n";
+        return;
+    }
+
+    out << L", min " << FormatDuration(Min())
+        << L", mean " << FormatDuration(Mean())
+        << L", p50 " << FormatDuration(Percentile(50))
+        << L", p90 " << FormatDuration(Percentile(90))
+        << L", p99 " << FormatDuration(Percentile(99))
+        << L", max " << FormatDuration(Max()) << L"\n";
+
+    // Line i holds samples in [2^i, 2^(i+1))
+    std::array<uint64_t, 64> powers = {};
+    for (size_t i = 0; i < kBucketCount; i++) {
+        uint64_t width = 0;
+        powers[Log2(BucketLower(i, width))] += buckets_[i];
+    }
+
+    uint64_t largest = *std::max_element(powers.begin(), powers.end());
+    for (size_t i = 0; i < powers.size(); i++) {
+        if (powers[i] == 0) {
+            continue;
+        }
+
+        std::wstring lower = FormatDuration(i == 0 ? 0 : (1ull << i));
+        size_t barLength = static_cast<size_t>(40 * powers[i] / largest);
+
+        wchar_t line[64];
+        swprintf(line, 64, L"  >= %-8ls %10llu ", lower.c_str(), static_cast<unsigned long long>(powers[i]));
+        out << line << std::wstring(std::max<size_t>(barLength, 1), L'#') << L"\n";
+    }
+}
@@ -0,0 +1,40 @@
+#pragma once
+#include <array>
+#include <cstdint>
+#include <ostream>
+#include <string>
+
+// Latency samples in nanoseconds, counted in log-linear buckets: each power
+// of two is split into 16 equal buckets, so memory is fixed however many
+// samples are recorded (a --serve run never stops recording) and a
+// percentile is within 1/16 of the exact value. Count, min, max and mean
+// are exact. Printed by power of two.
+class LatencyHistogram {
+public:
+    void Record(uint64_t nanoseconds);
+    void Merge(const LatencyHistogram& other);
+
+    uint64_t Count() const { return count_; }
+    uint64_t Min() const { return count_ ? min_ : 0; }
+    uint64_t Max() const { return max_; }
+    uint64_t Mean() const;
+    uint64_t Percentile(double percentile) const;  // 0.0 - 100.0
+
+    // Prints count/min/mean/percentiles followed by one line per non-empty power of two
+    void Print(std::wostream& out, const wchar_t* title) const;
+
+    static constexpr unsigned kSubBucketBits = 4;
+    static constexpr uint64_t kSubBuckets = uint64_t(1) << kSubBucketBits;
+    // Values below kSubBuckets get a bucket each, then kSubBuckets per power of two up to 2^64
+    static constexpr size_t kBucketCount = (64 - kSubBucketBits + 1) * kSubBuckets;
+
+private:
+    std::array<uint64_t, kBucketCount> buckets_ = {};
+    uint64_t count_ = 0;
+    uint64_t total_ = 0;
+    uint64_t min_ = UINT64_MAX;
+    uint64_t max_ = 0;
+};
+
+// Formats a nanosecond duration with a readable unit ("850ns", "12.4us", "3.1ms")
+std::wstring FormatDuration(uint64_t nanoseconds);
@@ -0,0 +1,131 @@
+#include "posix_acl.h"
+#include <algorithm>
+
+namespace {
+
+const uint32_t kPosixAclXattrVersion = 2;
+const size_t kHeaderSize = 4;
+const size_t kEntrySize = 8;
+
+void PutLe16(std::vector<uint8_t>& out, uint16_t value) {
+    out.push_back(static_cast<uint8_t>(value));
+    out.push_back(static_cast<uint8_t>(value >> 8));
+}
+
+void PutLe32(std::vector<uint8_t>& out, uint32_t value) {
+    for (int shift = 0; shift < 32; shift += 8) {
+        out.push_back(static_cast<uint8_t>(value >> shift));
+    }
+}
+
+uint16_t GetLe16(const uint8_t* data) {
+    return static_cast<uint16_t>(data[0] | (data[1] << 8));
+}
+
+uint32_t GetLe32(const uint8_t* data) {
+    return data[0] | (data[1] << 8) | (data[2] << 16) | (static_cast<uint32_t>(data[3]) << 24);
+}
+
+bool IsNamedTag(uint16_t tag) {
+    return tag == kPosixAclUser || tag == kPosixAclGroup;
+}
+
+}  // namespace
+
+PosixAcl MakeMinimalPosixAcl(uint16_t userPerm, uint16_t groupPerm, uint16_t otherPerm) {
+    return PosixAcl{
+        { kPosixAclUserObj,  userPerm,  kPosixAclUndefinedId },
+        { kPosixAclGroupObj, groupPerm, kPosixAclUndefinedId },
+        { kPosixAclOther,    otherPerm, kPosixAclUndefinedId },
+    };
+}
+
+bool NormalizePosixAcl(PosixAcl& acl) {
+    for (auto& entry : acl) {
+        if (entry.perm & ~kPosixAclAll) {
+            return false;
+        }
+        if (!IsNamedTag(entry.tag)) {
+            entry.id = kPosixAclUndefinedId;
+        }
+    }
+
+    std::sort(acl.begin(), acl.end(), [](const PosixAclEntry& a, const PosixAclEntry& b) {
+        return a.tag != b.tag ? a.tag < b.tag : a.id < b.id;
+    });
+
+    unsigned userObj = 0, groupObj = 0, other = 0, mask = 0, named = 0;
+    for (size_t i = 0; i < acl.size(); i++) {
+        switch (acl[i].tag) {
+            case kPosixAclUserObj:  userObj++;  break;
+            case kPosixAclGroupObj: groupObj++; break;
+            case kPosixAclOther:    other++;    break;
+            case kPosixAclMask:     mask++;     break;
+            case kPosixAclUser:
+            case kPosixAclGroup:
+                named++;
+                if (i > 0 && acl[i - 1].tag == acl[i].tag && acl[i - 1].id == acl[i].id) {
+                    return false;  // Same user/group listed twice
+                }
+                break;
+            default:
+                return false;
+        }
+    }
+
+    return userObj == 1 && groupObj == 1 && other == 1 && mask <= 1 && (named == 0 || mask == 1);
+}
+
+std::vector<uint8_t> EncodePosixAcl(PosixAcl acl) {
+    std::vector<uint8_t> out;
+    if (!NormalizePosixAcl(acl)) {
+        return out;
+    }
+
+    out.reserve(kHeaderSize + acl.size() * kEntrySize);
+    PutLe32(out, kPosixAclXattrVersion);
+    for (const auto& entry : acl) {
+        PutLe16(out, entry.tag);
+        PutLe16(out, entry.perm);
+        PutLe32(out, entry.id);
+    }
+    return out;
+}
+
+bool DecodePosixAcl(const uint8_t* data, size_t size, PosixAcl& acl) {
+    acl.clear();
+    if (size < kHeaderSize || (size - kHeaderSize) % kEntrySize != 0 ||
+        GetLe32(data) != kPosixAclXattrVersion) {
+        return false;
+    }
+
+    for (size_t offset = kHeaderSize; offset < size; offset += kEntrySize) {
+        acl.push_back(PosixAclEntry{ GetLe16(data + offset), GetLe16(data + offset + 2), GetLe32(data + offset + 4) });
+    }
+    return NormalizePosixAcl(acl);
+}
+
+std::wstring FormatPosixAcl(const PosixAcl& acl) {
+    std::wstring text;
+    for (const auto& entry : acl) {
+        if (!text.empty()) {
+            text += L',';
+        }
+
+        switch (entry.tag) {
+            case kPosixAclUserObj:  text += L"user:";  break;
+            case kPosixAclUser:     text += L"user:" + std::to_wstring(entry.id);  break;
+            case kPosixAclGroupObj: text += L"group:"; break;
+            case kPosixAclGroup:    text += L"group:" + std::to_wstring(entry.id); break;
+            case kPosixAclMask:     text += L"mask:";  break;
+            case kPosixAclOther:    text += L"other:"; break;
+            default:                text += L"?:";     break;
+        }
+
+        text += L':';
+        text += (entry.perm & kPosixAclRead)    ? L'r' : L'-';
+        text += (entry.perm & kPosixAclWrite)   ? L'w' : L'-';
+        text += (entry.perm & kPosixAclExecute) ? L'x' : L'-';
+    }
+    return text;
+}
@@ -0,0 +1,50 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// POSIX ACLs in the binary layout the kernel uses for the
+// system.posix_acl_access / system.posix_acl_default xattrs:
+//     uint32 version (2), then { uint16 tag, uint16 perm, uint32 id } per entry,
+// all little endian, entries sorted by tag then id. Encoding is done here so
+// applying an ACL costs one setxattr and no libacl text parsing. Writing an
+// ACL with only the three base entries sets the mode and drops any extended
+// entries; the kernel stores no xattr for it.
+
+const uint16_t kPosixAclUserObj  = 0x01;
+const uint16_t kPosixAclUser     = 0x02;
+const uint16_t kPosixAclGroupObj = 0x04;
+const uint16_t kPosixAclGroup    = 0x08;
+const uint16_t kPosixAclMask     = 0x10;
+const uint16_t kPosixAclOther    = 0x20;
+
+const uint16_t kPosixAclRead    = 0x04;
+const uint16_t kPosixAclWrite   = 0x02;
+const uint16_t kPosixAclExecute = 0x01;
+const uint16_t kPosixAclAll     = kPosixAclRead | kPosixAclWrite | kPosixAclExecute;
+
+const uint32_t kPosixAclUndefinedId = 0xFFFFFFFF;  // id of the *_OBJ, MASK and OTHER entries
+
+struct PosixAclEntry {
+    uint16_t tag;
+    uint16_t perm;
+    uint32_t id;
+};
+
+using PosixAcl = std::vector<PosixAclEntry>;
+
+// The three-entry ACL equivalent to a permission mode (user::, group::, other::)
+PosixAcl MakeMinimalPosixAcl(uint16_t userPerm, uint16_t groupPerm, uint16_t otherPerm);
+
+// Sorts the entries and checks the rules the kernel enforces: exactly one
+// USER_OBJ, GROUP_OBJ and OTHER, no duplicate named entries, and a MASK
+// whenever named USER/GROUP entries are present.
+bool NormalizePosixAcl(PosixAcl& acl);
+
+// Returns an empty buffer if the ACL is not valid
+std::vector<uint8_t> EncodePosixAcl(PosixAcl acl);
+bool DecodePosixAcl(const uint8_t* data, size_t size, PosixAcl& acl);
+
+// Short text form for display: "user::rwx,group::---,other::r--"
+std::wstring FormatPosixAcl(const PosixAcl& acl);
@@ -0,0 +1,256 @@
+#include "posix_acl_benchmark.h"
+#include "latency_histogram.h"
+#include "posix_acl.h"
+#include "posix_common.h"
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/xattr.h>
+#include <unistd.h>
+#include <cerrno>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+const char kAclAccessXattr[]  = "system.posix_acl_access";
+const char kAclDefaultXattr[] = "system.posix_acl_default";
+
+const uint32_t kNamedUid = 65534;  // nobody
+const uint32_t kNamedGid = 100;
+
+uint64_t ElapsedNs(Clock::time_point start) {
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count());
+}
+
+// Counts failed checks, printing each one
+class Checker {
+public:
+    void Expect(bool condition, const wchar_t* what) {
+        if (!condition) {
+            std::wcerr << L"FAILED: " << what << L"\n";
+            failures_++;
+        }
+    }
+
+    unsigned Failures() const { return failures_; }
+
+private:
+    unsigned failures_ = 0;
+};
+
+bool SameAcl(const PosixAcl& a, const PosixAcl& b) {
+    if (a.size() != b.size()) {
+        return false;
+    }
+    for (size_t i = 0; i < a.size(); i++) {
+        if (a[i].tag != b[i].tag || a[i].perm != b[i].perm || a[i].id != b[i].id) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// user::rw-,user:nobody:r--,group::r-x,group:100:rw-,mask::rwx,other::r--,
+// listed out of order
+PosixAcl MakeExtendedAcl() {
+    return PosixAcl{
+        { kPosixAclOther,    kPosixAclRead,                  kPosixAclUndefinedId },
+        { kPosixAclGroup,    kPosixAclRead | kPosixAclWrite, kNamedGid },
+        { kPosixAclMask,     kPosixAclAll,                   kPosixAclUndefinedId },
+        { kPosixAclUser,     kPosixAclRead,                  kNamedUid },
+        { kPosixAclGroupObj, kPosixAclRead | kPosixAclExecute, kPosixAclUndefinedId },
+        { kPosixAclUserObj,  kPosixAclRead | kPosixAclWrite, kPosixAclUndefinedId },
+    };
+}
+
+bool ReadAcl(int fd, const char* name, PosixAcl& acl, int& err) {
+    uint8_t buffer[512];
+    ssize_t size = fgetxattr(fd, name, buffer, sizeof(buffer));
+    if (size < 0) {
+        err = errno;
+        return false;
+    }
+    err = 0;
+    return DecodePosixAcl(buffer, static_cast<size_t>(size), acl);
+}
+
+void CheckCodec(Checker& check) {
+    PosixAcl expected = MakeExtendedAcl();
+    check.Expect(NormalizePosixAcl(expected) && expected.front().tag == kPosixAclUserObj &&
+                 expected.back().tag == kPosixAclOther, L"entries are sorted by tag");
+
+    std::vector<uint8_t> encoded = EncodePosixAcl(MakeExtendedAcl());
+    check.Expect(encoded.size() == 4 + 6 * 8 && encoded[0] == 2, L"an ACL encodes to a version 2 header and 8 bytes per entry");
+    PosixAcl decoded;
+    check.Expect(DecodePosixAcl(encoded.data(), encoded.size(), decoded) && SameAcl(decoded, expected),
+                 L"an encoded ACL decodes to the same entries");
+
+    PosixAcl noMask = MakeExtendedAcl();
+    noMask.erase(noMask.begin() + 2);
+    check.Expect(EncodePosixAcl(noMask).empty(), L"named entries without a mask are rejected");
+    PosixAcl duplicate = MakeExtendedAcl();
+    duplicate.push_back({ kPosixAclUser, kPosixAclWrite, kNamedUid });
+    check.Expect(EncodePosixAcl(duplicate).empty(), L"a user listed twice is rejected");
+    check.Expect(!DecodePosixAcl(encoded.data(), encoded.size() - 1, decoded), L"a truncated xattr is rejected");
+    encoded[0] = 1;
+    check.Expect(!DecodePosixAcl(encoded.data(), encoded.size(), decoded), L"an unknown version is rejected");
+}
+
+// Returns false if the filesystem has no ACL support, after printing so
+bool CheckXattrs(Checker& check, const std::string& scratch) {
+    std::string filePath = scratch + "/file";
+    int fd = open(filePath.c_str(), O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        PrintErrno(L"open", errno);
+        check.Expect(false, L"a scratch file can be created");
+        return true;
+    }
+
+    PosixAcl expected = MakeExtendedAcl();
+    NormalizePosixAcl(expected);
+    std::vector<uint8_t> encoded = EncodePosixAcl(expected);
+    if (fsetxattr(fd, kAclAccessXattr, encoded.data(), encoded.size(), 0) != 0 && errno == EOPNOTSUPP) {
+        std::wcout << FromNativePath(scratch) << L" has no POSIX ACL support; xattr checks skipped\n";
+        close(fd);
+        unlink(filePath.c_str());
+        return false;
+    }
+
+    PosixAcl read;
+    int err = 0;
+    check.Expect(ReadAcl(fd, kAclAccessXattr, read, err) && SameAcl(read, expected),
+                 L"an extended ACL written as an xattr reads back unchanged");
+    struct stat st;
+    check.Expect(fstat(fd, &st) == 0 && (st.st_mode & 0777) == 0674,
+                 L"the kernel sets the group bits from the mask");
+
+    // What harden writes: the kernel keeps no xattr, only the mode
+    std::vector<uint8_t> minimal = EncodePosixAcl(MakeMinimalPosixAcl(kPosixAclRead | kPosixAclWrite, 0, kPosixAclRead));
+    check.Expect(fsetxattr(fd, kAclAccessXattr, minimal.data(), minimal.size(), 0) == 0,
+                 L"a minimal ACL can be written");
+    check.Expect(!ReadAcl(fd, kAclAccessXattr, read, err) && err == ENODATA,
+                 L"a minimal ACL replaces the extended ACL");
+    check.Expect(fstat(fd, &st) == 0 && (st.st_mode & 0777) == 0604, L"a minimal ACL is stored as the mode");
+    close(fd);
+    unlink(filePath.c_str());
+
+    std::string directoryPath = scratch + "/dir";
+    int dirFd = -1;
+    if (mkdir(directoryPath.c_str(), 0755) == 0) {
+        dirFd = open(directoryPath.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    }
+    if (dirFd < 0) {
+        check.Expect(false, L"a scratch directory can be created");
+        return true;
+    }
+    check.Expect(fsetxattr(dirFd, kAclDefaultXattr, encoded.data(), encoded.size(), 0) == 0 &&
+                 ReadAcl(dirFd, kAclDefaultXattr, read, err) && SameAcl(read, expected),
+                 L"a default ACL written as an xattr reads back unchanged");
+    check.Expect(fremovexattr(dirFd, kAclDefaultXattr) == 0 && !ReadAcl(dirFd, kAclDefaultXattr, read, err) &&
+                 err == ENODATA, L"a default ACL can be removed");
+    close(dirFd);
+    rmdir(directoryPath.c_str());
+    return true;
+}
+
+// Times writing an extended ACL and reading it back on options.files files
+void BenchmarkXattrs(const std::string& scratch, unsigned files) {
+    PosixAcl acl = MakeExtendedAcl();
+    std::vector<uint8_t> encoded = EncodePosixAcl(acl);
+
+    LatencyHistogram writes;
+    LatencyHistogram reads;
+    for (unsigned i = 0; i < files; i++) {
+        std::string path = scratch + "/f" + std::to_string(i);
+        int fd = open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+        if (fd < 0) {
+            PrintErrno(L"open", errno);
+            break;
+        }
+
+        Clock::time_point start = Clock::now();
+        int result = fsetxattr(fd, kAclAccessXattr, encoded.data(), encoded.size(), 0);
+        writes.Record(ElapsedNs(start));
+
+        PosixAcl read;
+        int err = 0;
+        start = Clock::now();
+        ReadAcl(fd, kAclAccessXattr, read, err);
+        reads.Record(ElapsedNs(start));
+
+        close(fd);
+        unlink(path.c_str());
+        if (result != 0) {
+            PrintErrno(L"fsetxattr", errno);
+            break;
+        }
+    }
+
+    writes.Print(std::wcout, L"fsetxattr (encode once, write)");
+    reads.Print(std::wcout, L"fgetxattr + decode");
+}
+
+bool ParseValue(const std::wstring& arg, const std::wstring& text, unsigned long max, unsigned& value) {
+    wchar_t* endPtr = nullptr;
+    unsigned long parsed = wcstoul(text.c_str(), &endPtr, 10);
+    if (text.empty() || *endPtr != L'\0' || parsed == 0 || parsed > max) {
+        std::wcerr << L"Invalid value for " << arg << L" (1-" << max << L"): " << text << L"\n";
+        return false;
+    }
+    value = static_cast<unsigned>(parsed);
+    return true;
+}
+
+}  // namespace
+
+bool ParsePosixAclBenchmarkOptions(const std::vector<std::wstring>& args, size_t first,
+                                   PosixAclBenchmarkOptions& options) {
+    for (size_t i = first; i < args.size(); i++) {
+        const std::wstring& arg = args[i];
+        bool hasValue = i + 1 < args.size();
+        if (arg == L"--dir" && hasValue) {
+            options.directory = args[++i];
+        } else if (arg == L"--files" && hasValue) {
+            if (!ParseValue(arg, args[++i], 1000000, options.files)) {
+                return false;
+            }
+        } else {
+            std::wcerr << L"Unknown benchmark option: " << arg << L"\n";
+            std::wcerr << L"Valid options: --dir <path>, --files <n>\n";
+            return false;
+        }
+    }
+    return true;
+}
+
+int RunPosixAclBenchmark(const PosixAclBenchmarkOptions& options) {
+    Checker check;
+    CheckCodec(check);
+
+    std::string base = options.directory.empty() ? std::string(getenv("TMPDIR") ? getenv("TMPDIR") : "/tmp")
+                                                 : ToNativePath(options.directory);
+    std::string scratch = base + "/acltool_acl_XXXXXX";
+    if (!mkdtemp(&scratch[0])) {
+        PrintErrno(L"mkdtemp", errno);
+        return 1;
+    }
+
+    std::wcout << L"POSIX ACLs: scratch directory " << FromNativePath(scratch) << L", " << options.files
+               << L" file(s)\n";
+    bool supported = CheckXattrs(check, scratch);
+    if (check.Failures()) {
+        rmdir(scratch.c_str());
+        std::wcerr << check.Failures() << L" check(s) failed\n";
+        return 1;
+    }
+    std::wcout << L"Codec" << (supported ? L" and xattr round trips" : L"") << L": all checks passed\n";
+
+    if (supported) {
+        BenchmarkXattrs(scratch, options.files);
+    }
+    rmdir(scratch.c_str());
+    return 0;
+}
@@ -0,0 +1,19 @@
+#pragma once
+#include <string>
+#include <vector>
+
+struct PosixAclBenchmarkOptions {
+    std::wstring directory;  // Where the scratch files go; the temp directory if empty
+    unsigned files = 1000;   // Files the ACL writes are timed on
+};
+
+// Parses [--dir <path>] [--files <n>] from args[first..]
+bool ParsePosixAclBenchmarkOptions(const std::vector<std::wstring>& args, size_t first,
+                                   PosixAclBenchmarkOptions& options);
+
+// Checks the POSIX ACL codec in memory (round trip, ordering, the kernel's
+// validity rules) and against real system.posix_acl_access/default xattrs
+// on scratch files, then times writing and reading ACLs through them.
+// A filesystem without ACL support skips the xattr checks. Returns 1 if any
+// check fails.
+int RunPosixAclBenchmark(const PosixAclBenchmarkOptions& options);
@@ -0,0 +1,21 @@
+#include "posix_common.h"
+#include "utf8.h"
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+
+void PrintErrno(const wchar_t* context, int err) {
+    std::wcerr << context << L" failed: " << err << L" (" << FromUtf8(std::strerror(err)) << L")\n";
+}
+
+void PrintErrno(const wchar_t* context) {
+    PrintErrno(context, errno);
+}
+
+std::string ToNativePath(const std::wstring& path) {
+    return ToUtf8(path);
+}
+
+std::wstring FromNativePath(const std::string& path) {
+    return FromUtf8(path);
+}
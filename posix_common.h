@@ -0,0 +1,13 @@
+#pragma once
+#include <string>
+
+// Helpers shared by the non-Windows backends
+
+// Prints "<context> failed: <errno> (<message>)", like PrintLastError does for Win32 errors
+void PrintErrno(const wchar_t* context, int err);
+void PrintErrno(const wchar_t* context);
+
+// Paths are passed around as std::wstring like on Windows, and converted to
+// the UTF-8 bytes the kernel expects at the syscall boundary
+std::string ToNativePath(const std::wstring& path);
+std::wstring FromNativePath(const std::string& path);
@@ -2,8 +2,9 @@
 #include <windows.h>
 #include <iostream>
 
-// Forward declaration
+// Forward declarations
 DWORD SetPrivilege(LPCWSTR privilegeName, bool enable);
+bool IsPrivilegeHeld(LPCWSTR privilegeName);
 
 // RAII class for managing privileges
 class PrivilegeGuard {
@@ -13,7 +14,12 @@ public:
         if (privilegeName_ == nullptr) {
             return;  // No privilege to enable
         }
-        
+        if (IsPrivilegeHeld(privilegeName_)) {
+            enabled_ = true;
+            held_ = true;
+            return;  // Already on for the life of the server (--serve)
+        }
+
         DWORD result = SetPrivilege(privilegeName_, true);
         if (result == ERROR_SUCCESS) {
             enabled_ = true;
@@ -24,7 +30,7 @@ public:
     }
 
     ~PrivilegeGuard() {
-        if (enabled_ && privilegeName_ != nullptr) {
+        if (enabled_ && !held_ && privilegeName_ != nullptr) {
             SetPrivilege(privilegeName_, false);
             std::wcout << L"<--Disabled privilege: " << privilegeName_ << L"\n";
         }
@@ -40,4 +46,5 @@ public:
 private:
     LPCWSTR privilegeName_;
     bool enabled_;
+    bool held_ = false;
 };
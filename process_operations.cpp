@@ -3,53 +3,366 @@
 
 #include "process_operations.h"
 #include "common.h"
+#include "latency_histogram.h"
 #include "privilege_guard.h"
+#include <algorithm>
+#include <chrono>
 #include <iostream>
+#include <iterator>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
 
 namespace {
 
-bool SetProcessAcl(HANDLE handle) {
-    return SetRestrictiveAcl(handle, SE_KERNEL_OBJECT, PROCESS_ALL_ACCESS, PROCESS_QUERY_INFORMATION);
+bool SetProcessAcl(HANDLE handle, bool verbose) {
+    return SetRestrictiveAcl(handle, SE_KERNEL_OBJECT, PROCESS_ALL_ACCESS, PROCESS_QUERY_INFORMATION, verbose);
 }
 
-}  // namespace
+const CommandSpec kProcessCommands[] = {
+    // name          desiredAccess            takeown restore
+    { L"terminate", PROCESS_TERMINATE,       false,  false },
+    { L"harden",    WRITE_DAC | WRITE_OWNER, false,  true  },  // restore: owner -> SYSTEM
+    { L"takeown",   WRITE_OWNER,             false,  false },
+    { L"weaken",    WRITE_DAC,               false,  false },
+};
 
-DWORD FindProcessByName(const std::wstring& processName) {
-    // Add .exe extension if not present
-    std::wstring searchName = processName;
-    if (searchName.length() < 4 || 
-        _wcsicmp(searchName.substr(searchName.length() - 4).c_str(), L".exe") != 0) {
-        searchName += L".exe";
+// Open callback for RunCommandChain; processHandle is replaced by the new open
+ChainOpenResult OpenProcessForChain(DWORD processId, DWORD desiredAccess, HANDLE& processHandle, bool verbose) {
+    if (processHandle) {
+        CloseHandle(processHandle);
+    }
+    if (verbose) {
+        std::wcout << L"Opening process: " << processId << L" with permissions: 0x" << std::hex << desiredAccess << std::dec << L"\n";
+    }
+
+    TraceSpan trace(TraceOp::Open, TraceObject::Process, std::to_wstring(processId), desiredAccess);
+    processHandle = OpenProcess(desiredAccess, FALSE, processId);
+    FinishTraceSpan(trace, processHandle != nullptr);
+    if (processHandle) {
+        return ChainOpenResult::Opened;
+    }
+    return GetLastError() == ERROR_ACCESS_DENIED ? ChainOpenResult::AccessDenied : ChainOpenResult::Failed;
+}
+
+bool RunProcessCommand(HANDLE processHandle, const std::wstring& command, bool verbose) {
+    bool success = false;
+    if (command == L"terminate") {
+        TraceSpan trace(TraceOp::ProcessControl, 1);
+        success = TerminateProcess(processHandle, 1) != 0;
+        FinishTraceSpan(trace, success);
+        if (success && verbose) {
+            std::wcout << L"Process terminated successfully\n";
+        } else if (!success) {
+            PrintLastError(L"TerminateProcess");
+        }
+    } else if (command == L"harden") {
+        success = SetProcessAcl(processHandle, verbose);
+        if (success && verbose) {
+            std::wcout << L"Process ACL hardened successfully\n";
+        }
+    } else if (command == L"takeown") {
+        DWORD result = TakeOwnership(processHandle, SE_KERNEL_OBJECT, verbose);
+        success = (result == ERROR_SUCCESS);
+        if (success && verbose) {
+            std::wcout << L"Process ownership transferred to Administrators\n";
+        }
+    } else if (command == L"weaken") {
+        success = WeakenAcl(processHandle, SE_KERNEL_OBJECT, PROCESS_ALL_ACCESS, verbose);
+        if (success && verbose) {
+            std::wcout << L"Process ACL weakened successfully (Everyone has full access)\n";
+        }
+    }
+    return success;
+}
+
+bool RunProcessChain(DWORD processId, const std::vector<const CommandSpec*>& chain, bool verbose) {
+    std::wstring processName = std::to_wstring(processId);
+    TraceContext traceContext(TraceObject::Process, processName);
+
+    HANDLE processHandle = nullptr;
+    ChainResult result = RunCommandChain(chain,
+        [&](uint32_t desiredAccess) { return OpenProcessForChain(processId, desiredAccess, processHandle, verbose); },
+        [&](const CommandSpec& spec) { return RunProcessCommand(processHandle, spec.name, verbose); });
+    if (result == ChainResult::OpenFailed) {
+        PrintLastError(L"OpenProcess");
+    }
+
+    if (processHandle) {
+        CloseHandle(processHandle);
+    }
+    return result == ChainResult::Succeeded;
+}
+
+uint64_t FileTimeToUInt64(const FILETIME& time) {
+    return (static_cast<uint64_t>(time.dwHighDateTime) << 32) | time.dwLowDateTime;
+}
+
+using NtSuspendResumeProcessFn = LONG (NTAPI*)(HANDLE processHandle);
+
+// Handles to every process in a --tree run, held until it is done. An open
+// handle keeps the process object, and with it the PID, from being reused,
+// so the chain can reopen each process by PID without reaching a newcomer.
+class ProcessPins {
+public:
+    // Processes this run suspended are resumed, whether or not the chain got to them
+    ~ProcessPins() {
+        for (auto& [pid, pin] : pins_) {
+            if (pin.suspended) {
+                ntResumeProcess_(pin.handle);
+            }
+            CloseHandle(pin.handle);
+        }
+    }
+
+    // Pins nodes [first, end) and records their creation time. Nodes that
+    // have exited, or whose PID was taken by a process created after the
+    // snapshot, are marked skip. Returns the number of nodes that could not
+    // be opened.
+    uint64_t Pin(ProcessSubtree& subtree, size_t first, uint64_t snapshotTime, uint64_t& gone) {
+        uint64_t failures = 0;
+        for (size_t i = first; i < subtree.nodes.size(); i++) {
+            ProcessSubtree::Node& node = subtree.nodes[i];
+            HANDLE handle = OpenProcess(PROCESS_QUERY_LIMITED_INFORMATION | SYNCHRONIZE | PROCESS_SUSPEND_RESUME, FALSE,
+                                        node.info.pid);
+            if (!handle && GetLastError() == ERROR_ACCESS_DENIED) {
+                // Protected processes can still be pinned, just not suspended
+                handle = OpenProcess(PROCESS_QUERY_LIMITED_INFORMATION | SYNCHRONIZE, FALSE, node.info.pid);
+            }
+            if (!handle) {
+                node.skip = true;
+                if (GetLastError() == ERROR_INVALID_PARAMETER) {
+                    gone++;  // No such process any more
+                } else {
+                    std::wcerr << L"Process " << node.info.pid << L" (" << node.info.name << L"): ";
+                    PrintLastError(L"OpenProcess");
+                    failures++;
+                }
+                continue;
+            }
+            pins_.emplace(node.info.pid, PinnedProcess{ handle });
+
+            FILETIME creation, exit, kernel, user;
+            if (!GetProcessTimes(handle, &creation, &exit, &kernel, &user) ||
+                FileTimeToUInt64(creation) > snapshotTime || WaitForSingleObject(handle, 0) == WAIT_OBJECT_0) {
+                node.skip = true;
+                gone++;
+                continue;
+            }
+            node.info.startTime = FileTimeToUInt64(creation);
+        }
+        return failures;
+    }
+
+    // Suspends nodes [first, end) in parents-before-children order, so a
+    // suspended parent's children are all in the next snapshot. Processes in
+    // spared are never suspended.
+    void Suspend(const ProcessSubtree& subtree, size_t first, const std::unordered_set<uint32_t>& spared) {
+        if (!ntSuspendProcess_ || !ntResumeProcess_) {
+            return;
+        }
+        for (size_t i = first; i < subtree.nodes.size(); i++) {
+            const ProcessSubtree::Node& node = subtree.nodes[i];
+            auto pin = pins_.find(node.info.pid);
+            if (node.skip || pin == pins_.end() || spared.count(node.info.pid)) {
+                continue;
+            }
+            pin->second.suspended = ntSuspendProcess_(pin->second.handle) >= 0;
+        }
+    }
+
+private:
+    struct PinnedProcess {
+        HANDLE handle;
+        bool suspended = false;
+    };
+
+    std::unordered_map<uint32_t, PinnedProcess> pins_;
+    // Not in the SDK headers; resolved from ntdll
+    NtSuspendResumeProcessFn ntSuspendProcess_ = reinterpret_cast<NtSuspendResumeProcessFn>(
+        GetProcAddress(GetModuleHandleW(L"ntdll.dll"), "NtSuspendProcess"));
+    NtSuspendResumeProcessFn ntResumeProcess_ = reinterpret_cast<NtSuspendResumeProcessFn>(
+        GetProcAddress(GetModuleHandleW(L"ntdll.dll"), "NtResumeProcess"));
+};
+
+// Processes a --tree freeze must not suspend: this one, the ones above it
+// (a suspended parent can be waiting on it, or be the shell it reports to)
+// and its console host, which would block every console write
+std::unordered_set<uint32_t> FindSparedProcesses(const std::vector<ProcessInfo>& snapshot) {
+    uint32_t self = GetCurrentProcessId();
+    std::vector<uint32_t> ancestors = FindAncestors(snapshot, self);
+    std::unordered_set<uint32_t> spared(ancestors.begin(), ancestors.end());
+    spared.insert(self);
+
+    if (HWND console = GetConsoleWindow()) {
+        DWORD consoleHost = 0;
+        if (GetWindowThreadProcessId(console, &consoleHost) && consoleHost) {
+            spared.insert(consoleHost);
+        }
+    }
+    // Under a pseudoconsole the window above belongs to someone else; the
+    // host is then a conhost/OpenConsole child of this process or a parent
+    for (const ProcessInfo& process : snapshot) {
+        if (spared.count(process.parentPid) && (_wcsicmp(process.name.c_str(), L"conhost.exe") == 0 ||
+                                                _wcsicmp(process.name.c_str(), L"OpenConsole.exe") == 0)) {
+            spared.insert(process.pid);
+        }
+    }
+    return spared;
+}
+
+bool ChainTerminates(const std::vector<const CommandSpec*>& chain) {
+    return std::any_of(chain.begin(), chain.end(), [](const CommandSpec* spec) {
+        return wcscmp(spec->name, L"terminate") == 0;
+    });
+}
+
+// --tree: one Toolhelp snapshot gives every process's parent and the subtree
+// is pinned. For terminate it is also suspended top down and rescanned until
+// no new child shows up; the chain then runs on it leaves first
+int ProcessProcessTree(DWORD rootPid, const std::vector<const CommandSpec*>& chain, const ProcessCommandOptions& options) {
+    auto start = std::chrono::steady_clock::now();
+
+    std::vector<ProcessInfo> snapshot;
+    if (!SnapshotProcesses(snapshot)) {
+        return 1;
+    }
+    // Anything created after this cannot be a process the snapshot listed
+    FILETIME now;
+    GetSystemTimeAsFileTime(&now);
+
+    ProcessSubtree subtree;
+    if (!BuildProcessSubtree(snapshot, rootPid, subtree)) {
+        std::wcerr << L"Process not found: " << rootPid << L"\n";
+        return 1;
     }
 
+    // Only terminate needs the tree to hold still. Without a freeze nothing
+    // stops it from growing, so the ACL commands act on the first snapshot.
+    bool freeze = ChainTerminates(chain);
+    std::unordered_set<uint32_t> spared = FindSparedProcesses(snapshot);
+
+    ProcessPins pins;
+    uint64_t gone = 0;
+    uint64_t failures = 0;
+    size_t reused = 0;
+    unsigned scans = 1;
+    for (size_t first = 0;;) {
+        failures += pins.Pin(subtree, first, FileTimeToUInt64(now), gone);
+        // Pin gives the new nodes their creation times, which show the ones
+        // that were never below the root; they are dropped before anything
+        // is suspended. Nodes before first already passed, so they keep
+        // their indices.
+        reused += subtree.RemoveReusedParents();
+        if (!freeze) {
+            break;
+        }
+        pins.Suspend(subtree, first, spared);
+        first = subtree.nodes.size();
+
+        if (!SnapshotProcesses(snapshot)) {
+            break;
+        }
+        GetSystemTimeAsFileTime(&now);
+        scans++;
+        if (subtree.AddNewDescendants(snapshot) == 0) {
+            break;
+        }
+    }
+
+    // Terminating this process mid-run would leave the rest of the tree suspended
+    for (ProcessSubtree::Node& node : subtree.nodes) {
+        if (freeze && !node.skip && node.info.pid == GetCurrentProcessId()) {
+            std::wcerr << L"Skipped: process " << node.info.pid << L" (" << node.info.name << L"), this process\n";
+            node.skip = true;
+        }
+    }
+
+    unsigned workers = options.workers ? options.workers : std::max(1u, std::thread::hardware_concurrency());
+    ConcurrencyLimit limit(DefaultConcurrencyLimit(TraceObject::Process, options.concurrency, workers));
+    std::mutex outputLock;
+    LeavesFirstResult result = RunLeavesFirst(subtree, workers, [&](size_t index) {
+        const ProcessInfo& process = subtree.nodes[index].info;
+        if (RunProcessChain(process.pid, chain, false)) {
+            return true;
+        }
+        std::lock_guard<std::mutex> guard(outputLock);
+        std::wcerr << L"Failed: process " << process.pid << L" (" << process.name << L")\n";
+        return false;
+    }, &limit);
+    failures += result.failed;
+
+    for (size_t index : result.blocked) {
+        const ProcessInfo& process = subtree.nodes[index].info;
+        std::wcerr << L"Skipped: process " << process.pid << L" (" << process.name
+                   << L"), a process below it failed\n";
+    }
+
+    auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start);
+    std::wcout << L"Processed " << subtree.nodes.size() << L" process(es) in the tree of PID " << rootPid
+               << L" (" << scans << L" scan(s), depth " << subtree.Depth() << L") in "
+               << FormatDuration(static_cast<uint64_t>(elapsed.count())) << L": " << failures << L" failed, "
+               << result.blocked.size() << L" blocked by a failed child, " << gone << L" already gone, "
+               << reused << L" dropped as not descendants (PID reused); " << limit.Describe() << L"\n";
+    return failures || !result.blocked.empty() ? 1 : 0;
+}
+
+}  // namespace
+
+bool SnapshotProcesses(std::vector<ProcessInfo>& processes) {
+    processes.clear();
+
     HANDLE snapshot = CreateToolhelp32Snapshot(TH32CS_SNAPPROCESS, 0);
     if (snapshot == INVALID_HANDLE_VALUE) {
         PrintLastError(L"CreateToolhelp32Snapshot");
-        return 0;
+        return false;
     }
 
     PROCESSENTRY32W entry = {};
     entry.dwSize = sizeof(entry);
 
-    DWORD foundPid = 0;
-    int matchCount = 0;
-
     if (Process32FirstW(snapshot, &entry)) {
         do {
-            if (_wcsicmp(entry.szExeFile, searchName.c_str()) == 0) {
-                foundPid = entry.th32ProcessID;
-                matchCount++;
-                if (matchCount > 1) {
-                    std::wcerr << L"Multiple processes found with name: " << searchName << L"\n";
-                    std::wcerr << L"Please specify a process ID instead\n";
-                    CloseHandle(snapshot);
-                    return 0;
-                }
-            }
+            ProcessInfo process;
+            process.pid = entry.th32ProcessID;
+            process.parentPid = entry.th32ParentProcessID;
+            process.name = entry.szExeFile;
+            processes.push_back(std::move(process));
         } while (Process32NextW(snapshot, &entry));
     }
 
     CloseHandle(snapshot);
+    return true;
+}
+
+uint32_t FindProcessByName(const std::wstring& processName) {
+    // Add .exe extension if not present
+    std::wstring searchName = processName;
+    if (searchName.length() < 4 || 
+        _wcsicmp(searchName.substr(searchName.length() - 4).c_str(), L".exe") != 0) {
+        searchName += L".exe";
+    }
+
+    std::vector<ProcessInfo> processes;
+    if (!SnapshotProcesses(processes)) {
+        return 0;
+    }
+
+    DWORD foundPid = 0;
+    int matchCount = 0;
+
+    for (const ProcessInfo& process : processes) {
+        if (_wcsicmp(process.name.c_str(), searchName.c_str()) == 0) {
+            foundPid = process.pid;
+            matchCount++;
+            if (matchCount > 1) {
+                std::wcerr << L"Multiple processes found with name: " << searchName << L"\n";
+                std::wcerr << L"Please specify a process ID instead\n";
+                return 0;
+            }
+        }
+    }
 
     if (matchCount == 0) {
         std::wcerr << L"Process not found: " << searchName << L"\n";
@@ -60,22 +373,9 @@ DWORD FindProcessByName(const std::wstring& processName) {
     return foundPid;
 }
 
-int ProcessProcessCommand(DWORD processId, const std::wstring& command) {
-    DWORD desiredAccess = 0;
-    bool requiresRestorePrivilege = false;
-    
-    if (command == L"terminate") {
-        desiredAccess = PROCESS_TERMINATE;
-    } else if (command == L"harden") {
-        desiredAccess = WRITE_DAC | WRITE_OWNER;
-        requiresRestorePrivilege = true; // Needed to set the owner to SYSTEM
-    } else if (command == L"takeown") {
-        desiredAccess = WRITE_OWNER;
-    } else if (command == L"weaken") {
-        desiredAccess = WRITE_DAC;
-    } else {
-        std::wcerr << L"Unknown process command: " << command << L"\n";
-        std::wcerr << L"Valid commands: terminate, harden, takeown, weaken\n";
+int ProcessProcessCommand(uint32_t processId, const std::wstring& command, const ProcessCommandOptions& options) {
+    std::vector<const CommandSpec*> chain;
+    if (!ParseCommandChain(command, L"process", kProcessCommands, std::size(kProcessCommands), chain)) {
         return 1;
     }
 
@@ -87,45 +387,48 @@ int ProcessProcessCommand(DWORD processId, const std::wstring& command) {
     }
 
     // Enable SE_RESTORE_NAME privilege if setting owner (allows setting arbitrary owners)
-    PrivilegeGuard restorePrivilegeGuard(requiresRestorePrivilege ? SE_RESTORE_NAME : nullptr);
+    PrivilegeGuard restorePrivilegeGuard(ChainRequiresRestorePrivilege(chain) ? SE_RESTORE_NAME : nullptr);
     if (restorePrivilegeGuard.IsValid() && !restorePrivilegeGuard.IsEnabled()) {
         return 1;  // Error message already printed by PrivilegeGuard
     }
 
-    std::wcout << L"Opening process: " << processId << L" with permissions: 0x" << std::hex << desiredAccess << std::dec << L"\n";
-
-    HANDLE processHandle = OpenProcess(desiredAccess, FALSE, processId);
-    if (!processHandle || processHandle == INVALID_HANDLE_VALUE) {
-        PrintLastError(L"OpenProcess");
-        return 1;
+    if (options.tree) {
+        return ProcessProcessTree(processId, chain, options);
     }
+    return RunProcessChain(processId, chain, true) ? 0 : 1;
+}
 
-    bool success = false;
-    if (command == L"terminate") {
-        success = TerminateProcess(processHandle, 1) != 0;
-        if (success) {
-            std::wcout << L"Process terminated successfully\n";
-        } else {
-            PrintLastError(L"TerminateProcess");
+uint64_t ProcessProcessBatch(const std::vector<const BatchItem*>& items) {
+    std::vector<std::vector<const CommandSpec*>> chains(items.size());
+    bool restore = false;
+    for (size_t i = 0; i < items.size(); i++) {
+        if (!ParseCommandChain(items[i]->commands, L"process", kProcessCommands, std::size(kProcessCommands), chains[i])) {
+            return items.size();
         }
-    } else if (command == L"harden") {
-        success = SetProcessAcl(processHandle);
-        if (success) {
-            std::wcout << L"Process ACL hardened successfully\n";
-        }
-    } else if (command == L"takeown") {
-        DWORD result = TakeOwnership(processHandle, SE_KERNEL_OBJECT);
-        success = (result == ERROR_SUCCESS);
-        if (success) {
-            std::wcout << L"Process ownership transferred to Administrators\n";
+        restore = restore || ChainRequiresRestorePrivilege(chains[i]);
+    }
+
+    PrivilegeGuard debugPrivilegeGuard(SE_DEBUG_NAME);
+    if (debugPrivilegeGuard.IsValid() && !debugPrivilegeGuard.IsEnabled()) {
+        return items.size();  // Error message already printed by PrivilegeGuard
+    }
+    PrivilegeGuard restorePrivilegeGuard(restore ? SE_RESTORE_NAME : nullptr);
+    if (restorePrivilegeGuard.IsValid() && !restorePrivilegeGuard.IsEnabled()) {
+        return items.size();  // Error message already printed by PrivilegeGuard
+    }
+
+    uint64_t failures = 0;
+    for (size_t i = 0; i < items.size(); i++) {
+        const std::wstring& target = items[i]->name;
+        wchar_t* endPtr = nullptr;
+        DWORD processId = wcstoul(target.c_str(), &endPtr, 10);
+        if (*endPtr != L'\0' || processId == 0) {
+            processId = FindProcessByName(target);
         }
-    } else if (command == L"weaken") {
-        success = WeakenAcl(processHandle, SE_KERNEL_OBJECT, PROCESS_ALL_ACCESS);
-        if (success) {
-            std::wcout << L"Process ACL weakened successfully (Everyone has full access)\n";
+        if (processId == 0 || !RunProcessChain(processId, chains[i], false)) {
+            std::wcerr << L"Failed: process " << target << L"\n";
+            failures++;
         }
     }
-
-    CloseHandle(processHandle);
-    return success ? 0 : 1;
+    return failures;
 }
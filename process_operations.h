@@ -1,8 +1,19 @@
 #pragma once
+#include <cstdint>
 #include <string>
-#include <windows.h>
+#include <vector>
+#include "batch_plan.h"
+#include "process_tree.h"
 
 // Find process ID by name. Returns 0 if not found or multiple matches exist.
-DWORD FindProcessByName(const std::wstring& processName);
+uint32_t FindProcessByName(const std::wstring& processName);
 
-int ProcessProcessCommand(DWORD processId, const std::wstring& command);
+// Lists every running process with its parent, from a single snapshot
+bool SnapshotProcesses(std::vector<ProcessInfo>& processes);
+
+int ProcessProcessCommand(uint32_t processId, const std::wstring& command,
+                          const ProcessCommandOptions& options = ProcessCommandOptions());
+
+// Runs the process items of a batch plan (PID or name each) in order.
+// Returns the number that failed.
+uint64_t ProcessProcessBatch(const std::vector<const BatchItem*>& items);
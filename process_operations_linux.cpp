@@ -0,0 +1,398 @@
+// Process backend for Linux, built on /proc and pidfds so --tree can be
+// exercised and benchmarked off Windows. Processes have no DACL or owner to
+// change here, so terminate is the only command.
+#include "process_operations.h"
+#include "command_chain.h"
+#include "latency_histogram.h"
+#include "posix_common.h"
+#include "trace.h"
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <csignal>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <iterator>
+#include <mutex>
+#include <thread>
+#include <unordered_set>
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+const CommandSpec kProcessCommands[] = {
+    { L"terminate", 0, false, false },
+};
+
+uint64_t ElapsedNs(Clock::time_point start) {
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count());
+}
+
+// Reads pid, parent, start time and name from <procfd>/<pid>/stat. Returns
+// false if the process is gone, or is a zombie: that has already exited and
+// can no longer have children of its own.
+bool ReadProcessStat(int procfd, uint32_t pid, ProcessInfo& process) {
+    char path[32];
+    snprintf(path, sizeof(path), "%u/stat", pid);
+    int fd = openat(procfd, path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return false;
+    }
+    char buffer[1024];
+    ssize_t length = read(fd, buffer, sizeof(buffer) - 1);
+    close(fd);
+    if (length <= 0) {
+        return false;
+    }
+    buffer[length] = '\0';
+
+    // "pid (comm) state ppid ..." - comm may itself contain spaces and ')'
+    char* open = strchr(buffer, '(');
+    char* closeParen = strrchr(buffer, ')');
+    if (!open || !closeParen || closeParen < open || closeParen[1] != ' ') {
+        return false;
+    }
+
+    // Fields after comm, starting with state (field 3); starttime is field 22
+    char* fields[20] = {};
+    int count = 0;
+    char* save = nullptr;
+    for (char* token = strtok_r(closeParen + 2, " ", &save); token && count < 20; token = strtok_r(nullptr, " ", &save)) {
+        fields[count++] = token;
+    }
+    if (count < 20 || fields[0][0] == 'Z' || fields[0][0] == 'X') {
+        return false;
+    }
+
+    process.pid = pid;
+    process.parentPid = static_cast<uint32_t>(strtoul(fields[1], nullptr, 10));
+    process.startTime = strtoull(fields[19], nullptr, 10);
+    process.name = FromNativePath(std::string(open + 1, closeParen));
+    return true;
+}
+
+int OpenProcDirectory() {
+    int procfd = open("/proc", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (procfd < 0) {
+        PrintErrno(L"open(/proc)");
+    }
+    return procfd;
+}
+
+int PidfdOpen(uint32_t pid) {
+    return static_cast<int>(syscall(SYS_pidfd_open, static_cast<pid_t>(pid), 0));
+}
+
+int PidfdSendSignal(int pidfd, int signal) {
+    return static_cast<int>(syscall(SYS_pidfd_send_signal, pidfd, signal, nullptr, 0));
+}
+
+// pidfds for every process in a run. A pidfd refers to one process for its
+// whole life, so once the start time has been checked against the snapshot
+// a signal sent through it cannot reach a later process that reused the PID.
+class ProcessPins {
+public:
+    // Processes this run stopped and did not kill are let go again
+    ~ProcessPins() {
+        for (size_t i = 0; i < pidfds_.size(); i++) {
+            if (pidfds_[i] < 0) {
+                continue;
+            }
+            if (stopped_[i]) {
+                PidfdSendSignal(pidfds_[i], SIGCONT);
+            }
+            close(pidfds_[i]);
+        }
+    }
+
+    // Pins nodes [first, end). Marks nodes that have exited or whose PID was
+    // reused as skip. Returns the number that could not be opened for
+    // another reason.
+    uint64_t Pin(int procfd, ProcessSubtree& subtree, size_t first, uint64_t& gone) {
+        uint64_t failures = 0;
+        pidfds_.resize(subtree.nodes.size(), -1);
+        stopped_.resize(subtree.nodes.size(), false);
+        for (size_t i = first; i < subtree.nodes.size(); i++) {
+            ProcessSubtree::Node& node = subtree.nodes[i];
+            int pidfd = PidfdOpen(node.info.pid);
+            if (pidfd < 0) {
+                node.skip = true;
+                if (errno == ESRCH) {
+                    gone++;
+                } else {
+                    std::wcerr << L"Process " << node.info.pid << L" (" << node.info.name << L"): ";
+                    PrintErrno(L"pidfd_open");
+                    failures++;
+                }
+                continue;
+            }
+            pidfds_[i] = pidfd;
+
+            ProcessInfo current;
+            if (!ReadProcessStat(procfd, node.info.pid, current) || current.startTime != node.info.startTime) {
+                node.skip = true;
+                gone++;
+            }
+        }
+        return failures;
+    }
+
+    // SIGSTOPs nodes [first, end) in parents-before-children order. fork()
+    // fails once a stop is pending, so a stopped parent's children are all
+    // in the next snapshot. Processes in spared are never stopped.
+    void Stop(const ProcessSubtree& subtree, size_t first, const std::unordered_set<uint32_t>& spared) {
+        for (size_t i = first; i < subtree.nodes.size(); i++) {
+            if (!subtree.nodes[i].skip && !spared.count(subtree.nodes[i].info.pid)) {
+                stopped_[i] = PidfdSendSignal(pidfds_[i], SIGSTOP) == 0;
+            }
+        }
+    }
+
+    int Pidfd(size_t index) const { return pidfds_[index]; }
+
+private:
+    std::vector<int> pidfds_;
+    std::vector<bool> stopped_;
+};
+
+bool TerminatePinned(const ProcessInfo& process, int pidfd) {
+    TraceSpan trace(TraceOp::ProcessControl, TraceObject::Process, std::to_wstring(process.pid), 1);
+    int err = PidfdSendSignal(pidfd, SIGKILL) < 0 ? errno : 0;
+    trace.Finish(static_cast<uint32_t>(err));
+
+    // ESRCH: exited on its own since it was pinned
+    return err == 0 || err == ESRCH;
+}
+
+}  // namespace
+
+bool SnapshotProcesses(std::vector<ProcessInfo>& processes) {
+    processes.clear();
+
+    int procfd = OpenProcDirectory();
+    if (procfd < 0) {
+        return false;
+    }
+    DIR* dir = fdopendir(dup(procfd));
+    if (!dir) {
+        PrintErrno(L"opendir(/proc)");
+        close(procfd);
+        return false;
+    }
+
+    while (dirent* entry = readdir(dir)) {
+        char* end = nullptr;
+        unsigned long pid = strtoul(entry->d_name, &end, 10);
+        if (*end != '\0' || pid == 0) {
+            continue;  // Not a process directory
+        }
+        ProcessInfo process;
+        if (ReadProcessStat(procfd, static_cast<uint32_t>(pid), process)) {
+            processes.push_back(std::move(process));
+        }
+    }
+
+    closedir(dir);
+    close(procfd);
+    return true;
+}
+
+uint32_t FindProcessByName(const std::wstring& processName) {
+    std::vector<ProcessInfo> processes;
+    if (!SnapshotProcesses(processes)) {
+        return 0;
+    }
+
+    uint32_t foundPid = 0;
+    int matchCount = 0;
+    for (const ProcessInfo& process : processes) {
+        if (process.name == processName) {
+            foundPid = process.pid;
+            if (++matchCount > 1) {
+                std::wcerr << L"Multiple processes found with name: " << processName << L"\n";
+                std::wcerr << L"Please specify a process ID instead\n";
+                return 0;
+            }
+        }
+    }
+
+    if (matchCount == 0) {
+        std::wcerr << L"Process not found: " << processName << L"\n";
+        return 0;
+    }
+
+    std::wcout << L"Found process: " << processName << L" (PID: " << foundPid << L")\n";
+    return foundPid;
+}
+
+int ProcessProcessCommand(uint32_t processId, const std::wstring& command, const ProcessCommandOptions& options) {
+    std::vector<const CommandSpec*> chain;
+    if (!ParseCommandChain(command, L"process", kProcessCommands, std::size(kProcessCommands), chain)) {
+        return 1;
+    }
+
+    int procfd = OpenProcDirectory();
+    if (procfd < 0) {
+        return 1;
+    }
+
+    // One /proc pass gives every parent link; the start times it records
+    // are what the pins are checked against
+    Clock::time_point start = Clock::now();
+    ProcessSubtree subtree;
+    std::unordered_set<uint32_t> spared;
+    bool found = false;
+    if (options.tree) {
+        std::vector<ProcessInfo> snapshot;
+        found = SnapshotProcesses(snapshot) && BuildProcessSubtree(snapshot, processId, subtree);
+
+        // Stopping this process or one above it (the shell waiting on it,
+        // the terminal it writes to) would stall the run
+        uint32_t self = static_cast<uint32_t>(getpid());
+        std::vector<uint32_t> ancestors = FindAncestors(snapshot, self);
+        spared.insert(ancestors.begin(), ancestors.end());
+        spared.insert(self);
+    } else {
+        ProcessInfo process;
+        found = ReadProcessStat(procfd, processId, process);
+        subtree.nodes.push_back(ProcessSubtree::Node{ process });
+    }
+    if (!found) {
+        std::wcerr << L"Process not found: " << processId << L"\n";
+        close(procfd);
+        return 1;
+    }
+    uint64_t snapshotNs = ElapsedNs(start);
+
+    // Children forked between the snapshot and the stop are not in the
+    // subtree yet, so it is pinned and stopped top down and /proc scanned
+    // again until a scan finds nothing new. /proc gives start times up
+    // front, so nodes whose parent PID was reused are dropped before they
+    // are pinned or stopped; nodes before first already passed and keep
+    // their indices.
+    Clock::time_point freezeStart = Clock::now();
+    ProcessPins pins;
+    uint64_t gone = 0;
+    uint64_t failures = 0;
+    size_t reused = 0;
+    unsigned scans = 1;
+    for (size_t first = 0;;) {
+        reused += subtree.RemoveReusedParents();
+        failures += pins.Pin(procfd, subtree, first, gone);
+        if (!options.tree) {
+            break;
+        }
+        pins.Stop(subtree, first, spared);
+        first = subtree.nodes.size();
+
+        std::vector<ProcessInfo> snapshot;
+        if (!SnapshotProcesses(snapshot)) {
+            break;
+        }
+        scans++;
+        if (subtree.AddNewDescendants(snapshot) == 0) {
+            break;
+        }
+    }
+    close(procfd);
+    uint64_t freezeNs = ElapsedNs(freezeStart);
+
+    // Killing this process mid-run would leave the rest of the tree stopped
+    uint64_t leftOut = 0;
+    for (ProcessSubtree::Node& node : subtree.nodes) {
+        if (options.tree && !node.skip && node.info.pid == static_cast<uint32_t>(getpid())) {
+            std::wcerr << L"Process " << node.info.pid << L" (" << node.info.name
+                       << L"): not terminated, it is this process\n";
+            node.skip = true;
+            leftOut++;
+        }
+    }
+
+    Clock::time_point actStart = Clock::now();
+    unsigned workers = options.workers ? options.workers : std::max(1u, std::thread::hardware_concurrency());
+    ConcurrencyLimit limit(DefaultConcurrencyLimit(TraceObject::Process, options.concurrency, workers));
+    std::mutex outputLock;
+    LeavesFirstResult result = RunLeavesFirst(subtree, workers, [&](size_t index) {
+        const ProcessInfo& process = subtree.nodes[index].info;
+        if (TerminatePinned(process, pins.Pidfd(index))) {
+            return true;
+        }
+        std::lock_guard<std::mutex> guard(outputLock);
+        std::wcerr << L"Process " << process.pid << L" (" << process.name << L"): ";
+        PrintErrno(L"pidfd_send_signal");
+        return false;
+    }, &limit);
+    uint64_t actNs = ElapsedNs(actStart);
+    failures += result.failed;
+
+    if (!options.tree) {
+        if (failures == 0 && gone == 0) {
+            std::wcout << L"Process terminated successfully\n";
+        } else if (gone) {
+            std::wcerr << L"Process " << processId << L" exited before it could be terminated\n";
+        }
+        return failures || gone ? 1 : 0;
+    }
+
+    for (size_t index : result.blocked) {
+        const ProcessInfo& process = subtree.nodes[index].info;
+        std::wcerr << L"Process " << process.pid << L" (" << process.name
+                   << L"): not terminated, a process below it could not be\n";
+    }
+
+    uint64_t terminated = subtree.nodes.size() - gone - failures - result.blocked.size() - leftOut;
+    std::wcout << L"Terminated " << terminated << L" process(es) in the tree of PID " << processId
+               << L" (" << subtree.nodes.size() << L" found in " << scans << L" scan(s), depth " << subtree.Depth()
+               << L") in " << FormatDuration(snapshotNs + freezeNs + actNs) << L": snapshot "
+               << FormatDuration(snapshotNs) << L", freeze " << FormatDuration(freezeNs) << L", terminate "
+               << FormatDuration(actNs) << L"\n";
+    std::wcout << L"  " << failures << L" failed, " << result.blocked.size() << L" blocked by a failed child, "
+               << gone << L" already gone, " << reused << L" dropped as not descendants (PID reused); "
+               << limit.Describe() << L"\n";
+    return failures || !result.blocked.empty() ? 1 : 0;
+}
+
+uint64_t ProcessProcessBatch(const std::vector<const BatchItem*>& items) {
+    for (const BatchItem* item : items) {
+        std::vector<const CommandSpec*> chain;
+        if (!ParseCommandChain(item->commands, L"process", kProcessCommands, std::size(kProcessCommands), chain)) {
+            return items.size();
+        }
+    }
+
+    int procfd = OpenProcDirectory();
+    if (procfd < 0) {
+        return items.size();
+    }
+
+    uint64_t failures = 0;
+    for (const BatchItem* item : items) {
+        const std::wstring& target = item->name;
+        wchar_t* endPtr = nullptr;
+        unsigned long processId = wcstoul(target.c_str(), &endPtr, 10);
+        if (*endPtr != L'\0' || processId == 0) {
+            processId = FindProcessByName(target);
+        }
+
+        // terminate is the only command, so the chain is just that
+        ProcessInfo process;
+        int pidfd = processId ? PidfdOpen(static_cast<uint32_t>(processId)) : -1;
+        bool success = pidfd >= 0 && ReadProcessStat(procfd, static_cast<uint32_t>(processId), process) &&
+                       TerminatePinned(process, pidfd);
+        if (pidfd >= 0) {
+            close(pidfd);
+        }
+        if (!success) {
+            std::wcerr << L"Failed: process " << target << L"\n";
+            failures++;
+        }
+    }
+    close(procfd);
+    return failures;
+}
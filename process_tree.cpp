@@ -0,0 +1,305 @@
+#include "process_tree.h"
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cwchar>
+#include <iostream>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+
+namespace {
+
+bool StartedAfter(const ProcessInfo& a, const ProcessInfo& b) {
+    return a.startTime && b.startTime && a.startTime > b.startTime;
+}
+
+template <typename Action>
+bool RunLimited(ConcurrencyLimit* limit, Action action) {
+    if (!limit) {
+        return action();
+    }
+    limit->Acquire();
+    auto start = std::chrono::steady_clock::now();
+    bool succeeded = action();
+    auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start);
+    limit->Release(static_cast<uint64_t>(elapsed.count()), !succeeded);
+    return succeeded;
+}
+
+}  // namespace
+
+size_t ProcessSubtree::RemoveReusedParents() {
+    // Nodes that are skipped or have no start time can't vouch for their
+    // children, so each node is checked against its nearest ancestor that can
+    std::vector<size_t> anchor(nodes.size(), kNoParentNode);
+    std::vector<size_t> newIndex(nodes.size(), kNoParentNode);
+    std::vector<Node> kept;
+    kept.reserve(nodes.size());
+
+    for (size_t i = 0; i < nodes.size(); i++) {
+        Node& node = nodes[i];
+        size_t parentAnchor = kNoParentNode;
+        if (node.parent != kNoParentNode) {
+            if (newIndex[node.parent] == kNoParentNode) {
+                continue;  // Parent was removed
+            }
+            parentAnchor = anchor[node.parent];
+            if (parentAnchor != kNoParentNode && StartedAfter(nodes[parentAnchor].info, node.info)) {
+                continue;
+            }
+        }
+
+        anchor[i] = (!node.skip && node.info.startTime) ? i : parentAnchor;
+        newIndex[i] = kept.size();
+        kept.push_back(node);
+        kept.back().parent = node.parent == kNoParentNode ? kNoParentNode : newIndex[node.parent];
+        kept.back().children = 0;
+    }
+
+    for (Node& node : kept) {
+        if (node.parent != kNoParentNode) {
+            kept[node.parent].children++;
+        }
+    }
+
+    size_t removed = nodes.size() - kept.size();
+    nodes = std::move(kept);
+    return removed;
+}
+
+unsigned ProcessSubtree::Depth() const {
+    std::vector<unsigned> depth(nodes.size(), 1);
+    unsigned deepest = nodes.empty() ? 0 : 1;
+    for (size_t i = 1; i < nodes.size(); i++) {
+        depth[i] = depth[nodes[i].parent] + 1;
+        deepest = std::max(deepest, depth[i]);
+    }
+    return deepest;
+}
+
+size_t ProcessSubtree::AddNewDescendants(const std::vector<ProcessInfo>& snapshot) {
+    // Without start times (Windows snapshots) a PID that is already a node is
+    // taken to be that node; pinned processes keep their PIDs
+    auto sameProcess = [](const ProcessInfo& node, const ProcessInfo& process) {
+        return node.pid == process.pid &&
+               (!node.startTime || !process.startTime || node.startTime == process.startTime);
+    };
+
+    std::unordered_map<uint32_t, std::vector<size_t>> byPid;
+    for (size_t i = 0; i < nodes.size(); i++) {
+        byPid[nodes[i].info.pid].push_back(i);
+    }
+    auto findNode = [&](const ProcessInfo& process) {
+        auto found = byPid.find(process.pid);
+        if (found != byPid.end()) {
+            for (size_t index : found->second) {
+                if (sameProcess(nodes[index].info, process)) {
+                    return index;
+                }
+            }
+        }
+        return kNoParentNode;
+    };
+
+    std::unordered_map<uint32_t, std::vector<size_t>> children;
+    for (size_t i = 0; i < snapshot.size(); i++) {
+        if (snapshot[i].parentPid != snapshot[i].pid) {
+            children[snapshot[i].parentPid].push_back(i);
+        }
+    }
+
+    // Breadth first from every existing node, so new parents still land
+    // before their new children
+    size_t added = 0;
+    for (size_t next = 0; next < nodes.size(); next++) {
+        auto found = children.find(nodes[next].info.pid);
+        if (found == children.end()) {
+            continue;
+        }
+        for (size_t child : found->second) {
+            const ProcessInfo& process = snapshot[child];
+            if (StartedAfter(nodes[next].info, process) || findNode(process) != kNoParentNode) {
+                continue;
+            }
+            Node node{ process };
+            node.parent = next;
+            nodes[next].children++;
+            byPid[process.pid].push_back(nodes.size());
+            nodes.push_back(std::move(node));
+            added++;
+        }
+    }
+    return added;
+}
+
+std::vector<uint32_t> FindAncestors(const std::vector<ProcessInfo>& snapshot, uint32_t pid) {
+    std::unordered_map<uint32_t, uint32_t> parents;
+    for (const ProcessInfo& process : snapshot) {
+        parents.emplace(process.pid, process.parentPid);
+    }
+
+    std::vector<uint32_t> ancestors;
+    std::unordered_set<uint32_t> seen = { pid };
+    for (auto found = parents.find(pid); found != parents.end(); found = parents.find(found->second)) {
+        if (found->second == 0 || !seen.insert(found->second).second) {
+            break;
+        }
+        ancestors.push_back(found->second);
+    }
+    return ancestors;
+}
+
+bool BuildProcessSubtree(const std::vector<ProcessInfo>& snapshot, uint32_t rootPid, ProcessSubtree& subtree) {
+    subtree.nodes.clear();
+
+    std::unordered_map<uint32_t, size_t> byPid;
+    byPid.reserve(snapshot.size());
+    for (size_t i = 0; i < snapshot.size(); i++) {
+        byPid.emplace(snapshot[i].pid, i);
+    }
+
+    auto root = byPid.find(rootPid);
+    if (root == byPid.end()) {
+        return false;
+    }
+
+    std::unordered_map<uint32_t, std::vector<size_t>> children;
+    for (size_t i = 0; i < snapshot.size(); i++) {
+        const ProcessInfo& process = snapshot[i];
+        if (process.parentPid == process.pid) {
+            continue;  // The idle / swapper process lists itself as parent
+        }
+        auto parent = byPid.find(process.parentPid);
+        if (parent != byPid.end() && StartedAfter(snapshot[parent->second], process)) {
+            continue;  // Parent exited and its PID was reused by a newer process
+        }
+        children[process.parentPid].push_back(i);
+    }
+
+    // Breadth first, so every parent lands before its children. Without start
+    // times PID reuse can produce cycles; a process is only taken once.
+    std::unordered_set<uint32_t> visited{ rootPid };
+    subtree.nodes.push_back(ProcessSubtree::Node{ snapshot[root->second] });
+    for (size_t next = 0; next < subtree.nodes.size(); next++) {
+        auto found = children.find(subtree.nodes[next].info.pid);
+        if (found == children.end()) {
+            continue;
+        }
+        for (size_t child : found->second) {
+            if (!visited.insert(snapshot[child].pid).second) {
+                continue;
+            }
+            ProcessSubtree::Node node{ snapshot[child] };
+            node.parent = next;
+            subtree.nodes[next].children++;
+            subtree.nodes.push_back(std::move(node));
+        }
+    }
+    return true;
+}
+
+LeavesFirstResult RunLeavesFirst(const ProcessSubtree& subtree, unsigned workers,
+                                 const std::function<bool(size_t)>& action, ConcurrencyLimit* limit) {
+    LeavesFirstResult result;
+    const size_t count = subtree.nodes.size();
+    if (count == 0) {
+        return result;
+    }
+
+    std::mutex lock;
+    std::condition_variable readyChanged;
+    std::vector<size_t> ready;
+    std::vector<size_t> pending(count);
+    std::vector<bool> blocked(count);  // Something below the node failed
+    size_t finished = 0;
+
+    for (size_t i = 0; i < count; i++) {
+        pending[i] = subtree.nodes[i].children;
+        if (pending[i] == 0) {
+            ready.push_back(i);
+        }
+    }
+
+    auto worker = [&] {
+        std::unique_lock<std::mutex> guard(lock);
+        for (;;) {
+            readyChanged.wait(guard, [&] { return !ready.empty() || finished == count; });
+            if (ready.empty()) {
+                return;
+            }
+            size_t index = ready.back();
+            ready.pop_back();
+
+            const ProcessSubtree::Node& node = subtree.nodes[index];
+            bool succeeded = false;
+            if (blocked[index]) {
+                if (!node.skip) {
+                    result.blocked.push_back(index);
+                }
+            } else {
+                guard.unlock();
+                succeeded = node.skip || RunLimited(limit, [&] { return action(index); });
+                guard.lock();
+                if (!succeeded) {
+                    result.failed++;
+                }
+            }
+
+            finished++;
+            if (node.parent != kNoParentNode && !succeeded) {
+                blocked[node.parent] = true;
+            }
+            if (node.parent != kNoParentNode && --pending[node.parent] == 0) {
+                ready.push_back(node.parent);
+                readyChanged.notify_one();
+            }
+            if (finished == count) {
+                readyChanged.notify_all();
+            }
+        }
+    };
+
+    if (workers == 0) {
+        workers = std::max(1u, std::thread::hardware_concurrency());
+    }
+    workers = static_cast<unsigned>(std::min<size_t>(workers, count));
+
+    std::vector<std::thread> threads;
+    for (unsigned i = 1; i < workers; i++) {
+        threads.emplace_back(worker);
+    }
+    worker();
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    return result;
+}
+
+bool ParseProcessCommandOptions(const std::vector<std::wstring>& args, size_t first, ProcessCommandOptions& options) {
+    for (size_t i = first; i < args.size(); i++) {
+        const std::wstring& arg = args[i];
+        if (arg == L"--tree") {
+            options.tree = true;
+        } else if (arg == L"--workers" && i + 1 < args.size()) {
+            const std::wstring& text = args[++i];
+            wchar_t* endPtr = nullptr;
+            unsigned long workers = wcstoul(text.c_str(), &endPtr, 10);
+            if (text.empty() || *endPtr != L'\0' || workers == 0 || workers > 1024) {
+                std::wcerr << L"Invalid value for --workers (1-1024): " << text << L"\n";
+                return false;
+            }
+            options.workers = static_cast<unsigned>(workers);
+        } else if (arg == L"--concurrency" && i + 1 < args.size()) {
+            if (!ParseConcurrencyPolicy(args[++i], options.concurrency)) {
+                return false;
+            }
+        } else {
+            std::wcerr << L"Unknown process option: " << arg << L"\n";
+            std::wcerr << L"Valid options: --tree, --workers <n>, --concurrency <fixed|aimd|gradient>\n";
+            return false;
+        }
+    }
+    return true;
+}
@@ -0,0 +1,78 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+#include "concurrency_limit.h"
+
+// One process as listed by a snapshot (Toolhelp on Windows, /proc on Linux)
+struct ProcessInfo {
+    uint32_t pid = 0;
+    uint32_t parentPid = 0;
+    uint64_t startTime = 0;  // FILETIME on Windows, clock ticks since boot on Linux; 0 if not known yet
+    std::wstring name;
+};
+
+const size_t kNoParentNode = static_cast<size_t>(-1);
+
+// A process and everything below it, cut from one snapshot. Nodes are in
+// parents-before-children order and node 0 is the root.
+struct ProcessSubtree {
+    struct Node {
+        ProcessInfo info;
+        size_t parent = kNoParentNode;
+        size_t children = 0;
+        bool skip = false;  // Exited, or its PID now names another process; its children are still acted on
+    };
+
+    std::vector<Node> nodes;
+
+    // Drops every node whose recorded parent started after it, with its
+    // descendants: the parent PID had been reused, so they were never below
+    // the root. Only nodes with known start times are checked. Returns the
+    // number of nodes removed.
+    size_t RemoveReusedParents();
+
+    // Appends the processes of a later snapshot that are not nodes yet but
+    // whose parent is, with their descendants, keeping parents-before-children
+    // order. Nodes that have left the snapshot are kept. Returns the number of
+    // nodes added.
+    size_t AddNewDescendants(const std::vector<ProcessInfo>& snapshot);
+
+    unsigned Depth() const;
+};
+
+// Builds the parent/child graph of a snapshot and cuts out rootPid's
+// subtree. Returns false if rootPid is not in the snapshot.
+bool BuildProcessSubtree(const std::vector<ProcessInfo>& snapshot, uint32_t rootPid, ProcessSubtree& subtree);
+
+// The parents above pid in a snapshot, nearest first. Stops at a PID the
+// snapshot doesn't list or that is already in the chain (a parent PID can
+// have been reused by a later process).
+std::vector<uint32_t> FindAncestors(const std::vector<ProcessInfo>& snapshot, uint32_t pid);
+
+struct LeavesFirstResult {
+    uint64_t failed = 0;
+    // Nodes not acted on because an action below them failed: that child is
+    // still running under them, and acting on the parent would orphan it
+    std::vector<size_t> blocked;
+};
+
+// Runs action(node index) for every node not marked skip, leaves first: a
+// process is only acted on once all of its children have been, so a parent
+// is never terminated while it still has children to be found under it
+// (they would be re-parented away from the tree). Independent branches run
+// in parallel on up to `workers` threads (0 = one per CPU), of which at most
+// limit's current limit act at once when one is given.
+LeavesFirstResult RunLeavesFirst(const ProcessSubtree& subtree, unsigned workers,
+                                 const std::function<bool(size_t)>& action, ConcurrencyLimit* limit = nullptr);
+
+struct ProcessCommandOptions {
+    bool tree = false;     // Act on the process and all of its descendants
+    unsigned workers = 0;  // Most threads for --tree, 0 = one per CPU
+    ConcurrencyPolicy concurrency = ConcurrencyPolicy::Gradient;  // How many of them act at once
+};
+
+// Parses [--tree] [--workers <n>] [--concurrency <policy>] after the command
+bool ParseProcessCommandOptions(const std::vector<std::wstring>& args, size_t first, ProcessCommandOptions& options);
@@ -0,0 +1,173 @@
+#include "process_tree_benchmark.h"
+#include "latency_histogram.h"
+#include "posix_common.h"
+#include "process_operations.h"
+#include <sys/prctl.h>
+#include <sys/wait.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+#include <chrono>
+#include <csignal>
+#include <cwchar>
+#include <iostream>
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+const char kNodeReady = 'R';
+const char kNodeFailed = 'F';
+
+uint64_t ElapsedNs(Clock::time_point start) {
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count());
+}
+
+// Body of every process in the tree: fork this node's children (node i has
+// children i * fanout + 1 .. i * fanout + fanout), report in, then idle
+// until killed. Never returns to the caller's stack.
+[[noreturn]] void RunTreeNode(unsigned long index, const ProcessTreeBenchmarkOptions& options, int readyFd) {
+    char status = kNodeReady;
+    for (unsigned c = 1; c <= options.fanout; c++) {
+        unsigned long child = index * options.fanout + c;
+        if (child >= options.processes) {
+            break;
+        }
+        pid_t pid = fork();
+        if (pid == 0) {
+            RunTreeNode(child, options, readyFd);
+        }
+        if (pid < 0) {
+            status = kNodeFailed;
+            break;
+        }
+    }
+
+    if (write(readyFd, &status, 1) != 1) {
+        _exit(1);
+    }
+    for (;;) {
+        pause();
+    }
+}
+
+bool ParseValue(const std::wstring& arg, const std::wstring& text, unsigned long max, unsigned& value) {
+    wchar_t* endPtr = nullptr;
+    unsigned long parsed = wcstoul(text.c_str(), &endPtr, 10);
+    if (text.empty() || *endPtr != L'\0' || parsed == 0 || parsed > max) {
+        std::wcerr << L"Invalid value for " << arg << L" (1-" << max << L"): " << text << L"\n";
+        return false;
+    }
+    value = static_cast<unsigned>(parsed);
+    return true;
+}
+
+}  // namespace
+
+bool ParseProcessTreeBenchmarkOptions(const std::vector<std::wstring>& args, size_t first,
+                                      ProcessTreeBenchmarkOptions& options) {
+    for (size_t i = first; i < args.size(); i++) {
+        const std::wstring& arg = args[i];
+        bool hasValue = i + 1 < args.size();
+        if (arg == L"--processes" && hasValue) {
+            if (!ParseValue(arg, args[++i], 100000, options.processes)) {
+                return false;
+            }
+        } else if (arg == L"--fanout" && hasValue) {
+            if (!ParseValue(arg, args[++i], 10000, options.fanout)) {
+                return false;
+            }
+        } else if (arg == L"--workers" && hasValue) {
+            if (!ParseValue(arg, args[++i], 1024, options.workers)) {
+                return false;
+            }
+        } else {
+            std::wcerr << L"Unknown benchmark option: " << arg << L"\n";
+            std::wcerr << L"Valid options: --processes <n>, --fanout <n>, --workers <n>\n";
+            return false;
+        }
+    }
+    return true;
+}
+
+int RunProcessTreeBenchmark(const ProcessTreeBenchmarkOptions& options) {
+    // Orphans are re-parented to us rather than to init as their parents are
+    // killed, so every process in the tree can be reaped and counted here
+    if (prctl(PR_SET_CHILD_SUBREAPER, 1) != 0) {
+        PrintErrno(L"prctl(PR_SET_CHILD_SUBREAPER)");
+        return 1;
+    }
+
+    int readyPipe[2];
+    if (pipe2(readyPipe, O_CLOEXEC) != 0) {
+        PrintErrno(L"pipe2");
+        return 1;
+    }
+
+    std::wcout << L"Spawning " << options.processes << L" processes, fanout " << options.fanout << L"\n";
+    std::wcout.flush();
+
+    Clock::time_point spawnStart = Clock::now();
+    pid_t root = fork();
+    if (root == 0) {
+        close(readyPipe[0]);
+        setpgid(0, 0);  // One group, so a failed run can be cleaned up in one kill
+        RunTreeNode(0, options, readyPipe[1]);
+    }
+    close(readyPipe[1]);
+    if (root < 0) {
+        PrintErrno(L"fork");
+        close(readyPipe[0]);
+        return 1;
+    }
+    setpgid(root, root);
+
+    unsigned ready = 0;
+    bool spawnFailed = false;
+    while (ready < options.processes) {
+        char status;
+        ssize_t result = read(readyPipe[0], &status, 1);
+        if (result < 0 && errno == EINTR) {
+            continue;
+        }
+        if (result != 1 || status != kNodeReady) {
+            spawnFailed = true;
+            break;
+        }
+        ready++;
+    }
+    close(readyPipe[0]);
+
+    int result = 1;
+    if (spawnFailed) {
+        std::wcerr << L"Only " << ready << L" of " << options.processes
+                   << L" processes started (fork failed; check ulimit -u and pid_max)\n";
+    } else {
+        std::wcout << L"Spawned in " << FormatDuration(ElapsedNs(spawnStart)) << L", root PID " << root << L"\n";
+
+        ProcessCommandOptions commandOptions;
+        commandOptions.tree = true;
+        commandOptions.workers = options.workers;
+
+        Clock::time_point terminateStart = Clock::now();
+        result = ProcessProcessCommand(static_cast<uint32_t>(root), L"terminate", commandOptions);
+        if (result != 0) {
+            kill(-root, SIGKILL);  // Don't wait forever on a process that was missed
+        }
+
+        // Leaves go first, so by the time the root has been reaped every
+        // process in the tree has been signalled; exits are counted as they land
+        unsigned reaped = 0;
+        while (reaped < options.processes && waitpid(-1, nullptr, 0) > 0) {
+            reaped++;
+        }
+        std::wcout << L"All " << reaped << L" processes exited " << FormatDuration(ElapsedNs(terminateStart))
+                   << L" after terminate began\n";
+    }
+
+    // Whatever is left after a failed spawn
+    kill(-root, SIGKILL);
+    while (waitpid(-1, nullptr, 0) > 0 || errno == EINTR) {
+    }
+    return result;
+}
@@ -0,0 +1,17 @@
+#pragma once
+#include <string>
+#include <vector>
+
+struct ProcessTreeBenchmarkOptions {
+    unsigned processes = 1000;  // Size of the tree, root included
+    unsigned fanout = 4;        // Children per process
+    unsigned workers = 0;       // As for --process ... --tree --workers
+};
+
+// Parses [--processes <n>] [--fanout <n>] [--workers <n>] from args[first..]
+bool ParseProcessTreeBenchmarkOptions(const std::vector<std::wstring>& args, size_t first,
+                                      ProcessTreeBenchmarkOptions& options);
+
+// Forks a tree of idle processes, terminates it with --tree and reports how
+// long the snapshot, freezing, signalling and final exit of every process took
+int RunProcessTreeBenchmark(const ProcessTreeBenchmarkOptions& options);
@@ -0,0 +1,515 @@
+#include "serve.h"
+#include "ipc_channel.h"
+#include "latency_histogram.h"
+#include "utf8.h"
+#include <atomic>
+#include <chrono>
+#include <cwchar>
+#include <filesystem>
+#include <iostream>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <thread>
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+// Frames are a little-endian uint32 payload size followed by the payload.
+// Request:  op byte, the client's working directory, varint argument count,
+//           then the arguments (without the program name). Strings are a
+//           varint length and UTF-8 bytes.
+// Response: varint exit code, varint server nanoseconds, standard output as
+//           a varint length and UTF-8 bytes, then standard error to the end.
+enum class RequestOp : uint8_t {
+    Run = 1,
+    Ping,      // Answered without taking the command lock
+    Shutdown,
+};
+
+const uint32_t kMaxRequestSize  = 1 << 20;
+const uint32_t kMaxResponseSize = 64 << 20;
+
+struct Request {
+    RequestOp op = RequestOp::Ping;
+    std::string directory;  // UTF-8; relative paths in args are resolved against it
+    std::vector<std::wstring> args;
+};
+
+struct Response {
+    uint32_t exitCode = 0;
+    uint64_t serverNs = 0;
+    std::string out;  // UTF-8
+    std::string err;
+};
+
+uint64_t ElapsedNs(Clock::time_point start) {
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count());
+}
+
+void PutVarint(std::string& out, uint64_t value) {
+    while (value >= 0x80) {
+        out += static_cast<char>((value & 0x7F) | 0x80);
+        value >>= 7;
+    }
+    out += static_cast<char>(value);
+}
+
+void PutString(std::string& out, const std::string& text) {
+    PutVarint(out, text.size());
+    out += text;
+}
+
+class PayloadReader {
+public:
+    explicit PayloadReader(const std::string& payload) : payload_(payload) {}
+
+    bool Byte(uint8_t& value) {
+        if (pos_ >= payload_.size()) {
+            return false;
+        }
+        value = static_cast<uint8_t>(payload_[pos_++]);
+        return true;
+    }
+
+    bool Varint(uint64_t& value) {
+        value = 0;
+        for (int shift = 0; shift < 64; shift += 7) {
+            uint8_t byte = 0;
+            if (!Byte(byte)) {
+                return false;
+            }
+            value |= static_cast<uint64_t>(byte & 0x7F) << shift;
+            if ((byte & 0x80) == 0) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    bool String(std::string& text) {
+        uint64_t length = 0;
+        if (!Varint(length) || length > payload_.size() - pos_) {
+            return false;
+        }
+        text.assign(payload_, pos_, length);
+        pos_ += length;
+        return true;
+    }
+
+    std::string Rest() const { return payload_.substr(pos_); }
+    bool AtEnd() const { return pos_ == payload_.size(); }
+
+private:
+    const std::string& payload_;
+    size_t pos_ = 0;
+};
+
+// Starts a frame; FinishFrame fills in the size once the payload is appended
+std::string StartFrame() {
+    return std::string(4, '\0');
+}
+
+std::string& FinishFrame(std::string& frame) {
+    uint32_t size = static_cast<uint32_t>(frame.size() - 4);
+    for (int i = 0; i < 4; i++) {
+        frame[i] = static_cast<char>(size >> (8 * i));
+    }
+    return frame;
+}
+
+bool ReadFrame(IpcConnection& connection, uint32_t maxSize, std::string& payload) {
+    uint8_t header[4];
+    if (!connection.Read(header, sizeof(header))) {
+        return false;
+    }
+    uint32_t size = header[0] | (header[1] << 8) | (header[2] << 16) | (static_cast<uint32_t>(header[3]) << 24);
+    if (size > maxSize) {
+        return false;
+    }
+    payload.resize(size);
+    return size == 0 || connection.Read(&payload[0], size);
+}
+
+std::string EncodeRequest(const Request& request) {
+    std::string frame = StartFrame();
+    frame += static_cast<char>(request.op);
+    PutString(frame, request.directory);
+    PutVarint(frame, request.args.size());
+    for (const std::wstring& arg : request.args) {
+        PutString(frame, ToUtf8(arg));
+    }
+    return FinishFrame(frame);
+}
+
+bool DecodeRequest(const std::string& payload, Request& request) {
+    PayloadReader reader(payload);
+    uint8_t op = 0;
+    uint64_t count = 0;
+    if (!reader.Byte(op) || op < static_cast<uint8_t>(RequestOp::Run) || op > static_cast<uint8_t>(RequestOp::Shutdown) ||
+        !reader.String(request.directory) || !reader.Varint(count) || count > payload.size()) {
+        return false;
+    }
+    request.op = static_cast<RequestOp>(op);
+    request.args.clear();
+    for (uint64_t i = 0; i < count; i++) {
+        std::string arg;
+        if (!reader.String(arg)) {
+            return false;
+        }
+        request.args.push_back(FromUtf8(arg));
+    }
+    return reader.AtEnd();
+}
+
+std::string EncodeResponse(const Response& response) {
+    std::string frame = StartFrame();
+    PutVarint(frame, response.exitCode);
+    PutVarint(frame, response.serverNs);
+    PutString(frame, response.out);
+    frame += response.err;
+    return FinishFrame(frame);
+}
+
+bool DecodeResponse(const std::string& payload, Response& response) {
+    PayloadReader reader(payload);
+    uint64_t exitCode = 0;
+    if (!reader.Varint(exitCode) || exitCode > UINT32_MAX || !reader.Varint(response.serverNs) ||
+        !reader.String(response.out)) {
+        return false;
+    }
+    response.exitCode = static_cast<uint32_t>(exitCode);
+    response.err = reader.Rest();
+    return true;
+}
+
+bool RoundTrip(IpcConnection& connection, const std::string& request, Response& response) {
+    std::string payload;
+    return connection.Write(request.data(), request.size()) &&
+           ReadFrame(connection, kMaxResponseSize, payload) &&
+           DecodeResponse(payload, response);
+}
+
+struct ServerState {
+    ServerState(const ServeHandler& handler, const std::wstring& endpoint) : handler(handler), endpoint(endpoint) {}
+
+    const ServeHandler& handler;
+    std::wstring endpoint;
+    std::atomic<bool> stopping{ false };
+    std::atomic<uint64_t> requests{ 0 };
+    std::mutex commandLock;     // Held while a command runs with std::wcout redirected
+    LatencyHistogram commands;  // Under commandLock
+};
+
+// Runs the command from the client's working directory, so relative paths
+// (--file, --batch, --trace and the names inside a batch file) mean what they
+// would have meant had the client run it. The working directory is process
+// wide, which is safe because commands run one at a time. Formatting flags
+// are process wide too and outlive the command (PrintLastError leaves
+// std::wcerr in hex), so they are put back along with the buffers.
+int RunCaptured(const ServeHandler& handler, const Request& request, Response& response) {
+    std::error_code error;
+    std::filesystem::path serverDirectory = std::filesystem::current_path(error);
+    std::filesystem::current_path(std::filesystem::u8path(request.directory), error);
+    if (error) {
+        response.err = "Cannot use the client's working directory " + request.directory + ": " + error.message() + "\n";
+        return 1;
+    }
+
+    std::wostringstream out;
+    std::wostringstream err;
+    std::ios_base::fmtflags outFlags = std::wcout.flags();
+    std::ios_base::fmtflags errFlags = std::wcerr.flags();
+    std::wstreambuf* previousOut = std::wcout.rdbuf(out.rdbuf());
+    std::wstreambuf* previousErr = std::wcerr.rdbuf(err.rdbuf());
+
+    int exitCode = handler(request.args);
+
+    std::filesystem::current_path(serverDirectory, error);
+    std::wcout.rdbuf(previousOut);
+    std::wcerr.rdbuf(previousErr);
+    std::wcout.flags(outFlags);
+    std::wcerr.flags(errFlags);
+
+    response.out = ToUtf8(out.str());
+    response.err = ToUtf8(err.str());
+    if (response.out.size() + response.err.size() > kMaxResponseSize / 2) {
+        response.out.clear();
+        response.err = "Command output is too large to return; run it without --client\n";
+    }
+    return exitCode;
+}
+
+void ServeConnection(ServerState& state, IpcConnection& connection) {
+    std::string payload;
+    Request request;
+    while (ReadFrame(connection, kMaxRequestSize, payload)) {
+        if (!DecodeRequest(payload, request)) {
+            return;  // Not one of ours; drop it
+        }
+
+        Response response;
+        if (request.op == RequestOp::Run) {
+            request.args.insert(request.args.begin(), L"AclTool");
+            std::lock_guard<std::mutex> guard(state.commandLock);
+            Clock::time_point start = Clock::now();
+            response.exitCode = static_cast<uint32_t>(RunCaptured(state.handler, request, response));
+            response.serverNs = ElapsedNs(start);
+            state.commands.Record(response.serverNs);
+        } else if (request.op == RequestOp::Shutdown) {
+            state.stopping = true;
+        }
+        state.requests++;
+
+        std::string frame = EncodeResponse(response);
+        if (!connection.Write(frame.data(), frame.size())) {
+            return;
+        }
+        if (request.op == RequestOp::Shutdown) {
+            // Accept() only returns for a client, so connect one
+            ConnectIpc(state.endpoint);
+            return;
+        }
+    }
+}
+
+struct Session {
+    std::unique_ptr<IpcConnection> connection;
+    std::thread thread;
+    std::atomic<bool> done{ false };
+};
+
+bool ParseCount(const std::wstring& arg, const std::wstring& text, unsigned long max, unsigned& value) {
+    wchar_t* endPtr = nullptr;
+    unsigned long parsed = wcstoul(text.c_str(), &endPtr, 10);
+    if (text.empty() || *endPtr != L'\0' || parsed == 0 || parsed > max) {
+        std::wcerr << L"Invalid value for " << arg << L" (1-" << max << L"): " << text << L"\n";
+        return false;
+    }
+    value = static_cast<unsigned>(parsed);
+    return true;
+}
+
+std::string CurrentDirectory() {
+    std::error_code error;
+    return std::filesystem::current_path(error).u8string();
+}
+
+std::wstring Endpoint(const std::wstring& endpoint) {
+    return endpoint.empty() ? DefaultIpcEndpoint() : endpoint;
+}
+
+}  // namespace
+
+bool ParseServeOptions(const std::vector<std::wstring>& args, size_t first, ServeOptions& options) {
+    for (size_t i = first; i < args.size(); i++) {
+        const std::wstring& arg = args[i];
+        if (arg == L"--endpoint" && i + 1 < args.size()) {
+            options.endpoint = args[++i];
+        } else {
+            std::wcerr << L"Unknown serve option: " << arg << L"\n";
+            std::wcerr << L"Valid options: --endpoint <name>\n";
+            return false;
+        }
+    }
+    return true;
+}
+
+bool ParseClientOptions(const std::vector<std::wstring>& args, size_t first, ClientOptions& options) {
+    // Client options come first; everything from the first other argument is the command
+    size_t i = first;
+    for (; i < args.size(); i++) {
+        if (args[i] == L"--endpoint" && i + 1 < args.size()) {
+            options.endpoint = args[++i];
+        } else if (args[i] == L"--shutdown") {
+            options.shutdown = true;
+        } else {
+            break;
+        }
+    }
+    options.command.assign(args.begin() + i, args.end());
+    if (options.shutdown == !options.command.empty()) {
+        std::wcerr << L"--client takes either --shutdown or an AclTool command\n";
+        return false;
+    }
+    return true;
+}
+
+bool ParseClientLoadOptions(const std::vector<std::wstring>& args, size_t first, ClientLoadOptions& options) {
+    size_t i = first;
+    for (; i < args.size(); i++) {
+        const std::wstring& arg = args[i];
+        bool hasValue = i + 1 < args.size();
+        if (arg == L"--endpoint" && hasValue) {
+            options.endpoint = args[++i];
+        } else if (arg == L"--connections" && hasValue) {
+            if (!ParseCount(arg, args[++i], 256, options.connections)) {
+                return false;
+            }
+        } else if (arg == L"--requests" && hasValue) {
+            if (!ParseCount(arg, args[++i], 10000000, options.requests)) {
+                return false;
+            }
+        } else {
+            break;
+        }
+    }
+    options.command.assign(args.begin() + i, args.end());
+    return true;
+}
+
+int RunServer(const ServeOptions& options, const ServeHandler& handler) {
+    ServerState state(handler, Endpoint(options.endpoint));
+    std::unique_ptr<IpcListener> listener = ListenIpc(state.endpoint);
+    if (!listener) {
+        return 1;
+    }
+    std::wcout << L"Serving on " << listener->Path() << L" (stop with --client --shutdown)\n";
+
+    std::list<std::unique_ptr<Session>> sessions;
+    while (!state.stopping) {
+        std::unique_ptr<IpcConnection> connection = listener->Accept();
+        if (!connection || state.stopping) {
+            break;
+        }
+
+        sessions.remove_if([](const std::unique_ptr<Session>& session) {
+            if (!session->done) {
+                return false;
+            }
+            session->thread.join();
+            return true;
+        });
+
+        auto session = std::make_unique<Session>();
+        session->connection = std::move(connection);
+        Session* current = session.get();
+        current->thread = std::thread([&state, current] {
+            ServeConnection(state, *current->connection);
+            current->done = true;
+        });
+        sessions.push_back(std::move(session));
+    }
+
+    // Idle clients are disconnected; a command already running finishes first
+    for (const auto& session : sessions) {
+        session->connection->Close();
+    }
+    for (const auto& session : sessions) {
+        session->thread.join();
+    }
+
+    std::wcout << L"Served " << state.requests << L" request(s)";
+    if (state.commands.Count()) {
+        std::wcout << L"; command time p50 " << FormatDuration(state.commands.Percentile(50)) << L", p99 "
+                   << FormatDuration(state.commands.Percentile(99));
+    }
+    std::wcout << L"\n";
+    return state.stopping ? 0 : 1;
+}
+
+int RunClient(const ClientOptions& options) {
+    std::unique_ptr<IpcConnection> connection = ConnectIpc(Endpoint(options.endpoint));
+    if (!connection) {
+        return 1;
+    }
+
+    Request request;
+    request.op = options.shutdown ? RequestOp::Shutdown : RequestOp::Run;
+    request.directory = CurrentDirectory();
+    request.args = options.command;
+    Response response;
+    if (!RoundTrip(*connection, EncodeRequest(request), response)) {
+        std::wcerr << L"Lost connection to the server\n";
+        return 1;
+    }
+
+    if (options.shutdown) {
+        std::wcout << L"Server is shutting down\n";
+    }
+    std::wcout << FromUtf8(response.out);
+    std::wcerr << FromUtf8(response.err);
+    return static_cast<int>(response.exitCode);
+}
+
+int RunClientLoad(const ClientLoadOptions& options) {
+    Request request;
+    request.op = options.command.empty() ? RequestOp::Ping : RequestOp::Run;
+    request.directory = CurrentDirectory();
+    request.args = options.command;
+    const std::string frame = EncodeRequest(request);
+
+    // Connected up front so connection setup is not part of the request times
+    std::vector<std::unique_ptr<IpcConnection>> connections;
+    for (unsigned i = 0; i < options.connections; i++) {
+        connections.push_back(ConnectIpc(Endpoint(options.endpoint)));
+        if (!connections.back()) {
+            return 1;
+        }
+    }
+
+    std::atomic<unsigned> next{ 0 };
+    std::atomic<uint64_t> failures{ 0 };
+    std::atomic<bool> lost{ false };
+    std::vector<LatencyHistogram> roundTrips(options.connections);
+    std::vector<LatencyHistogram> serverTimes(options.connections);
+
+    auto worker = [&](unsigned index) {
+        Response response;
+        while (next++ < options.requests) {
+            Clock::time_point start = Clock::now();
+            if (!RoundTrip(*connections[index], frame, response)) {
+                lost = true;
+                return;
+            }
+            roundTrips[index].Record(ElapsedNs(start));
+            serverTimes[index].Record(response.serverNs);
+            failures += response.exitCode != 0 ? 1 : 0;
+        }
+    };
+
+    std::wstring what = L"ping";
+    if (!options.command.empty()) {
+        what = options.command[0];
+        for (size_t i = 1; i < options.command.size(); i++) {
+            what += L" " + options.command[i];
+        }
+    }
+    std::wcout << L"Load: " << options.requests << L" request(s) over " << options.connections
+               << L" connection(s): " << what << L"\n";
+
+    Clock::time_point start = Clock::now();
+    std::vector<std::thread> threads;
+    for (unsigned i = 0; i < options.connections; i++) {
+        threads.emplace_back(worker, i);
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    uint64_t elapsedNs = ElapsedNs(start);
+
+    LatencyHistogram roundTrip;
+    LatencyHistogram serverTime;
+    for (unsigned i = 0; i < options.connections; i++) {
+        roundTrip.Merge(roundTrips[i]);
+        serverTime.Merge(serverTimes[i]);
+    }
+
+    wchar_t rate[64];
+    swprintf(rate, 64, L"%.0f", elapsedNs ? static_cast<double>(roundTrip.Count()) * 1e9 / static_cast<double>(elapsedNs) : 0);
+    std::wcout << L"Completed " << roundTrip.Count() << L" in " << FormatDuration(elapsedNs) << L": " << rate
+               << L" requests/sec, " << failures << L" failed\n\n";
+    roundTrip.Print(std::wcout, L"Round trip");
+    if (request.op == RequestOp::Run) {
+        std::wcout << L"\n";
+        serverTime.Print(std::wcout, L"Server command time");
+    }
+
+    if (lost) {
+        std::wcerr << L"Lost connection to the server\n";
+        return 1;
+    }
+    return failures ? 1 : 0;
+}
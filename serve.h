@@ -0,0 +1,48 @@
+#pragma once
+#include <functional>
+#include <string>
+#include <vector>
+
+// Resident mode. AclTool --serve stays up and runs commands sent by thin
+// clients over a local IPC endpoint (ipc_channel.h), so privileges, the SCM
+// connection and the SID cache are set up once instead of once per command.
+
+// Runs one AclTool command line (args[0] is the program name) and returns
+// its exit code; whatever it prints goes back to the client
+using ServeHandler = std::function<int(const std::vector<std::wstring>& args)>;
+
+struct ServeOptions {
+    std::wstring endpoint;  // Empty = DefaultIpcEndpoint()
+};
+
+struct ClientOptions {
+    std::wstring endpoint;
+    bool shutdown = false;              // Stop the server instead of running a command
+    std::vector<std::wstring> command;  // AclTool arguments, without the program name
+};
+
+struct ClientLoadOptions {
+    std::wstring endpoint;
+    unsigned connections = 4;
+    unsigned requests = 10000;          // In total, spread over the connections
+    std::vector<std::wstring> command;  // Empty = ping, which times the transport alone
+};
+
+// [--endpoint <name>] from args[first..]
+bool ParseServeOptions(const std::vector<std::wstring>& args, size_t first, ServeOptions& options);
+// [--endpoint <name>] (--shutdown | <AclTool arguments>) from args[first..]
+bool ParseClientOptions(const std::vector<std::wstring>& args, size_t first, ClientOptions& options);
+// [--endpoint <name>] [--connections <n>] [--requests <n>] [<AclTool arguments>] from args[first..]
+bool ParseClientLoadOptions(const std::vector<std::wstring>& args, size_t first, ClientLoadOptions& options);
+
+// Serves until a client sends --shutdown. Each connection has its own thread,
+// but commands run one at a time: the backends print to std::wcout, which is
+// redirected per command to capture its output.
+int RunServer(const ServeOptions& options, const ServeHandler& handler);
+
+// Sends one command and prints its output; returns the command's exit code
+int RunClient(const ClientOptions& options);
+
+// Sends the same request from several connections at once and reports
+// requests/sec, the client round trip and the server-side command time
+int RunClientLoad(const ClientLoadOptions& options);
@@ -3,6 +3,7 @@
 #include "privilege_guard.h"
 #include <windows.h>
 #include <iostream>
+#include <iterator>
 
 namespace {
 
@@ -14,9 +15,13 @@ bool QueryServiceState(SC_HANDLE serviceHandle) {
     SERVICE_STATUS_PROCESS statusInfo = {};
     DWORD bytesNeeded = 0;
 
-    if (!QueryServiceStatusEx(serviceHandle, SC_STATUS_PROCESS_INFO, 
-                             reinterpret_cast<LPBYTE>(&statusInfo), 
-                             sizeof(statusInfo), &bytesNeeded)) {
+    TraceSpan trace(TraceOp::ServiceControl, kTraceServiceQuery);
+    BOOL queried = QueryServiceStatusEx(serviceHandle, SC_STATUS_PROCESS_INFO, 
+                                        reinterpret_cast<LPBYTE>(&statusInfo), 
+                                        sizeof(statusInfo), &bytesNeeded);
+    FinishTraceSpan(trace, queried != FALSE);
+
+    if (!queried) {
         PrintLastError(L"QueryServiceStatusEx");
         return false;
     }
@@ -52,63 +57,40 @@ bool QueryServiceState(SC_HANDLE serviceHandle) {
     return true;
 }
 
-}  // namespace
-
-int ProcessServiceCommand(const std::wstring& serviceName, const std::wstring& command) {
-    bool requiresTakeOwnership = false;
-    bool requiresRestorePrivilege = false;
-    DWORD desiredAccess = 0;
-    
-    if (command == L"start" || command == L"stop") {
-        desiredAccess = SERVICE_START | SERVICE_STOP | SERVICE_QUERY_STATUS;
-    } else if (command == L"harden") {
-        desiredAccess = WRITE_DAC | WRITE_OWNER;
-        requiresRestorePrivilege = true;  // Needed to set the owner to SYSTEM
-        requiresTakeOwnership = true; // Needed for WRITE_DAC
-    } else if (command == L"takeown") {
-        desiredAccess = WRITE_OWNER;
-        requiresTakeOwnership = true;
-    } else if (command == L"query") {
-        desiredAccess = SERVICE_QUERY_STATUS;
-    } else if (command == L"weaken") {
-        desiredAccess = WRITE_DAC;
-    } else {
-        std::wcerr << L"Unknown service command: " << command << L"\n";
-        std::wcerr << L"Valid commands: start, stop, query, harden, takeown, weaken\n";
-        return 1;
-    }
-
-    // Enable SE_TAKE_OWNERSHIP_NAME privilege for WRITE_OWNER access
-    PrivilegeGuard takeownPrivilegeGuard(requiresTakeOwnership ? SE_TAKE_OWNERSHIP_NAME : nullptr);
-    if (takeownPrivilegeGuard.IsValid() && !takeownPrivilegeGuard.IsEnabled()) {
-        return 1;  // Error message already printed by PrivilegeGuard
-    }
+const CommandSpec kServiceCommands[] = {
+    // name        desiredAccess                                       takeown restore
+    { L"start",   SERVICE_START | SERVICE_STOP | SERVICE_QUERY_STATUS, false,  false },
+    { L"stop",    SERVICE_START | SERVICE_STOP | SERVICE_QUERY_STATUS, false,  false },
+    { L"query",   SERVICE_QUERY_STATUS,                                false,  false },
+    { L"harden",  WRITE_DAC | WRITE_OWNER,                             true,   true  },  // restore: owner -> SYSTEM, takeown: WRITE_DAC
+    { L"takeown", WRITE_OWNER,                                         true,   false },
+    { L"weaken",  WRITE_DAC,                                           false,  false },
+};
 
-    // Enable SE_RESTORE_NAME privilege if setting owner to another user
-    PrivilegeGuard restorePrivilegeGuard(requiresRestorePrivilege ? SE_RESTORE_NAME : nullptr);
-    if (restorePrivilegeGuard.IsValid() && !restorePrivilegeGuard.IsEnabled()) {
-        return 1;  // Error message already printed by PrivilegeGuard
+// Open callback for RunCommandChain; serviceHandle is replaced by the new open
+ChainOpenResult OpenServiceForChain(SC_HANDLE scmHandle, const std::wstring& serviceName, DWORD desiredAccess,
+                                    SC_HANDLE& serviceHandle) {
+    if (serviceHandle) {
+        CloseServiceHandle(serviceHandle);
     }
-
     std::wcout << L"Opening service: " << serviceName << L" with permissions: 0x" << std::hex << desiredAccess << std::dec << L"\n";
 
-    SC_HANDLE scmHandle = OpenSCManagerW(nullptr, nullptr, SC_MANAGER_CONNECT);
-    if (!scmHandle) {
-        PrintLastError(L"OpenSCManager");
-        return 1;
-    }
-
-    SC_HANDLE serviceHandle = OpenServiceW(scmHandle, serviceName.c_str(), desiredAccess);
-    if (!serviceHandle) {
-        PrintLastError(L"OpenService");
-        CloseServiceHandle(scmHandle);
-        return 1;
+    TraceSpan trace(TraceOp::Open, TraceObject::Service, serviceName, desiredAccess);
+    serviceHandle = OpenServiceW(scmHandle, serviceName.c_str(), desiredAccess);
+    FinishTraceSpan(trace, serviceHandle != nullptr);
+    if (serviceHandle) {
+        return ChainOpenResult::Opened;
     }
+    return GetLastError() == ERROR_ACCESS_DENIED ? ChainOpenResult::AccessDenied : ChainOpenResult::Failed;
+}
 
+bool RunServiceCommand(SC_HANDLE serviceHandle, const std::wstring& command) {
     bool success = false;
     if (command == L"start") {
         std::wcout << L"Starting service...\n";
+        TraceSpan trace(TraceOp::ServiceControl, kTraceServiceStart);
         success = StartServiceW(serviceHandle, 0, nullptr) != 0;
+        FinishTraceSpan(trace, success);
         if (success) {
             std::wcout << L"Service started successfully\n";
         } else {
@@ -117,7 +99,9 @@ int ProcessServiceCommand(const std::wstring& serviceName, const std::wstring& c
     } else if (command == L"stop") {
         SERVICE_STATUS status;
         std::wcout << L"Stopping service...\n";
+        TraceSpan trace(TraceOp::ServiceControl, SERVICE_CONTROL_STOP);
         success = ControlService(serviceHandle, SERVICE_CONTROL_STOP, &status) != 0;
+        FinishTraceSpan(trace, success);
         if (success) {
             std::wcout << L"Service stopped successfully\n";
         } else {
@@ -142,8 +126,123 @@ int ProcessServiceCommand(const std::wstring& serviceName, const std::wstring& c
     } else if (command == L"query") {
         success = QueryServiceState(serviceHandle);
     }
+    return success;
+}
+
+// Runs the chain against one service, reopening it only when a command
+// needs rights the current handle lacks
+bool RunServiceChain(SC_HANDLE scmHandle, const std::wstring& serviceName, const std::vector<const CommandSpec*>& chain) {
+    TraceContext traceContext(TraceObject::Service, serviceName);
+
+    SC_HANDLE serviceHandle = nullptr;
+    ChainResult result = RunCommandChain(chain,
+        [&](uint32_t desiredAccess) { return OpenServiceForChain(scmHandle, serviceName, desiredAccess, serviceHandle); },
+        [&](const CommandSpec& spec) { return RunServiceCommand(serviceHandle, spec.name); });
+    if (result == ChainResult::OpenFailed) {
+        PrintLastError(L"OpenService");
+    }
+
+    if (serviceHandle) {
+        CloseServiceHandle(serviceHandle);
+    }
+    return result == ChainResult::Succeeded;
+}
+
+// Set by KeepServiceManagerConnected; requests share it instead of connecting
+SC_HANDLE g_residentScm = nullptr;
+
+SC_HANDLE ConnectServiceManager() {
+    if (g_residentScm) {
+        return g_residentScm;
+    }
+
+    TraceSpan trace(TraceOp::Open, TraceObject::ServiceManager, std::wstring(), SC_MANAGER_CONNECT);
+    SC_HANDLE scmHandle = OpenSCManagerW(nullptr, nullptr, SC_MANAGER_CONNECT);
+    FinishTraceSpan(trace, scmHandle != nullptr);
+    if (!scmHandle) {
+        PrintLastError(L"OpenSCManager");
+    }
+    return scmHandle;
+}
+
+void ReleaseServiceManager(SC_HANDLE scmHandle) {
+    if (scmHandle != g_residentScm) {
+        CloseServiceHandle(scmHandle);
+    }
+}
+
+}  // namespace
+
+bool KeepServiceManagerConnected() {
+    if (!g_residentScm) {
+        g_residentScm = ConnectServiceManager();
+    }
+    return g_residentScm != nullptr;
+}
+
+int ProcessServiceCommand(const std::wstring& serviceName, const std::wstring& command) {
+    std::vector<const CommandSpec*> chain;
+    if (!ParseCommandChain(command, L"service", kServiceCommands, std::size(kServiceCommands), chain)) {
+        return 1;
+    }
+
+    // Enable SE_TAKE_OWNERSHIP_NAME privilege for WRITE_OWNER access
+    PrivilegeGuard takeownPrivilegeGuard(ChainRequiresTakeOwnership(chain) ? SE_TAKE_OWNERSHIP_NAME : nullptr);
+    if (takeownPrivilegeGuard.IsValid() && !takeownPrivilegeGuard.IsEnabled()) {
+        return 1;  // Error message already printed by PrivilegeGuard
+    }
+
+    // Enable SE_RESTORE_NAME privilege if setting owner to another user
+    PrivilegeGuard restorePrivilegeGuard(ChainRequiresRestorePrivilege(chain) ? SE_RESTORE_NAME : nullptr);
+    if (restorePrivilegeGuard.IsValid() && !restorePrivilegeGuard.IsEnabled()) {
+        return 1;  // Error message already printed by PrivilegeGuard
+    }
 
-    CloseServiceHandle(serviceHandle);
-    CloseServiceHandle(scmHandle);
+    SC_HANDLE scmHandle = ConnectServiceManager();
+    if (!scmHandle) {
+        return 1;
+    }
+
+    bool success = RunServiceChain(scmHandle, serviceName, chain);
+    ReleaseServiceManager(scmHandle);
     return success ? 0 : 1;
 }
+
+uint64_t ProcessServiceBatch(const std::vector<const BatchItem*>& items) {
+    // Every chain is checked before anything runs, so the privileges the
+    // group needs are enabled once for all of it
+    std::vector<std::vector<const CommandSpec*>> chains(items.size());
+    bool takeown = false;
+    bool restore = false;
+    for (size_t i = 0; i < items.size(); i++) {
+        if (!ParseCommandChain(items[i]->commands, L"service", kServiceCommands, std::size(kServiceCommands), chains[i])) {
+            return items.size();
+        }
+        takeown = takeown || ChainRequiresTakeOwnership(chains[i]);
+        restore = restore || ChainRequiresRestorePrivilege(chains[i]);
+    }
+
+    PrivilegeGuard takeownPrivilegeGuard(takeown ? SE_TAKE_OWNERSHIP_NAME : nullptr);
+    if (takeownPrivilegeGuard.IsValid() && !takeownPrivilegeGuard.IsEnabled()) {
+        return items.size();  // Error message already printed by PrivilegeGuard
+    }
+    PrivilegeGuard restorePrivilegeGuard(restore ? SE_RESTORE_NAME : nullptr);
+    if (restorePrivilegeGuard.IsValid() && !restorePrivilegeGuard.IsEnabled()) {
+        return items.size();  // Error message already printed by PrivilegeGuard
+    }
+
+    SC_HANDLE scmHandle = ConnectServiceManager();
+    if (!scmHandle) {
+        return items.size();
+    }
+
+    uint64_t failures = 0;
+    for (size_t i = 0; i < items.size(); i++) {
+        if (!RunServiceChain(scmHandle, items[i]->name, chains[i])) {
+            std::wcerr << L"Failed: service " << items[i]->name << L"\n";
+            failures++;
+        }
+    }
+    ReleaseServiceManager(scmHandle);
+    return failures;
+}
@@ -1,4 +1,15 @@
 #pragma once
+#include <cstdint>
 #include <string>
+#include <vector>
+#include "batch_plan.h"
 
 int ProcessServiceCommand(const std::wstring& serviceName, const std::wstring& command);
+
+// Runs the service items of a batch plan in order over one SCM connection.
+// Returns the number that failed.
+uint64_t ProcessServiceBatch(const std::vector<const BatchItem*>& items);
+
+// For the resident server: connects to the SCM once and has every later
+// command reuse the handle instead of opening its own
+bool KeepServiceManagerConnected();
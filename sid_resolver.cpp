@@ -0,0 +1,179 @@
+#include "sid_resolver.h"
+#include "utf8.h"
+#include <filesystem>
+#include <fstream>
+
+namespace {
+
+struct WellKnownSid {
+    const wchar_t* sid;
+    const wchar_t* name;
+};
+
+// English names; LookupAccountSid returns localized names on other locales,
+// but these SIDs are only ever used by this tool to build its own ACLs.
+const WellKnownSid kWellKnownSids[] = {
+    { L"S-1-0-0",      L"NULL SID" },
+    { L"S-1-1-0",      L"Everyone" },
+    { L"S-1-3-0",      L"CREATOR OWNER" },
+    { L"S-1-3-1",      L"CREATOR GROUP" },
+    { L"S-1-5-2",      L"NT AUTHORITY\\NETWORK" },
+    { L"S-1-5-4",      L"NT AUTHORITY\\INTERACTIVE" },
+    { L"S-1-5-6",      L"NT AUTHORITY\\SERVICE" },
+    { L"S-1-5-7",      L"NT AUTHORITY\\ANONYMOUS LOGON" },
+    { L"S-1-5-11",     L"NT AUTHORITY\\Authenticated Users" },
+    { L"S-1-5-18",     L"NT AUTHORITY\\SYSTEM" },
+    { L"S-1-5-19",     L"NT AUTHORITY\\LOCAL SERVICE" },
+    { L"S-1-5-20",     L"NT AUTHORITY\\NETWORK SERVICE" },
+    { L"S-1-5-32-544", L"BUILTIN\\Administrators" },
+    { L"S-1-5-32-545", L"BUILTIN\\Users" },
+    { L"S-1-5-32-546", L"BUILTIN\\Guests" },
+    { L"S-1-5-32-551", L"BUILTIN\\Backup Operators" },
+};
+
+}  // namespace
+
+void StaticAccountDirectory::Add(const std::wstring& sid, const std::wstring& accountName) {
+    std::lock_guard<std::mutex> guard(lock_);
+    accounts_[sid] = accountName;
+}
+
+SidLookupResult StaticAccountDirectory::LookupSid(const std::wstring& sid, std::wstring& accountName) {
+    lookups_.fetch_add(1, std::memory_order_relaxed);
+
+    std::lock_guard<std::mutex> guard(lock_);
+    auto it = accounts_.find(sid);
+    if (it == accounts_.end()) {
+        return SidLookupResult::NotMapped;
+    }
+    accountName = it->second;
+    return SidLookupResult::Found;
+}
+
+SidResolver::SidResolver(AccountDirectory& directory, std::chrono::seconds negativeTtl)
+    : directory_(directory), negativeTtl_(negativeTtl) {
+}
+
+const wchar_t* SidResolver::LookupWellKnownSid(const std::wstring& sid) {
+    for (const auto& entry : kWellKnownSids) {
+        if (sid == entry.sid) {
+            return entry.name;
+        }
+    }
+    return nullptr;
+}
+
+SidResolver::Shard& SidResolver::ShardFor(const std::wstring& sid) {
+    return shards_[std::hash<std::wstring>{}(sid) % kShardCount];
+}
+
+std::wstring SidResolver::Resolve(const std::wstring& sid) {
+    if (const wchar_t* name = LookupWellKnownSid(sid)) {
+        wellKnownHits_.fetch_add(1, std::memory_order_relaxed);
+        return name;
+    }
+
+    Shard& shard = ShardFor(sid);
+    auto now = std::chrono::steady_clock::now();
+    {
+        std::lock_guard<std::mutex> guard(shard.lock);
+        auto it = shard.entries.find(sid);
+        if (it != shard.entries.end()) {
+            if (it->second.mapped) {
+                hits_.fetch_add(1, std::memory_order_relaxed);
+                return it->second.name;
+            }
+            if (now < it->second.expires) {
+                negativeHits_.fetch_add(1, std::memory_order_relaxed);
+                return sid;
+            }
+            shard.entries.erase(it);  // Negative entry expired - ask again
+        }
+    }
+
+    // Lookup runs without the shard lock held; two threads racing on the same
+    // SID both ask the directory, which is cheaper than blocking the shard.
+    directoryLookups_.fetch_add(1, std::memory_order_relaxed);
+    std::wstring accountName;
+    SidLookupResult result = directory_.LookupSid(sid, accountName);
+
+    if (result == SidLookupResult::Failed) {
+        return sid;
+    }
+
+    std::lock_guard<std::mutex> guard(shard.lock);
+    if (result == SidLookupResult::Found) {
+        shard.entries[sid] = Entry{ accountName, true, {} };
+        return accountName;
+    }
+
+    shard.entries[sid] = Entry{ std::wstring(), false, now + negativeTtl_ };
+    return sid;
+}
+
+bool SidResolver::LoadCache(const std::wstring& path) {
+    std::ifstream in(std::filesystem::path(path), std::ios::binary);
+    if (!in) {
+        return false;
+    }
+
+    // One "SID<TAB>name" pair per line, UTF-8
+    std::string line;
+    while (std::getline(in, line)) {
+        if (!line.empty() && line.back() == '\r') {
+            line.pop_back();
+        }
+        size_t tab = line.find('\t');
+        if (tab == std::string::npos || tab == 0 || tab + 1 == line.size()) {
+            continue;  // Skip malformed lines rather than failing the whole cache
+        }
+
+        std::wstring sid  = FromUtf8(line.substr(0, tab));
+        std::wstring name = FromUtf8(line.substr(tab + 1));
+
+        Shard& shard = ShardFor(sid);
+        std::lock_guard<std::mutex> guard(shard.lock);
+        shard.entries[sid] = Entry{ name, true, {} };
+    }
+    return true;
+}
+
+bool SidResolver::SaveCache(const std::wstring& path) const {
+    // Write to a temporary file and rename so a crash never leaves a torn cache
+    std::filesystem::path target(path);
+    std::filesystem::path temp = target;
+    temp += L".tmp";
+
+    {
+        std::ofstream out(temp, std::ios::binary | std::ios::trunc);
+        if (!out) {
+            return false;
+        }
+
+        for (const auto& shard : shards_) {
+            std::lock_guard<std::mutex> guard(shard.lock);
+            for (const auto& [sid, entry] : shard.entries) {
+                if (entry.mapped) {
+                    out << ToUtf8(sid) << '\t' << ToUtf8(entry.name) << '\n';
+                }
+            }
+        }
+
+        if (!out) {
+            return false;
+        }
+    }
+
+    std::error_code ec;
+    std::filesystem::rename(temp, target, ec);
+    return !ec;
+}
+
+SidResolver::Stats SidResolver::GetStats() const {
+    return Stats{
+        hits_.load(std::memory_order_relaxed),
+        negativeHits_.load(std::memory_order_relaxed),
+        wellKnownHits_.load(std::memory_order_relaxed),
+        directoryLookups_.load(std::memory_order_relaxed),
+    };
+}
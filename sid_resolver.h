@@ -0,0 +1,93 @@
+#pragma once
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+// SIDs are handled in their string form ("S-1-5-18") so this layer does not
+// depend on the Win32 SID layout and can be driven off Windows.
+
+enum class SidLookupResult {
+    Found,     // accountName was filled in
+    NotMapped, // the SID does not belong to any account (deleted user, orphaned SID)
+    Failed,    // transient failure (e.g. domain controller unreachable) - not cached
+};
+
+// Source of SID -> account name lookups (LookupAccountSid on Windows)
+class AccountDirectory {
+public:
+    virtual ~AccountDirectory() = default;
+    virtual SidLookupResult LookupSid(const std::wstring& sid, std::wstring& accountName) = 0;
+};
+
+// In-memory directory, for resolving without a live account database
+class StaticAccountDirectory : public AccountDirectory {
+public:
+    void Add(const std::wstring& sid, const std::wstring& accountName);
+    SidLookupResult LookupSid(const std::wstring& sid, std::wstring& accountName) override;
+
+    uint64_t LookupCount() const { return lookups_.load(std::memory_order_relaxed); }
+
+private:
+    std::mutex lock_;
+    std::unordered_map<std::wstring, std::wstring> accounts_;
+    std::atomic<uint64_t> lookups_{0};
+};
+
+// Caching SID -> name resolver. Lookups are spread over independently locked
+// shards so concurrent reports do not serialize on one mutex. SIDs that do not
+// map to an account are remembered for negativeTtl so orphaned ACEs are not
+// looked up over and over.
+class SidResolver {
+public:
+    struct Stats {
+        uint64_t hits;
+        uint64_t negativeHits;
+        uint64_t wellKnownHits;
+        uint64_t directoryLookups;
+    };
+
+    explicit SidResolver(AccountDirectory& directory,
+                         std::chrono::seconds negativeTtl = std::chrono::seconds(300));
+
+    // Returns "DOMAIN\name", or the SID string itself if it does not resolve
+    std::wstring Resolve(const std::wstring& sid);
+
+    // Warm cache persisted between runs. Only positive entries are saved.
+    bool LoadCache(const std::wstring& path);
+    bool SaveCache(const std::wstring& path) const;
+
+    Stats GetStats() const;
+
+    // Names for the SIDs CreateWellKnownSid produces for this tool (SYSTEM,
+    // INTERACTIVE, Everyone, Administrators, ...). Returns nullptr if unknown.
+    static const wchar_t* LookupWellKnownSid(const std::wstring& sid);
+
+private:
+    struct Entry {
+        std::wstring name;
+        bool mapped;
+        std::chrono::steady_clock::time_point expires;  // only meaningful when !mapped
+    };
+
+    struct Shard {
+        mutable std::mutex lock;
+        std::unordered_map<std::wstring, Entry> entries;
+    };
+
+    static constexpr size_t kShardCount = 16;
+
+    Shard& ShardFor(const std::wstring& sid);
+
+    AccountDirectory& directory_;
+    std::chrono::seconds negativeTtl_;
+    std::array<Shard, kShardCount> shards_;
+
+    std::atomic<uint64_t> hits_{0};
+    std::atomic<uint64_t> negativeHits_{0};
+    std::atomic<uint64_t> wellKnownHits_{0};
+    std::atomic<uint64_t> directoryLookups_{0};
+};
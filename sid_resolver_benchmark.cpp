@@ -0,0 +1,225 @@
+#include "sid_resolver_benchmark.h"
+#include "latency_histogram.h"
+#include "sid_resolver.h"
+#include <algorithm>
+#include <chrono>
+#include <cwchar>
+#include <filesystem>
+#include <iostream>
+#include <thread>
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+const wchar_t kDomainSid[] = L"S-1-5-21-1004336348-1177238915-682003330-";
+const unsigned kFirstMappedRid = 1000;
+const unsigned kFirstUnmappedRid = 900000;  // No account in the directory has one of these
+
+uint64_t ElapsedNs(Clock::time_point start) {
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count());
+}
+
+std::wstring MappedSid(unsigned index) {
+    return kDomainSid + std::to_wstring(kFirstMappedRid + index);
+}
+
+std::wstring MappedName(unsigned index) {
+    return L"CONTOSO\\user" + std::to_wstring(index);
+}
+
+std::wstring UnmappedSid(unsigned index) {
+    return kDomainSid + std::to_wstring(kFirstUnmappedRid + index);
+}
+
+void FillDirectory(StaticAccountDirectory& directory, unsigned sids) {
+    for (unsigned i = 0; i < sids; i++) {
+        directory.Add(MappedSid(i), MappedName(i));
+    }
+}
+
+// Counts failed checks, printing each one
+class Checker {
+public:
+    void Expect(bool condition, const wchar_t* what) {
+        if (!condition) {
+            std::wcerr << L"FAILED: " << what << L"\n";
+            failures_++;
+        }
+    }
+
+    unsigned Failures() const { return failures_; }
+
+private:
+    unsigned failures_ = 0;
+};
+
+bool ResolvesAll(SidResolver& resolver, unsigned sids) {
+    bool all = true;
+    for (unsigned i = 0; i < sids; i++) {
+        all = resolver.Resolve(MappedSid(i)) == MappedName(i) && all;
+    }
+    return all;
+}
+
+void CheckCacheHits(Checker& check, unsigned sids) {
+    StaticAccountDirectory directory;
+    FillDirectory(directory, sids);
+    SidResolver resolver(directory);
+
+    check.Expect(ResolvesAll(resolver, sids), L"mapped SIDs resolve to their account names");
+    check.Expect(directory.LookupCount() == sids, L"each SID is looked up in the directory once");
+    check.Expect(ResolvesAll(resolver, sids), L"cached SIDs resolve to their account names");
+    check.Expect(directory.LookupCount() == sids, L"cached SIDs are not looked up again");
+    check.Expect(resolver.GetStats().hits == sids, L"the second pass is counted as cache hits");
+
+    check.Expect(resolver.Resolve(L"S-1-5-18") == L"NT AUTHORITY\\SYSTEM", L"well-known SIDs resolve from the table");
+    check.Expect(directory.LookupCount() == sids && resolver.GetStats().wellKnownHits == 1,
+                 L"well-known SIDs do not reach the directory");
+}
+
+void CheckNegativeEntries(Checker& check) {
+    StaticAccountDirectory directory;
+    std::wstring sid = UnmappedSid(0);
+    {
+        SidResolver resolver(directory, std::chrono::seconds(300));
+        check.Expect(resolver.Resolve(sid) == sid && resolver.Resolve(sid) == sid,
+                     L"unmapped SIDs resolve to themselves");
+        check.Expect(directory.LookupCount() == 1 && resolver.GetStats().negativeHits == 1,
+                     L"unmapped SIDs are remembered for the negative TTL");
+    }
+    {
+        // A zero TTL expires the entry as soon as it is written
+        SidResolver resolver(directory, std::chrono::seconds(0));
+        uint64_t before = directory.LookupCount();
+        resolver.Resolve(sid);
+        resolver.Resolve(sid);
+        check.Expect(directory.LookupCount() == before + 2 && resolver.GetStats().negativeHits == 0,
+                     L"expired negative entries are looked up again");
+
+        directory.Add(sid, L"CONTOSO\\restored");
+        check.Expect(resolver.Resolve(sid) == L"CONTOSO\\restored",
+                     L"an expired negative entry gives way to an account added since");
+    }
+}
+
+void CheckWarmCache(Checker& check, unsigned sids) {
+    std::filesystem::path path = std::filesystem::temp_directory_path() /
+        (L"acltool_sids_" + std::to_wstring(Clock::now().time_since_epoch().count()) + L".txt");
+
+    StaticAccountDirectory directory;
+    FillDirectory(directory, sids);
+    std::wstring nonAscii = kDomainSid + std::to_wstring(kFirstUnmappedRid - 1);
+    directory.Add(nonAscii, L"CONTOSO\\J\u00f6rg \u5c71\u7530");
+    SidResolver resolver(directory);
+    ResolvesAll(resolver, sids);
+    resolver.Resolve(nonAscii);
+    resolver.Resolve(UnmappedSid(0));
+    check.Expect(resolver.SaveCache(path.wstring()), L"the cache file is written");
+
+    StaticAccountDirectory empty;
+    SidResolver warm(empty);
+    check.Expect(warm.LoadCache(path.wstring()), L"the cache file is read back");
+    check.Expect(ResolvesAll(warm, sids), L"a loaded cache resolves every saved SID");
+    check.Expect(warm.Resolve(nonAscii) == L"CONTOSO\\J\u00f6rg \u5c71\u7530",
+                 L"names outside ASCII survive the cache file");
+    check.Expect(empty.LookupCount() == 0, L"a loaded cache answers without the directory");
+    warm.Resolve(UnmappedSid(0));
+    check.Expect(empty.LookupCount() == 1, L"negative entries are not saved");
+
+    std::error_code ec;
+    std::filesystem::remove(path, ec);
+}
+
+// Cached lookups spread over every SID, from 1 thread doubling up to the most
+void BenchmarkLookups(const SidResolverBenchmarkOptions& options) {
+    StaticAccountDirectory directory;
+    FillDirectory(directory, options.sids);
+    SidResolver resolver(directory);
+    ResolvesAll(resolver, options.sids);
+
+    std::wcout << L"\n  threads    lookups/s   per lookup\n";
+    for (unsigned threads = 1;; threads = std::min(threads * 2, options.threads)) {
+        unsigned perThread = std::max(1u, options.lookups / threads);
+        Clock::time_point start = Clock::now();
+        std::vector<std::thread> workers;
+        for (unsigned t = 0; t < threads; t++) {
+            workers.emplace_back([&, t] {
+                for (unsigned i = 0; i < perThread; i++) {
+                    resolver.Resolve(MappedSid((t * 7919 + i) % options.sids));
+                }
+            });
+        }
+        for (auto& worker : workers) {
+            worker.join();
+        }
+        uint64_t elapsedNs = ElapsedNs(start);
+
+        uint64_t lookups = static_cast<uint64_t>(perThread) * threads;
+        double perSecond = elapsedNs ? static_cast<double>(lookups) * 1e9 / static_cast<double>(elapsedNs) : 0;
+        wchar_t line[80];
+        swprintf(line, 80, L"  %7u %12.0f %12ls\n", threads, perSecond,
+                 FormatDuration(lookups ? elapsedNs * threads / lookups : 0).c_str());
+        std::wcout << line;
+        if (threads >= options.threads) {
+            break;
+        }
+    }
+}
+
+bool ParseValue(const std::wstring& arg, const std::wstring& text, unsigned long max, unsigned& value) {
+    wchar_t* endPtr = nullptr;
+    unsigned long parsed = wcstoul(text.c_str(), &endPtr, 10);
+    if (text.empty() || *endPtr != L'\0' || parsed == 0 || parsed > max) {
+        std::wcerr << L"Invalid value for " << arg << L" (1-" << max << L"): " << text << L"\n";
+        return false;
+    }
+    value = static_cast<unsigned>(parsed);
+    return true;
+}
+
+}  // namespace
+
+bool ParseSidResolverBenchmarkOptions(const std::vector<std::wstring>& args, size_t first,
+                                      SidResolverBenchmarkOptions& options) {
+    for (size_t i = first; i < args.size(); i++) {
+        const std::wstring& arg = args[i];
+        bool hasValue = i + 1 < args.size();
+        if (arg == L"--sids" && hasValue) {
+            if (!ParseValue(arg, args[++i], kFirstUnmappedRid - kFirstMappedRid - 1, options.sids)) {
+                return false;
+            }
+        } else if (arg == L"--lookups" && hasValue) {
+            if (!ParseValue(arg, args[++i], 100000000, options.lookups)) {
+                return false;
+            }
+        } else if (arg == L"--threads" && hasValue) {
+            if (!ParseValue(arg, args[++i], 1024, options.threads)) {
+                return false;
+            }
+        } else {
+            std::wcerr << L"Unknown benchmark option: " << arg << L"\n";
+            std::wcerr << L"Valid options: --sids <n>, --lookups <n>, --threads <n>\n";
+            return false;
+        }
+    }
+    return true;
+}
+
+int RunSidResolverBenchmark(const SidResolverBenchmarkOptions& options) {
+    std::wcout << L"SID resolver: " << options.sids << L" mapped SID(s), " << options.lookups
+               << L" cached lookup(s) per run\n";
+
+    Checker check;
+    CheckCacheHits(check, options.sids);
+    CheckNegativeEntries(check);
+    CheckWarmCache(check, options.sids);
+    if (check.Failures()) {
+        std::wcerr << check.Failures() << L" check(s) failed\n";
+        return 1;
+    }
+    std::wcout << L"Cache hits, negative TTL and warm cache file: all checks passed\n";
+
+    BenchmarkLookups(options);
+    return 0;
+}
@@ -0,0 +1,19 @@
+#pragma once
+#include <string>
+#include <vector>
+
+struct SidResolverBenchmarkOptions {
+    unsigned sids = 1000;       // Distinct mapped SIDs in the directory
+    unsigned lookups = 200000;  // Cached lookups per thread count
+    unsigned threads = 8;       // Most threads; runs with 1, 2, 4... up to this
+};
+
+// Parses [--sids <n>] [--lookups <n>] [--threads <n>] from args[first..]
+bool ParseSidResolverBenchmarkOptions(const std::vector<std::wstring>& args, size_t first,
+                                      SidResolverBenchmarkOptions& options);
+
+// Checks SidResolver against a StaticAccountDirectory (cache hits,
+// well-known SIDs, negative entries and their expiry, the warm cache file
+// round trip), then times cached lookups from 1 up to `threads` threads.
+// Returns 1 if any check fails.
+int RunSidResolverBenchmark(const SidResolverBenchmarkOptions& options);
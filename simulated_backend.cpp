@@ -0,0 +1,128 @@
+#include "simulated_backend.h"
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <thread>
+
+namespace {
+
+const uint32_t kErrorTimeout = 1460;  // ERROR_TIMEOUT
+
+// Where GetSecurity copies descriptors to, like the caller's buffer
+thread_local std::vector<uint8_t> t_scratch;
+
+}  // namespace
+
+SimulatedBackend::Object& SimulatedBackend::Lookup(const TraceRecord& record) {
+    // Objects spring into existence on first use; the trace already says
+    // whether the real lookup succeeded
+    ObjectKey key(record.object, record.name);
+    {
+        std::shared_lock<std::shared_mutex> guard(objectsLock_);
+        auto found = objects_.find(key);
+        if (found != objects_.end()) {
+            return found->second;
+        }
+    }
+    std::unique_lock<std::shared_mutex> guard(objectsLock_);
+    return objects_.try_emplace(std::move(key)).first->second;
+}
+
+void SimulatedBackend::SetLatencyCurve(TraceObject object, const LatencyCurve& curve) {
+    auto& state = curves_[object];
+    if (!state) {
+        state = std::make_unique<CurveState>();
+    }
+    state->curve = curve;
+}
+
+uint32_t SimulatedBackend::ApplyCurve(CurveState& state) {
+    const LatencyCurve& curve = state.curve;
+    unsigned inFlight = ++state.inFlight;
+    uint32_t result = 0;
+
+    if (curve.failAbove && inFlight > curve.failAbove) {
+        // Callers that far back time out without being served
+        std::this_thread::sleep_for(std::chrono::nanoseconds(curve.serviceNs));
+        result = kErrorTimeout;
+    } else {
+        std::unique_lock<std::mutex> guard(state.lock);
+        state.freed.wait(guard, [&] { return state.busy < std::max(1u, curve.capacity); });
+        state.busy++;
+        guard.unlock();
+
+        unsigned queued = inFlight > curve.capacity ? inFlight - curve.capacity : 0;
+        double serviceNs = static_cast<double>(curve.serviceNs) * (1.0 + curve.collapse * queued);
+        std::this_thread::sleep_for(std::chrono::nanoseconds(static_cast<uint64_t>(serviceNs)));
+
+        guard.lock();
+        state.busy--;
+        state.freed.notify_one();
+    }
+
+    state.inFlight--;
+    return result;
+}
+
+uint32_t SimulatedBackend::Execute(const TraceRecord& record) {
+    auto curve = curves_.find(record.object);
+    if (curve != curves_.end()) {
+        if (uint32_t error = ApplyCurve(*curve->second)) {
+            return error;
+        }
+    }
+
+    switch (record.op) {
+        case TraceOp::Open:
+            if (record.result == 0) {
+                Object& object = Lookup(record);
+                std::lock_guard<std::mutex> guard(object.lock);
+                object.opens++;
+            }
+            break;
+
+        case TraceOp::GetSecurity: {
+            Object& object = Lookup(record);
+            std::lock_guard<std::mutex> guard(object.lock);
+            t_scratch.resize(record.size);
+            size_t copied = std::min(t_scratch.size(), object.descriptor.size());
+            if (copied) {
+                std::memcpy(t_scratch.data(), object.descriptor.data(), copied);
+            }
+            break;
+        }
+
+        case TraceOp::SetSecurity:
+            if (record.result == 0) {
+                // Rebuild the descriptor the way SetSecurityInfo re-serializes it
+                Object& object = Lookup(record);
+                std::lock_guard<std::mutex> guard(object.lock);
+                object.descriptor.assign(record.size, static_cast<uint8_t>(record.flags));
+            }
+            break;
+
+        case TraceOp::AdjustPrivilege:
+            if (record.result == 0) {
+                std::lock_guard<std::mutex> guard(privilegesLock_);
+                privileges_[record.name] = (record.flags != 0);
+            }
+            break;
+
+        case TraceOp::ServiceControl:
+        case TraceOp::EventControl:
+        case TraceOp::ProcessControl:
+            if (record.result == 0) {
+                Object& object = Lookup(record);
+                std::lock_guard<std::mutex> guard(object.lock);
+                object.state = record.flags;
+            }
+            break;
+    }
+
+    return record.result;
+}
+
+size_t SimulatedBackend::ObjectCount() const {
+    std::shared_lock<std::shared_mutex> guard(objectsLock_);
+    return objects_.size();
+}
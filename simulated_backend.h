@@ -0,0 +1,70 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <utility>
+#include <vector>
+#include "trace.h"
+
+// Service time injected for one object type, to model how a real backend
+// behaves as concurrency rises. Operations beyond capacity queue, and every
+// caller queued behind them also slows the ones being served (lock and cache
+// contention), so throughput falls again past the knee.
+struct LatencyCurve {
+    unsigned capacity = 1;   // Operations served at once (1 = serialized, like the SCM)
+    uint64_t serviceNs = 0;  // Time one operation takes uncontended
+    double collapse = 0;     // Extra service time per queued caller, as a fraction of serviceNs
+    unsigned failAbove = 0;  // Callers in flight past which operations time out (ERROR_TIMEOUT); 0 = never
+};
+
+// In-memory stand-in for the Win32 object and security APIs. Each operation
+// does work proportional to what the real call moves (name lookup, descriptor
+// copies) and reports the outcome recorded in the trace, so a production trace
+// can be run off Windows with realistic access patterns.
+class SimulatedBackend {
+public:
+    // Applies to every later Execute on that object type. Set curves before
+    // operations start; they are not synchronized with Execute.
+    void SetLatencyCurve(TraceObject object, const LatencyCurve& curve);
+
+    // Performs the operation and returns its Win32 error code
+    uint32_t Execute(const TraceRecord& record);
+
+    size_t ObjectCount() const;
+
+private:
+    struct Object {
+        std::mutex lock;  // Guards the fields below
+        std::vector<uint8_t> descriptor;
+        uint32_t state = 0;
+        uint32_t opens = 0;
+    };
+
+    struct CurveState {
+        LatencyCurve curve;
+        std::mutex lock;
+        std::condition_variable freed;
+        unsigned busy = 0;
+        std::atomic<unsigned> inFlight{ 0 };
+    };
+
+    using ObjectKey = std::pair<TraceObject, std::wstring>;
+
+    Object& Lookup(const TraceRecord& record);
+
+    // Returns ERROR_TIMEOUT if the curve fails the call, otherwise 0
+    uint32_t ApplyCurve(CurveState& state);
+
+    // Replay threads only contend when they touch the same object: the map is
+    // locked exclusively just to insert an object seen for the first time
+    mutable std::shared_mutex objectsLock_;
+    std::map<ObjectKey, Object> objects_;
+    std::mutex privilegesLock_;
+    std::map<std::wstring, bool> privileges_;
+    std::map<TraceObject, std::unique_ptr<CurveState>> curves_;
+};
@@ -0,0 +1,290 @@
+#include "trace.h"
+#include "utf8.h"
+#include <atomic>
+#include <filesystem>
+#include <mutex>
+
+namespace {
+
+const char kTraceMagic[8] = { 'A', 'C', 'L', 'T', 'R', 'A', 'C', 'E' };
+const uint32_t kTraceVersion = 1;
+
+using Clock = std::chrono::steady_clock;
+
+struct Recorder {
+    std::mutex lock;
+    TraceWriter writer;
+    Clock::time_point start;
+    std::atomic<bool> active{false};
+    uint32_t nextThread = 0;  // Under lock
+    uint32_t generation = 0;  // Bumped per recording, so threads reused across recordings are renumbered
+};
+
+Recorder& GetRecorder() {
+    static Recorder recorder;
+    return recorder;
+}
+
+thread_local TraceObject t_contextObject = TraceObject::None;
+thread_local const std::wstring* t_contextName = nullptr;
+thread_local uint32_t t_threadIndex = 0;
+thread_local uint32_t t_threadGeneration = 0;  // 0 = no index yet
+
+// Called with the recorder lock held
+uint32_t CurrentThreadIndex(Recorder& recorder) {
+    if (t_threadGeneration != recorder.generation) {
+        t_threadIndex = recorder.nextThread++;
+        t_threadGeneration = recorder.generation;
+    }
+    return t_threadIndex;
+}
+
+void WriteVarint(std::ostream& out, uint64_t value) {
+    char bytes[10];
+    size_t count = 0;
+    do {
+        uint8_t byte = value & 0x7F;
+        value >>= 7;
+        bytes[count++] = static_cast<char>(value ? (byte | 0x80) : byte);
+    } while (value);
+    out.write(bytes, count);
+}
+
+bool ReadVarint(std::istream& in, uint64_t& value) {
+    value = 0;
+    for (unsigned shift = 0; shift < 64; shift += 7) {
+        int byte = in.get();
+        if (byte == std::char_traits<char>::eof()) {
+            return false;
+        }
+        value |= static_cast<uint64_t>(byte & 0x7F) << shift;
+        if (!(byte & 0x80)) {
+            return true;
+        }
+    }
+    return false;  // Longer than any value we write
+}
+
+bool ReadVarint32(std::istream& in, uint32_t& value) {
+    uint64_t wide = 0;
+    if (!ReadVarint(in, wide) || wide > UINT32_MAX) {
+        return false;
+    }
+    value = static_cast<uint32_t>(wide);
+    return true;
+}
+
+uint64_t ZigZag(int64_t value) {
+    return (static_cast<uint64_t>(value) << 1) ^ static_cast<uint64_t>(value >> 63);
+}
+
+int64_t UnZigZag(uint64_t value) {
+    return static_cast<int64_t>(value >> 1) ^ -static_cast<int64_t>(value & 1);
+}
+
+}  // namespace
+
+const wchar_t* TraceOpName(TraceOp op) {
+    switch (op) {
+        case TraceOp::Open:            return L"open";
+        case TraceOp::GetSecurity:     return L"get-security";
+        case TraceOp::SetSecurity:     return L"set-security";
+        case TraceOp::AdjustPrivilege: return L"adjust-privilege";
+        case TraceOp::ServiceControl:  return L"service-control";
+        case TraceOp::EventControl:    return L"event-control";
+        case TraceOp::ProcessControl:  return L"process-control";
+    }
+    return L"unknown";
+}
+
+const wchar_t* TraceObjectName(TraceObject object) {
+    switch (object) {
+        case TraceObject::None:           return L"-";
+        case TraceObject::File:           return L"file";
+        case TraceObject::Service:        return L"service";
+        case TraceObject::Process:        return L"process";
+        case TraceObject::Event:          return L"event";
+        case TraceObject::Token:          return L"token";
+        case TraceObject::ServiceManager: return L"scm";
+    }
+    return L"unknown";
+}
+
+bool TraceWriter::Open(const std::wstring& path) {
+    out_.open(std::filesystem::path(path), std::ios::binary | std::ios::trunc);
+    if (!out_) {
+        return false;
+    }
+
+    out_.write(kTraceMagic, sizeof(kTraceMagic));
+    uint8_t version[4] = {
+        static_cast<uint8_t>(kTraceVersion), static_cast<uint8_t>(kTraceVersion >> 8),
+        static_cast<uint8_t>(kTraceVersion >> 16), static_cast<uint8_t>(kTraceVersion >> 24),
+    };
+    out_.write(reinterpret_cast<const char*>(version), sizeof(version));
+    previousStartNs_ = 0;
+    return static_cast<bool>(out_);
+}
+
+void TraceWriter::Write(const TraceRecord& record) {
+    std::string name = ToUtf8(record.name);
+
+    out_.put(static_cast<char>(record.op));
+    out_.put(static_cast<char>(record.object));
+    WriteVarint(out_, record.thread);
+    WriteVarint(out_, record.flags);
+    WriteVarint(out_, record.size);
+    WriteVarint(out_, record.result);
+    // Records from different threads can finish out of start order, hence signed deltas
+    WriteVarint(out_, ZigZag(static_cast<int64_t>(record.startNs - previousStartNs_)));
+    WriteVarint(out_, record.durationNs);
+    WriteVarint(out_, name.size());
+    out_.write(name.data(), name.size());
+
+    previousStartNs_ = record.startNs;
+}
+
+bool TraceWriter::Close() {
+    out_.close();
+    return !out_.fail();
+}
+
+bool TraceReader::Open(const std::wstring& path) {
+    in_.open(std::filesystem::path(path), std::ios::binary);
+    if (!in_) {
+        return false;
+    }
+
+    char magic[sizeof(kTraceMagic)];
+    uint8_t version[4];
+    in_.read(magic, sizeof(magic));
+    in_.read(reinterpret_cast<char*>(version), sizeof(version));
+    if (!in_ || std::char_traits<char>::compare(magic, kTraceMagic, sizeof(magic)) != 0) {
+        corrupt_ = true;
+        return false;
+    }
+
+    uint32_t fileVersion = version[0] | (version[1] << 8) | (version[2] << 16) | (static_cast<uint32_t>(version[3]) << 24);
+    if (fileVersion != kTraceVersion) {
+        corrupt_ = true;
+        return false;
+    }
+
+    previousStartNs_ = 0;
+    return true;
+}
+
+bool TraceReader::Next(TraceRecord& record) {
+    int op = in_.get();
+    if (op == std::char_traits<char>::eof()) {
+        return false;  // Clean end of trace
+    }
+
+    int object = in_.get();
+    uint64_t startDelta = 0;
+    uint64_t nameLength = 0;
+    if (object == std::char_traits<char>::eof() ||
+        op < static_cast<int>(TraceOp::Open) || op > static_cast<int>(TraceOp::ProcessControl) ||
+        object > static_cast<int>(TraceObject::ServiceManager) ||
+        !ReadVarint32(in_, record.thread) ||
+        !ReadVarint32(in_, record.flags) ||
+        !ReadVarint32(in_, record.size) ||
+        !ReadVarint32(in_, record.result) ||
+        !ReadVarint(in_, startDelta) ||
+        !ReadVarint(in_, record.durationNs) ||
+        !ReadVarint(in_, nameLength) || nameLength > 0xFFFF) {
+        corrupt_ = true;
+        return false;
+    }
+
+    std::string name(static_cast<size_t>(nameLength), '\0');
+    in_.read(&name[0], name.size());
+    if (!in_) {
+        corrupt_ = true;
+        return false;
+    }
+
+    record.op = static_cast<TraceOp>(op);
+    record.object = static_cast<TraceObject>(object);
+    record.startNs = previousStartNs_ + static_cast<uint64_t>(UnZigZag(startDelta));
+    record.name = FromUtf8(name);
+    previousStartNs_ = record.startNs;
+    return true;
+}
+
+bool StartTraceRecording(const std::wstring& path) {
+    Recorder& recorder = GetRecorder();
+    std::lock_guard<std::mutex> guard(recorder.lock);
+    if (!recorder.writer.Open(path)) {
+        return false;
+    }
+    recorder.start = Clock::now();
+    recorder.nextThread = 0;
+    recorder.generation++;
+    recorder.active.store(true, std::memory_order_release);
+    return true;
+}
+
+void StopTraceRecording() {
+    Recorder& recorder = GetRecorder();
+    std::lock_guard<std::mutex> guard(recorder.lock);
+    if (recorder.active.exchange(false)) {
+        recorder.writer.Close();
+    }
+}
+
+bool IsTraceRecording() {
+    return GetRecorder().active.load(std::memory_order_relaxed);
+}
+
+TraceContext::TraceContext(TraceObject object, const std::wstring& name)
+    : previousObject_(t_contextObject), previousName_(t_contextName) {
+    t_contextObject = object;
+    t_contextName = &name;
+}
+
+TraceContext::~TraceContext() {
+    t_contextObject = previousObject_;
+    t_contextName = previousName_;
+}
+
+TraceSpan::TraceSpan(TraceOp op, TraceObject object, const std::wstring& name, uint32_t flags, uint32_t size)
+    : active_(IsTraceRecording()) {
+    if (!active_) {
+        return;
+    }
+    record_.op = op;
+    record_.object = object;
+    record_.name = name;
+    record_.flags = flags;
+    record_.size = size;
+    start_ = Clock::now();
+}
+
+TraceSpan::TraceSpan(TraceOp op, uint32_t flags, uint32_t size)
+    : TraceSpan(op, t_contextObject, t_contextName ? *t_contextName : std::wstring(), flags, size) {
+}
+
+TraceSpan::~TraceSpan() {
+    Finish(kTraceNotFinished);
+}
+
+void TraceSpan::Finish(uint32_t result) {
+    if (!active_) {
+        return;
+    }
+    active_ = false;
+
+    Clock::time_point end = Clock::now();
+    record_.result = result;
+    record_.durationNs = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(end - start_).count());
+
+    Recorder& recorder = GetRecorder();
+    std::lock_guard<std::mutex> guard(recorder.lock);
+    if (!recorder.active.load(std::memory_order_relaxed)) {
+        return;  // Recording stopped while the call was in flight
+    }
+    record_.thread = CurrentThreadIndex(recorder);
+    record_.startNs = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(start_ - recorder.start).count());
+    recorder.writer.Write(record_);
+}
@@ -0,0 +1,136 @@
+#pragma once
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+
+// Record of the backend operations (Win32 calls) the tool performs, written to
+// a compact binary trace so production workloads can be replayed elsewhere.
+
+enum class TraceOp : uint8_t {
+    Open = 1,         // CreateFile / OpenEvent / CreateEventEx / OpenProcess / OpenService / OpenSCManager
+    GetSecurity,      // GetSecurityInfo / GetNamedSecurityInfo; flags = SECURITY_INFORMATION, size = descriptor bytes
+    SetSecurity,      // SetSecurityInfo / SetNamedSecurityInfo; flags = SECURITY_INFORMATION, size = ACL or SID bytes
+    AdjustPrivilege,  // AdjustTokenPrivileges; flags = 1 to enable, 0 to disable
+    ServiceControl,   // flags = SERVICE_CONTROL_* code, or one of the kTraceService* values below
+    EventControl,     // flags = one of the kTraceEvent* values below
+    ProcessControl,   // TerminateProcess; flags = exit code
+};
+
+// TraceOp::SetSecurity flags for backends without SECURITY_INFORMATION;
+// same values as OWNER_SECURITY_INFORMATION / DACL_SECURITY_INFORMATION
+const uint32_t kTraceOwnerSecurity = 0x1;
+const uint32_t kTraceDaclSecurity  = 0x4;
+
+// TraceRecord::result of a span that was never finished, e.g. because the
+// caller returned early
+const uint32_t kTraceNotFinished = 0xFFFFFFFF;
+
+// TraceOp::ServiceControl flags for calls that are not ControlService
+const uint32_t kTraceServiceStart = 0x10000;  // StartService
+const uint32_t kTraceServiceQuery = 0x10001;  // QueryServiceStatusEx
+
+// TraceOp::EventControl flags
+const uint32_t kTraceEventSet        = 1;  // SetEvent
+const uint32_t kTraceEventReset      = 2;  // ResetEvent
+const uint32_t kTraceEventWait       = 3;  // WaitForSingleObject
+const uint32_t kTraceEventQueryState = 4;  // NtQueryEvent
+
+enum class TraceObject : uint8_t {
+    None = 0,
+    File,
+    Service,
+    Process,
+    Event,
+    Token,
+    ServiceManager,
+};
+
+struct TraceRecord {
+    TraceOp op = TraceOp::Open;
+    TraceObject object = TraceObject::None;
+    uint32_t thread = 0;       // Small per-trace thread index, in order of first use
+    uint32_t flags = 0;        // Desired access, SECURITY_INFORMATION, control code...
+    uint32_t size = 0;         // Bytes of security data passed or returned
+    uint32_t result = 0;       // Win32 error code, 0 on success
+    uint64_t startNs = 0;      // Relative to the start of the trace
+    uint64_t durationNs = 0;
+    std::wstring name;         // Object or privilege name
+};
+
+const wchar_t* TraceOpName(TraceOp op);
+const wchar_t* TraceObjectName(TraceObject object);
+
+// Trace file layout: "ACLTRACE" + uint32 version, then one record after another.
+// Records use LEB128 varints; start times are zigzag deltas from the previous
+// record, names are UTF-8.
+class TraceWriter {
+public:
+    bool Open(const std::wstring& path);
+    void Write(const TraceRecord& record);
+    bool Close();
+
+private:
+    std::ofstream out_;
+    uint64_t previousStartNs_ = 0;
+};
+
+class TraceReader {
+public:
+    bool Open(const std::wstring& path);
+    // Returns false at end of file or on a malformed record (see IsCorrupt)
+    bool Next(TraceRecord& record);
+    bool IsCorrupt() const { return corrupt_; }
+
+private:
+    std::ifstream in_;
+    uint64_t previousStartNs_ = 0;
+    bool corrupt_ = false;
+};
+
+// Process-wide recording. All functions are thread safe; when recording is
+// off, TraceSpan costs one relaxed atomic load.
+bool StartTraceRecording(const std::wstring& path);
+void StopTraceRecording();
+bool IsTraceRecording();
+
+// The object the current thread is working on. Spans created without a name
+// (e.g. SetSecurityInfo on a handle) are attributed to it.
+class TraceContext {
+public:
+    TraceContext(TraceObject object, const std::wstring& name);
+    ~TraceContext();
+
+    TraceContext(const TraceContext&) = delete;
+    TraceContext& operator=(const TraceContext&) = delete;
+
+private:
+    TraceObject previousObject_;
+    const std::wstring* previousName_;
+};
+
+// Times one backend call:
+//     TraceSpan trace(TraceOp::Open, TraceObject::File, path, desiredAccess);
+//     HANDLE h = CreateFileW(...);
+//     trace.Finish(h != INVALID_HANDLE_VALUE ? ERROR_SUCCESS : GetLastError());
+// A span destroyed without Finish is recorded with kTraceNotFinished.
+class TraceSpan {
+public:
+    TraceSpan(TraceOp op, TraceObject object, const std::wstring& name, uint32_t flags, uint32_t size = 0);
+    // Attributed to the current TraceContext
+    TraceSpan(TraceOp op, uint32_t flags, uint32_t size = 0);
+    ~TraceSpan();
+
+    TraceSpan(const TraceSpan&) = delete;
+    TraceSpan& operator=(const TraceSpan&) = delete;
+
+    // For calls that only learn the size from their result (GetSecurity)
+    void SetSize(uint32_t size) { record_.size = size; }
+    void Finish(uint32_t result);
+
+private:
+    bool active_;
+    TraceRecord record_;
+    std::chrono::steady_clock::time_point start_;
+};
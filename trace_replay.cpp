@@ -0,0 +1,150 @@
+#include "trace_replay.h"
+#include "latency_histogram.h"
+#include "simulated_backend.h"
+#include "trace.h"
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cwchar>
+#include <iostream>
+#include <map>
+#include <thread>
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+constexpr size_t kOpCount = static_cast<size_t>(TraceOp::ProcessControl) + 1;
+
+struct OpStats {
+    LatencyHistogram recorded;
+    LatencyHistogram replayed;
+};
+
+using OpStatsTable = std::array<OpStats, kOpCount>;
+
+void PrintRecord(const TraceRecord& record) {
+    wchar_t line[160];
+    swprintf(line, 160, L"  %10ls  t%-3u %-16ls %-8ls flags=0x%08x size=%-6u result=%-5u %10ls  ",
+             FormatDuration(record.startNs).c_str(), record.thread,
+             TraceOpName(record.op), TraceObjectName(record.object),
+             record.flags, record.size, record.result,
+             FormatDuration(record.durationNs).c_str());
+    std::wcout << line << record.name << L"\n";
+}
+
+void ReplayThread(SimulatedBackend& backend, const std::vector<const TraceRecord*>& records,
+                  bool paced, Clock::time_point start, OpStatsTable& stats) {
+    for (const TraceRecord* record : records) {
+        if (paced) {
+            std::this_thread::sleep_until(start + std::chrono::nanoseconds(record->startNs));
+        }
+
+        Clock::time_point opStart = Clock::now();
+        backend.Execute(*record);
+        auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - opStart).count();
+
+        OpStats& opStats = stats[static_cast<size_t>(record->op)];
+        opStats.recorded.Record(record->durationNs);
+        opStats.replayed.Record(static_cast<uint64_t>(elapsed));
+    }
+}
+
+}  // namespace
+
+bool ParseReplayOptions(const std::vector<std::wstring>& args, size_t first, ReplayOptions& options) {
+    for (size_t i = first; i < args.size(); i++) {
+        if (args[i] == L"--paced") {
+            options.paced = true;
+        } else if (args[i] == L"--print") {
+            options.print = true;
+        } else {
+            std::wcerr << L"Unknown replay option: " << args[i] << L"\n";
+            std::wcerr << L"Valid options: --paced, --print\n";
+            return false;
+        }
+    }
+    return true;
+}
+
+int ReplayTrace(const std::wstring& path, const ReplayOptions& options) {
+    TraceReader reader;
+    if (!reader.Open(path)) {
+        std::wcerr << L"Failed to open trace: " << path << (reader.IsCorrupt() ? L" (not a trace file)" : L"") << L"\n";
+        return 1;
+    }
+
+    // Load the whole trace up front so file reads don't show up in replay timings
+    std::vector<TraceRecord> records;
+    TraceRecord record;
+    while (reader.Next(record)) {
+        records.push_back(record);
+    }
+    if (reader.IsCorrupt()) {
+        std::wcerr << L"Trace is truncated or corrupt after " << records.size() << L" records\n";
+        return 1;
+    }
+
+    uint64_t recordedSpanNs = 0;
+    std::map<uint32_t, std::vector<const TraceRecord*>> byThread;
+    for (const TraceRecord& entry : records) {
+        byThread[entry.thread].push_back(&entry);
+        recordedSpanNs = std::max(recordedSpanNs, entry.startNs + entry.durationNs);
+    }
+
+    std::wcout << L"Trace        : " << path << L"\n";
+    std::wcout << L"Records      : " << records.size() << L" on " << byThread.size() << L" thread(s), recorded over "
+               << FormatDuration(recordedSpanNs) << L"\n";
+
+    if (options.print) {
+        for (const TraceRecord& entry : records) {
+            PrintRecord(entry);
+        }
+    }
+
+    // Records are written when calls finish; replay them in start order
+    for (auto& [thread, threadRecords] : byThread) {
+        std::stable_sort(threadRecords.begin(), threadRecords.end(),
+                         [](const TraceRecord* a, const TraceRecord* b) { return a->startNs < b->startNs; });
+    }
+
+    SimulatedBackend backend;
+    std::vector<OpStatsTable> threadStats(byThread.size());
+    std::vector<std::thread> threads;
+
+    Clock::time_point start = Clock::now();
+    size_t index = 0;
+    for (const auto& [thread, threadRecords] : byThread) {
+        threads.emplace_back(ReplayThread, std::ref(backend), std::cref(threadRecords),
+                             options.paced, start, std::ref(threadStats[index++]));
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    uint64_t replayNs = static_cast<uint64_t>(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count());
+
+    std::wcout << L"Replayed     : " << (options.paced ? L"at recorded pacing" : L"at full speed")
+               << L" in " << FormatDuration(replayNs);
+    if (replayNs) {
+        std::wcout << L" (" << static_cast<uint64_t>(records.size() * 1e9 / replayNs) << L" ops/s)";
+    }
+    std::wcout << L", " << backend.ObjectCount() << L" simulated object(s)\n";
+
+    for (size_t op = 0; op < kOpCount; op++) {
+        OpStats merged;
+        for (const OpStatsTable& stats : threadStats) {
+            merged.recorded.Merge(stats[op].recorded);
+            merged.replayed.Merge(stats[op].replayed);
+        }
+        if (merged.recorded.Count() == 0) {
+            continue;
+        }
+
+        std::wcout << L"\n" << TraceOpName(static_cast<TraceOp>(op)) << L"\n";
+        merged.recorded.Print(std::wcout, L"  Recorded");
+        merged.replayed.Print(std::wcout, L"  Replayed");
+    }
+
+    return 0;
+}
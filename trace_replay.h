@@ -0,0 +1,16 @@
+#pragma once
+#include <string>
+#include <vector>
+
+struct ReplayOptions {
+    bool paced = false;  // Issue each operation at its recorded offset instead of back to back
+    bool print = false;  // List the records before replaying them
+};
+
+// Parses "--paced --print" from args[first..]
+bool ParseReplayOptions(const std::vector<std::wstring>& args, size_t first, ReplayOptions& options);
+
+// Runs a trace written by --trace against SimulatedBackend, one replay thread
+// per recorded thread, and prints recorded vs replayed latency per operation.
+// Returns a process exit code.
+int ReplayTrace(const std::wstring& path, const ReplayOptions& options);
@@ -0,0 +1,156 @@
+#include "uring.h"
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <vector>
+
+namespace {
+
+int SysSetup(unsigned entries, io_uring_params* params) {
+    return static_cast<int>(syscall(__NR_io_uring_setup, entries, params));
+}
+
+int SysEnter(int fd, unsigned toSubmit, unsigned minComplete, unsigned flags) {
+    return static_cast<int>(syscall(__NR_io_uring_enter, fd, toSubmit, minComplete, flags, nullptr, 0));
+}
+
+int SysRegister(int fd, unsigned opcode, void* arg, unsigned count) {
+    return static_cast<int>(syscall(__NR_io_uring_register, fd, opcode, arg, count));
+}
+
+template <typename T>
+T* RingField(void* ring, uint32_t offset) {
+    return reinterpret_cast<T*>(static_cast<char*>(ring) + offset);
+}
+
+}  // namespace
+
+IoUring::~IoUring() {
+    if (sqes_) {
+        munmap(sqes_, sqesSize_);
+    }
+    if (cqRing_ && cqRing_ != sqRing_) {
+        munmap(cqRing_, cqRingSize_);
+    }
+    if (sqRing_) {
+        munmap(sqRing_, sqRingSize_);
+    }
+    if (fd_ >= 0) {
+        close(fd_);
+    }
+}
+
+int IoUring::Init(unsigned entries) {
+    io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    fd_ = SysSetup(entries, &params);
+    if (fd_ < 0) {
+        return errno;
+    }
+    entries_ = params.sq_entries;
+
+    sqRingSize_ = params.sq_off.array + params.sq_entries * sizeof(uint32_t);
+    cqRingSize_ = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    bool singleMmap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+    if (singleMmap) {
+        sqRingSize_ = cqRingSize_ = std::max(sqRingSize_, cqRingSize_);
+    }
+
+    sqRing_ = mmap(nullptr, sqRingSize_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_SQ_RING);
+    if (sqRing_ == MAP_FAILED) {
+        sqRing_ = nullptr;
+        return errno;
+    }
+    if (singleMmap) {
+        cqRing_ = sqRing_;
+    } else {
+        cqRing_ = mmap(nullptr, cqRingSize_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_CQ_RING);
+        if (cqRing_ == MAP_FAILED) {
+            cqRing_ = nullptr;
+            return errno;
+        }
+    }
+
+    sqesSize_ = params.sq_entries * sizeof(io_uring_sqe);
+    void* sqes = mmap(nullptr, sqesSize_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_SQES);
+    if (sqes == MAP_FAILED) {
+        return errno;
+    }
+    sqes_ = static_cast<io_uring_sqe*>(sqes);
+
+    sqHead_ = RingField<unsigned>(sqRing_, params.sq_off.head);
+    sqTail_ = RingField<unsigned>(sqRing_, params.sq_off.tail);
+    sqMask_ = *RingField<unsigned>(sqRing_, params.sq_off.ring_mask);
+    sqeTail_ = submittedTail_ = *sqTail_;
+
+    // SQEs are always submitted in slot order, so the indirection array is the identity
+    unsigned* array = RingField<unsigned>(sqRing_, params.sq_off.array);
+    for (unsigned i = 0; i < params.sq_entries; i++) {
+        array[i] = i;
+    }
+
+    cqHead_ = RingField<unsigned>(cqRing_, params.cq_off.head);
+    cqTail_ = RingField<unsigned>(cqRing_, params.cq_off.tail);
+    cqMask_ = *RingField<unsigned>(cqRing_, params.cq_off.ring_mask);
+    cqes_ = RingField<io_uring_cqe>(cqRing_, params.cq_off.cqes);
+
+    // Kernels before 5.6 have no probe, and none of the opcodes we want either
+    const unsigned probeOps = 256;
+    std::vector<uint8_t> buffer(sizeof(io_uring_probe) + probeOps * sizeof(io_uring_probe_op));
+    auto probe = reinterpret_cast<io_uring_probe*>(buffer.data());
+    if (SysRegister(fd_, IORING_REGISTER_PROBE, probe, probeOps) == 0) {
+        for (unsigned i = 0; i < probe->ops_len && i < probeOps; i++) {
+            if (probe->ops[i].flags & IO_URING_OP_SUPPORTED) {
+                supported_[probe->ops[i].op] = 1;
+            }
+        }
+    }
+    return 0;
+}
+
+bool IoUring::Supports(uint8_t opcode) const {
+    return fd_ >= 0 && supported_[opcode] != 0;
+}
+
+io_uring_sqe* IoUring::GetSqe() {
+    unsigned head = __atomic_load_n(sqHead_, __ATOMIC_ACQUIRE);
+    if (sqeTail_ - head >= entries_) {
+        return nullptr;
+    }
+    io_uring_sqe* sqe = &sqes_[sqeTail_ & sqMask_];
+    sqeTail_++;
+    memset(sqe, 0, sizeof(*sqe));
+    return sqe;
+}
+
+int IoUring::Submit(unsigned minComplete) {
+    __atomic_store_n(sqTail_, sqeTail_, __ATOMIC_RELEASE);
+
+    for (;;) {
+        unsigned toSubmit = sqeTail_ - submittedTail_;
+        if (toSubmit == 0 && minComplete == 0) {
+            return 0;
+        }
+
+        int result = SysEnter(fd_, toSubmit, minComplete, minComplete ? IORING_ENTER_GETEVENTS : 0);
+        if (result < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return errno;
+        }
+
+        submittedTail_ += static_cast<unsigned>(result);
+        if (static_cast<unsigned>(result) == toSubmit) {
+            return 0;
+        }
+        if (result == 0) {
+            return EAGAIN;
+        }
+        // Partial submission: the kernel ran short of memory or stopped at a
+        // bad SQE; loop to push the rest (waiting again is harmless)
+    }
+}
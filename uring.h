@@ -0,0 +1,87 @@
+#pragma once
+#include <linux/io_uring.h>
+#include <cstddef>
+#include <cstdint>
+
+// Minimal io_uring over the raw syscalls, so the tool has no liburing
+// dependency. One ring is driven by one thread: queue SQEs with GetSqe(),
+// then Submit() hands the whole batch to the kernel in a single
+// io_uring_enter and optionally waits for completions, which are drained in
+// bulk with ForEachCompletion().
+class IoUring {
+public:
+    IoUring() = default;
+    ~IoUring();
+
+    IoUring(const IoUring&) = delete;
+    IoUring& operator=(const IoUring&) = delete;
+
+    // Returns 0 or an errno value. ENOSYS / EPERM mean io_uring is missing or
+    // blocked (old kernel, seccomp, io_uring_disabled) and the caller should
+    // fall back to synchronous calls.
+    int Init(unsigned entries);
+
+    // Whether the running kernel implements an opcode
+    bool Supports(uint8_t opcode) const;
+
+    // Next free submission slot, zeroed; nullptr when the submission queue is full
+    io_uring_sqe* GetSqe();
+
+    // Submits every SQE queued since the last call and waits until at least
+    // minComplete completions are available. Returns 0 or an errno value.
+    int Submit(unsigned minComplete);
+
+    // Calls handler(const io_uring_cqe&) for each available completion and
+    // returns how many there were
+    template <typename Handler>
+    unsigned ForEachCompletion(Handler&& handler) {
+        unsigned head = *cqHead_;
+        unsigned tail = __atomic_load_n(cqTail_, __ATOMIC_ACQUIRE);
+        unsigned count = 0;
+        for (; head != tail; head++, count++) {
+            handler(cqes_[head & cqMask_]);
+        }
+        __atomic_store_n(cqHead_, head, __ATOMIC_RELEASE);
+        return count;
+    }
+
+    // Takes back the SQEs queued since the last successful Submit(), which
+    // the kernel has not seen, calling handler(const io_uring_sqe&) for each;
+    // for cleaning up after Submit() fails. Returns how many there were.
+    template <typename Handler>
+    unsigned DiscardUnsubmitted(Handler&& handler) {
+        unsigned count = 0;
+        for (unsigned tail = submittedTail_; tail != sqeTail_; tail++, count++) {
+            handler(sqes_[tail & sqMask_]);
+        }
+        sqeTail_ = submittedTail_;
+        __atomic_store_n(sqTail_, sqeTail_, __ATOMIC_RELEASE);
+        return count;
+    }
+
+    unsigned Entries() const { return entries_; }
+
+private:
+    int fd_ = -1;
+    unsigned entries_ = 0;
+
+    void* sqRing_ = nullptr;
+    void* cqRing_ = nullptr;
+    size_t sqRingSize_ = 0;
+    size_t cqRingSize_ = 0;
+    io_uring_sqe* sqes_ = nullptr;
+    size_t sqesSize_ = 0;
+
+    unsigned* sqHead_ = nullptr;
+    unsigned* sqTail_ = nullptr;
+    unsigned sqMask_ = 0;
+    unsigned sqeTail_ = 0;       // Next slot GetSqe() hands out
+    unsigned submittedTail_ = 0; // Slots up to here have been passed to the kernel
+
+    unsigned* cqHead_ = nullptr;
+    unsigned* cqTail_ = nullptr;
+    unsigned cqMask_ = 0;
+    io_uring_cqe* cqes_ = nullptr;
+
+    uint8_t supported_[256] = {};
+};
@@ -0,0 +1,7 @@
+#pragma once
+#include <string>
+
+// Conversions between std::wstring (UTF-16 on Windows, UTF-32 elsewhere) and UTF-8.
+// Used for on-disk formats that must be readable on both platforms.
+std::string ToUtf8(const std::wstring& text);
+std::wstring FromUtf8(const std::string& text);